@@ -0,0 +1,191 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tango {
+namespace async {
+
+namespace details {
+
+// Move-only type erased task. std::function requires copiable targets, but
+// the queued actions may carry non copiable arguments (see NonCopiable test).
+class Task {
+  struct Base {
+    virtual ~Base() = default;
+    virtual void run() = 0;
+  };
+
+  template <class Functor, class ...Params>
+  class Bound : public Base {
+    Functor func_;
+    std::tuple<Params...> params_;
+
+    template <std::size_t ...I>
+    void apply(std::index_sequence<I...>) {
+      func_(std::move(std::get<I>(params_))...);
+    }
+
+  public:
+    template <class F, class ...P>
+    Bound(F &&func, P &&...params)
+        : func_(std::forward<F>(func)), params_(std::forward<P>(params)...) {}
+
+    void run() override {
+      apply(std::index_sequence_for<Params...>());
+    }
+  };
+
+  std::unique_ptr<Base> impl_;
+
+public:
+  Task() = default;
+
+  template <class Functor, class ...Params>
+  static Task bind(Functor &&func, Params &&...params) {
+    Task task;
+    task.impl_.reset(
+      new Bound<typename std::decay<Functor>::type, typename std::decay<Params>::type...>(
+        std::forward<Functor>(func), std::forward<Params>(params)...));
+    return task;
+  }
+
+  void operator()() { impl_->run(); }
+};
+
+}
+
+// A thread pool whose queue is split into priority lanes; lane 0 is the most
+// urgent. Workers always serve the most urgent non-empty lane, except that a
+// lane passed over 'starvation_limit' times in a row is served next so bulk
+// stages still make progress under a steady latency-critical load.
+//
+// lane(n) returns an executor usable anywhere jobs.hpp takes one, e.g.
+//   job.then(pool.lane(0), critical).then(pool.lane(1), bulk);
+class PriorityExecutor {
+public:
+  class Lane {
+    friend class PriorityExecutor;
+    PriorityExecutor *owner_;
+    unsigned priority_;
+
+    Lane(PriorityExecutor *owner, unsigned priority) : owner_(owner), priority_(priority) {}
+
+  public:
+    template <class Functor, class ...Params>
+    void operator()(Functor &&func, Params &&...params) {
+      owner_->post(priority_, details::Task::bind(std::forward<Functor>(func), std::forward<Params>(params)...));
+    }
+
+    unsigned priority() const { return priority_; }
+  };
+
+  PriorityExecutor(unsigned threads, unsigned lanes = 2, unsigned starvation_limit = 8)
+      : queues_(lanes), skipped_(lanes, 0), starvation_limit_(starvation_limit), stopping_(false) {
+    lanes_.reserve(lanes);
+    for (unsigned i = 0; i < lanes; ++i) {
+      lanes_.push_back(Lane(this, i));
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+      workers_.emplace_back([this]() { work(); });
+    }
+  }
+
+  PriorityExecutor(const PriorityExecutor &) = delete;
+  PriorityExecutor &operator=(const PriorityExecutor &) = delete;
+
+  // Runs everything already queued, then joins the workers.
+  ~PriorityExecutor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
+
+  Lane *lane(unsigned priority) { return &lanes_.at(priority); }
+
+  unsigned num_lanes() const { return static_cast<unsigned>(lanes_.size()); }
+
+  void post(unsigned priority, details::Task &&task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queues_.at(priority).push_back(std::move(task));
+    }
+    ready_.notify_one();
+  }
+
+private:
+  // Called with mutex_ held and at least one task queued.
+  unsigned pick() {
+    unsigned chosen = static_cast<unsigned>(queues_.size());
+    for (unsigned i = 0; i < queues_.size(); ++i) {
+      if (!queues_[i].empty() && skipped_[i] >= starvation_limit_) {
+        chosen = i;
+        break;
+      }
+    }
+    if (chosen == queues_.size()) {
+      chosen = 0;
+      while (queues_[chosen].empty()) {
+        ++chosen;
+      }
+    }
+    for (unsigned i = 0; i < queues_.size(); ++i) {
+      if (i == chosen) {
+        skipped_[i] = 0;
+      } else if (!queues_[i].empty()) {
+        ++skipped_[i];
+      }
+    }
+    return chosen;
+  }
+
+  bool has_work() const {
+    for (const auto &queue : queues_) {
+      if (!queue.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void work() {
+    for (;;) {
+      details::Task task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return stopping_ || has_work(); });
+        if (!has_work()) {
+          return;
+        }
+        auto &queue = queues_[pick()];
+        task = std::move(queue.front());
+        queue.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::vector<Lane> lanes_;
+  std::vector<std::deque<details::Task>> queues_;
+  std::vector<unsigned> skipped_;
+  unsigned starvation_limit_;
+  bool stopping_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::vector<std::thread> workers_;
+};
+
+}
+}
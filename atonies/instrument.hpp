@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Per-stage timing for Job pipelines. Build with -DTANGO_ASYNC_INSTRUMENT to
+// turn the hooks in jobs.hpp on; without it they collapse to nothing and the
+// histograms below are only there for whoever wants to use them directly.
+//
+// A stage is identified by the type of the user functor, so every lambda
+// passed to then()/make_job() gets its own row no matter how many times the
+// pipeline is rebuilt. Functors sharing a type (e.g. plain function
+// pointers) share a row.
+
+namespace tango {
+namespace async {
+
+// Lock-free log-linear histogram of durations, in the spirit of
+// HdrHistogram: values below 2^SubBits are exact, above that every power of
+// two is split in 2^SubBits buckets, which bounds the relative error at
+// 1/2^SubBits (~6%).
+class LatencyHistogram {
+public:
+  enum : unsigned {
+    SubBits = 4,
+    SubCount = 1u << SubBits,
+    NumBuckets = (64 - SubBits + 1) * SubCount
+  };
+
+  LatencyHistogram() : sum_(0), max_(0) {
+    for (auto &b : buckets_) {
+      b.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void record(uint64_t value) {
+    buckets_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  uint64_t count() const {
+    uint64_t n = 0;
+    for (const auto &b : buckets_) {
+      n += b.load(std::memory_order_relaxed);
+    }
+    return n;
+  }
+
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  double mean() const {
+    uint64_t n = count();
+    return n ? double(sum()) / n : 0.0;
+  }
+
+  // Upper bound of the bucket holding the q-th quantile, q in [0, 1]
+  uint64_t percentile(double q) const {
+    uint64_t n = count();
+    if (!n) {
+      return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(q * n + 0.5));
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < NumBuckets; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= rank) {
+        return std::min(upper_bound_of(i), max());
+      }
+    }
+    return max();
+  }
+
+  static unsigned bucket_of(uint64_t value) {
+    if (value < SubCount) {
+      return unsigned(value);
+    }
+    unsigned shift = 63 - __builtin_clzll(value) - SubBits;
+    return (shift + 1) * SubCount + unsigned(value >> shift) - SubCount;
+  }
+
+  static uint64_t upper_bound_of(unsigned bucket) {
+    if (bucket < SubCount) {
+      return bucket;
+    }
+    unsigned shift = bucket / SubCount - 1;
+    uint64_t sub = bucket % SubCount + SubCount;
+    return ((sub + 1) << shift) - 1;
+  }
+
+private:
+  std::atomic<uint64_t> buckets_[NumBuckets];
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+namespace details {
+
+// Cheapest monotonic clock around: the TSC where there is one (constant rate
+// on anything recent), steady_clock otherwise. Stage histograms are kept in
+// ticks and only scaled to nanoseconds when dumped.
+inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline double ticks_per_ns() {
+#if defined(__x86_64__) || defined(__i386__)
+  static const double rate = []() {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t t0 = ticks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t t1 = ticks();
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    return double(t1 - t0) / elapsed.count();
+  }();
+  return rate;
+#else
+  return 1.0;
+#endif
+}
+
+}
+
+struct StageStats {
+  StageStats(const std::string &kind, const std::string &name) : kind(kind), name(name), hops(0) {}
+
+  const std::string kind;
+  const std::string name;
+  // Time between the previous stage handing its result to an executor and
+  // this stage starting to run. Only recorded for executor hops. In ticks.
+  LatencyHistogram queue_wait;
+  // Time spent in the stage itself, not counting later stages that ran
+  // inline from its callbacks. In ticks.
+  LatencyHistogram run;
+  std::atomic<uint64_t> hops;
+};
+
+class StageRegistry {
+public:
+  static StageRegistry &instance() {
+    static StageRegistry registry;
+    return registry;
+  }
+
+  StageStats *add(const std::string &kind, const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stages_.emplace_back(new StageStats(kind, name));
+    return stages_.back().get();
+  }
+
+  // Both dumps report nanoseconds
+  void dump_text(std::ostream &out) const {
+    double scale = 1 / details::ticks_per_ns();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &stage : stages_) {
+      out << stage->kind << " " << stage->name << "\n"
+          << "  hops " << stage->hops.load(std::memory_order_relaxed) << "\n";
+      text_line(out, "wait", stage->queue_wait, scale);
+      text_line(out, "run ", stage->run, scale);
+    }
+  }
+
+  void dump_json(std::ostream &out) const {
+    double scale = 1 / details::ticks_per_ns();
+    std::lock_guard<std::mutex> lock(mutex_);
+    out << "[";
+    for (size_t i = 0; i < stages_.size(); ++i) {
+      const StageStats &stage = *stages_[i];
+      out << (i ? ",\n " : "")
+          << "{\"kind\":\"" << stage.kind << "\","
+          << "\"name\":";
+      json_string(out, stage.name);
+      out << ",\"hops\":" << stage.hops.load(std::memory_order_relaxed)
+          << ",\"wait\":";
+      json_histogram(out, stage.queue_wait, scale);
+      out << ",\"run\":";
+      json_histogram(out, stage.run, scale);
+      out << "}";
+    }
+    out << "]\n";
+  }
+
+private:
+  static void text_line(std::ostream &out, const char *what, const LatencyHistogram &h, double scale) {
+    out << "  " << what
+        << " count " << h.count()
+        << " mean " << uint64_t(h.mean() * scale)
+        << " p50 " << uint64_t(h.percentile(0.5) * scale)
+        << " p90 " << uint64_t(h.percentile(0.9) * scale)
+        << " p99 " << uint64_t(h.percentile(0.99) * scale)
+        << " max " << uint64_t(h.max() * scale) << " ns\n";
+  }
+
+  static void json_histogram(std::ostream &out, const LatencyHistogram &h, double scale) {
+    out << "{\"count\":" << h.count()
+        << ",\"mean\":" << uint64_t(h.mean() * scale)
+        << ",\"p50\":" << uint64_t(h.percentile(0.5) * scale)
+        << ",\"p90\":" << uint64_t(h.percentile(0.9) * scale)
+        << ",\"p99\":" << uint64_t(h.percentile(0.99) * scale)
+        << ",\"max\":" << uint64_t(h.max() * scale) << "}";
+  }
+
+  static void json_string(std::ostream &out, const std::string &s) {
+    out << '"';
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        out << '\\' << c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        out << ' ';
+      } else {
+        out << c;
+      }
+    }
+    out << '"';
+  }
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<StageStats>> stages_;
+};
+
+namespace details {
+
+template <class T>
+std::string type_name() {
+  const char *name = typeid(T).name();
+#if defined(__GNUG__)
+  int status = 0;
+  std::unique_ptr<char, void (*)(void *)> demangled(abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free);
+  if (status == 0) {
+    return demangled.get();
+  }
+#endif
+  return name;
+}
+
+// What a stage runs as; one functor type can be a stage of each kind
+enum class StageKind { Sync, Async, Batch };
+
+inline const char *kind_name(StageKind kind) {
+  switch (kind) {
+  case StageKind::Sync:
+    return "sync";
+  case StageKind::Async:
+    return "async";
+  case StageKind::Batch:
+    return "batch";
+  }
+  return "?";
+}
+
+#ifdef TANGO_ASYNC_INSTRUMENT
+
+template <class Functor, StageKind Kind>
+StageStats *registered_stage() {
+  static StageStats *stage = StageRegistry::instance().add(kind_name(Kind), type_name<Functor>());
+  return stage;
+}
+
+template <class Functor, StageKind Kind>
+StageStats *stage_of() {
+  return registered_stage<typename std::decay<Functor>::type, Kind>();
+}
+
+// Records the exclusive run time of a stage. Stages run inline from a
+// callback nest on the same thread; their time is subtracted from the
+// enclosing stage.
+class StageTimer {
+  StageStats *stage_;
+  StageTimer *parent_;
+  uint64_t start_;
+  uint64_t nested_;
+
+  static StageTimer *&current() {
+    static thread_local StageTimer *timer = nullptr;
+    return timer;
+  }
+
+public:
+  StageTimer(StageStats *stage) : stage_(stage), parent_(current()), start_(ticks()), nested_(0) {
+    current() = this;
+  }
+
+  StageTimer(const StageTimer &) = delete;
+  StageTimer &operator=(const StageTimer &) = delete;
+
+  ~StageTimer() {
+    uint64_t total = ticks() - start_;
+    stage_->run.record(total - std::min(total, nested_));
+    if (parent_) {
+      parent_->nested_ += total;
+    }
+    current() = parent_;
+  }
+};
+
+// Carries the time an action was handed to an executor, so the wait can be
+// recorded when the executor gets round to running it.
+template <class Action>
+class Hop {
+  Action action_;
+  StageStats *stage_;
+  uint64_t queued_;
+
+public:
+  Hop(Action &&action, StageStats *stage) : action_(std::move(action)), stage_(stage), queued_(ticks()) {
+    stage_->hops.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  template <class ...Args>
+  void operator()(Args &&...args) {
+    stage_->queue_wait.record(ticks() - queued_);
+    action_(std::forward<Args>(args)...);
+  }
+};
+
+template <class Action>
+Hop<typename std::decay<Action>::type> hop(StageStats *stage, Action &&action) {
+  return Hop<typename std::decay<Action>::type>(std::move(action), stage);
+}
+
+#else
+
+template <class Functor, StageKind Kind>
+constexpr StageStats *stage_of() { return nullptr; }
+
+struct StageTimer {
+  StageTimer(StageStats *) {}
+};
+
+template <class Action>
+Action &&hop(StageStats *, Action &&action) { return std::forward<Action>(action); }
+
+#endif
+
+}
+
+}
+}
@@ -2,12 +2,19 @@
 
 #include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "instrument.hpp"
 
 namespace tango {
 namespace async {
 
 // Forward declaration
 template <class, class ...> class Job;
+template <class> class Batcher;
 
 namespace details {
 
@@ -118,6 +125,10 @@ template <class R>
 using Callback = NonVoidFunc<void, R>;
 using ErrorCallback = Callback<std::exception_ptr>;
 
+// Selects the Job constructor that shares an existing step instead of
+// copying a new one
+struct SharedStep {};
+
 // is_job
 template <class T> class is_job : public std::false_type {};
 template <class T, class ...U> class is_job<Job<T, U...>> : public std::true_type {};
@@ -169,9 +180,14 @@ class SyncStep<Functor, Ret(Args...)> : public Step<Ret, Args...> {
   Functor func_;
 
 public:
+  typedef Functor functor_type;
+
   SyncStep(Functor &&func) : func_(std::move(func)) {}
 
+  static StageStats *stage() { return stage_of<Functor, StageKind::Sync>(); }
+
   void operator()(details::Callback<Ret> done, details::ErrorCallback error, Args &&...args) override {
+    StageTimer timer(stage());
     Sync<Ret, Args...>::run(func_, done, error, std::forward<Args>(args)...);
   }
 };
@@ -183,10 +199,15 @@ class AsyncStep<Functor, Ret(Args...)> : public Step<Ret, Args...> {
   Functor func_;
 
 public:
+  typedef Functor functor_type;
+
   AsyncStep(Functor &&functor) :
       func_(std::move(functor)) {}
 
+  static StageStats *stage() { return stage_of<Functor, StageKind::Async>(); }
+
   void operator()(details::Callback<Ret> done, details::ErrorCallback error, Args &&...args) override {
+    StageTimer timer(stage());
     async<Ret>(func_, done, error, std::forward<Args>(args)...);
   }
 };
@@ -203,7 +224,7 @@ public:
       : executor_(executor), func_(std::move(func)) {}
 
   void operator()(details::Callback<Ret> done, details::ErrorCallback error, Args &&...args) override {
-    (*executor_)(std::move(func_), done, error, std::forward<Args>(args)...);
+    (*executor_)(hop(Functor::stage(), std::move(func_)), done, error, std::forward<Args>(args)...);
   }
 };
 
@@ -218,6 +239,7 @@ public:
       : func_(std::move(func)), done_(std::move(done)), error_(error) {}
 
   void operator()(Old &&...old) {
+    StageTimer timer(stage_of<Functor, StageKind::Sync>());
     Sync<NewRetType, Old...>::run(func_, done_, error_, std::forward<Old>(old)...);
   }
 };
@@ -233,6 +255,7 @@ public:
       : func_(std::move(func)), done_(std::move(done)), error_(error) {}
 
   void operator()(Old &&...old) {
+    StageTimer timer(stage_of<Functor, StageKind::Async>());
     async<NewRetType>(func_, done_, error_, std::forward<Old>(old)...);
   }
 };
@@ -249,7 +272,9 @@ public:
       : executor_(executor), func_(std::move(func)), done_(std::move(done)), error_(error) {}
 
   void operator()(Old &&...old) {
-    (*executor_)(SyncActionQueued<Functor, NewRetType, Old...>(std::move(func_), std::move(done_), error_), std::forward<Old>(old)...);
+    (*executor_)(
+      hop(stage_of<Functor, StageKind::Sync>(), SyncActionQueued<Functor, NewRetType, Old...>(std::move(func_), std::move(done_), error_)),
+      std::forward<Old>(old)...);
   }
 };
 
@@ -265,7 +290,9 @@ public:
       : executor_(executor), func_(std::move(func)), done_(std::move(done)), error_(error) {}
 
   void operator()(Old &&...old) {
-    (*executor_)(AsyncActionQueued<Functor, NewRetType, Old...>(std::move(func_), std::move(done_), error_), std::forward<Old>(old)...);
+    (*executor_)(
+      hop(stage_of<Functor, StageKind::Async>(), AsyncActionQueued<Functor, NewRetType, Old...>(std::move(func_), std::move(done_), error_)),
+      std::forward<Old>(old)...);
   }
 };
 
@@ -378,6 +405,124 @@ public:
   }
 };
 
+// Batch function traits: std::vector<R>(std::vector<A>) -> R(A)
+template <typename T> struct batch_function_traits : public batch_function_traits<typename function_traits<T>::type> {};
+
+template <typename R, typename A>
+struct batch_function_traits<std::vector<R>(std::vector<A>)> {
+  using type = R(A);
+  using ret_type = R;
+  using arg_type = A;
+};
+template <typename R, typename A>
+struct batch_function_traits<std::vector<R>(const std::vector<A> &)> : public batch_function_traits<std::vector<R>(std::vector<A>)> {};
+template <typename R, typename A>
+struct batch_function_traits<std::vector<R>(std::vector<A> &&)> : public batch_function_traits<std::vector<R>(std::vector<A>)> {};
+
+template <class Ret, class Arg>
+class BatchStepBase : public Step<Ret, Arg> {
+public:
+  virtual void flush() = 0;
+};
+
+// Coalesces the invocations that pile up while a flush is queued on the
+// executor into a single call of the batch functor, then scatters the results
+// back to each caller's callbacks. A batch is also cut as soon as it reaches
+// max_batch, without waiting for the executor.
+template <class Executor, class Functor, class Ret, class Arg>
+class BatchStep : public BatchStepBase<Ret, Arg>,
+                  public std::enable_shared_from_this<BatchStep<Executor, Functor, Ret, Arg>> {
+  static_assert(!std::is_void<Arg>::value && !std::is_void<Ret>::value,
+    "Batched steps need an argument and a result per invocation");
+
+  struct Pending {
+    Arg arg;
+    Callback<Ret> done;
+    ErrorCallback error;
+  };
+
+  class Flush {
+    std::shared_ptr<BatchStep> step_;
+
+  public:
+    Flush(std::shared_ptr<BatchStep> &&step) : step_(std::move(step)) {}
+
+    void operator()() { step_->flush(); }
+  };
+
+  Executor executor_;
+  Functor func_;
+  std::size_t max_batch_;
+  std::mutex mutex_;
+  std::vector<Pending> pending_;
+  bool scheduled_;
+
+  void run(std::vector<Pending> &batch) {
+    std::vector<Arg> args;
+    args.reserve(batch.size());
+    for (auto &p : batch) {
+      args.push_back(std::move(p.arg));
+    }
+
+    std::vector<Ret> results;
+    try {
+      StageTimer timer(stage_of<Functor, StageKind::Batch>());
+      results = func_(std::move(args));
+      if (results.size() != batch.size()) {
+        throw std::length_error("Batch function must return one result per argument");
+      }
+    } catch (...) {
+      auto exception = std::current_exception();
+      for (auto &p : batch) {
+        p.error(exception);
+      }
+      return;
+    }
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      batch[i].done(std::move(results[i]));
+    }
+  }
+
+public:
+  BatchStep(Executor executor, Functor func, std::size_t max_batch)
+      : executor_(executor), func_(std::move(func)), max_batch_(max_batch ? max_batch : 1), scheduled_(false) {}
+
+  void operator()(Callback<Ret> done, ErrorCallback error, Arg &&arg) override {
+    std::vector<Pending> batch;
+    bool schedule = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.push_back(Pending{std::forward<Arg>(arg), std::move(done), std::move(error)});
+      if (pending_.size() >= max_batch_) {
+        batch.swap(pending_);
+      } else if (!scheduled_) {
+        scheduled_ = schedule = true;
+      }
+    }
+
+    if (!batch.empty()) {
+      run(batch);
+    }
+    if (schedule) {
+      (*executor_)(hop(stage_of<Functor, StageKind::Batch>(), Flush(this->shared_from_this())));
+    }
+  }
+
+  void flush() override {
+    std::vector<Pending> batch;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      scheduled_ = false;
+      batch.swap(pending_);
+    }
+
+    if (!batch.empty()) {
+      run(batch);
+    }
+  }
+};
+
 template <class Ret, class Error>
 class ExceptionHandler {
   typedef std::shared_ptr<Step<Ret, Error>> Functor;
@@ -454,6 +599,7 @@ private:
   template <class F> friend Job<typename details::async_function_traits<F>::type> make_job_from_async(F&&);
   template <class E, class F> friend Job<typename details::function_traits<F>::type> make_job(E, F&&);
   template <class E, class F> friend Job<typename details::async_function_traits<F>::type> make_job_from_async(E, F&&);
+  template <class> friend class Batcher;
 
   std::shared_ptr<details::Step<RetType, Params...>> job_;
 
@@ -461,6 +607,8 @@ protected:
   template <class Functor>
   Job(Functor &&func) : job_(new Functor(std::forward<Functor>(func))) {}
 
+  Job(details::SharedStep, std::shared_ptr<details::Step<RetType, Params...>> step) : job_(std::move(step)) {}
+
 public:
   Job(Job<RetType(Params...)> &&job) : job_(std::move(job.job_)) {}
 
@@ -712,5 +860,36 @@ make_job_from_async(Executor executor, Functor &&func)
       std::move(step)));
 }
 
+
+// Handle on a batched step. Every job returned by job() feeds the same
+// batch, so independent pipelines can share one round trip:
+//   auto lookup = make_batcher(&exec, [](std::vector<int> keys) { return db.multi_get(keys); });
+//   make_job(parse).then(lookup.job());
+template <class Ret, class Arg>
+class Batcher<Ret(Arg)> {
+  std::shared_ptr<details::BatchStepBase<Ret, Arg>> step_;
+
+public:
+  Batcher(std::shared_ptr<details::BatchStepBase<Ret, Arg>> &&step) : step_(std::move(step)) {}
+
+  Job<Ret, Arg> job() const {
+    return Job<Ret, Arg>(details::SharedStep(), step_);
+  }
+
+  // Run whatever is pending now instead of waiting for the executor
+  void flush() { step_->flush(); }
+};
+
+template <class Executor, class Functor>
+inline Batcher<typename details::batch_function_traits<Functor>::type>
+make_batcher(Executor executor, Functor &&func, std::size_t max_batch = 64)
+{
+  typedef details::batch_function_traits<Functor> Traits;
+  typedef details::BatchStep<Executor, typename std::decay<Functor>::type, typename Traits::ret_type, typename Traits::arg_type> Step;
+
+  return Batcher<typename Traits::type>(
+    std::make_shared<Step>(executor, std::forward<Functor>(func), max_batch));
+}
+
 }
 }
@@ -1,7 +1,9 @@
 #include "jobs.hpp"
+#include "executors.hpp"
 
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <thread>
 
 class ThreadExecutor {
@@ -288,3 +290,221 @@ TEST_F(AsyncTest, NonCopiable)
 
   EXPECT_EQ(5, job(NonCopiable(5)).get());
 }
+
+
+// Holds queued work until the test runs it
+class ManualExecutor {
+public:
+  template <class Functor, class ...Params>
+  void
+  operator()(Functor &&func, Params&&... params) {
+    m_queue.push_back(tango::async::details::Task::bind(std::forward<Functor>(func), std::forward<Params>(params)...));
+  }
+
+  void run_all() {
+    std::vector<tango::async::details::Task> queue;
+    queue.swap(m_queue);
+    for (auto &f : queue) {
+      f();
+    }
+  }
+
+  size_t size() const { return m_queue.size(); }
+
+private:
+  std::vector<tango::async::details::Task> m_queue;
+};
+
+TEST_F(AsyncTest, PriorityLanes)
+{
+  std::vector<int> order;
+  std::promise<void> gate;
+  auto opened = gate.get_future().share();
+  std::atomic<bool> blocked(false);
+
+  {
+    tango::async::PriorityExecutor pool(1, 2);
+    // Occupy the only worker so everything below is queued
+    (*pool.lane(1))([opened, &blocked]() { blocked = true; opened.wait(); });
+    while (!blocked) {
+      std::this_thread::yield();
+    }
+
+    (*pool.lane(1))([&order](int i) { order.push_back(i); }, 3);
+    (*pool.lane(1))([&order](int i) { order.push_back(i); }, 4);
+    (*pool.lane(0))([&order](int i) { order.push_back(i); }, 1);
+    (*pool.lane(0))([&order](int i) { order.push_back(i); }, 2);
+    gate.set_value();
+  }
+
+  EXPECT_EQ((std::vector<int>{1, 2, 3, 4}), order);
+}
+
+TEST_F(AsyncTest, PriorityLanesNoStarvation)
+{
+  std::vector<int> order;
+  std::promise<void> gate;
+  auto opened = gate.get_future().share();
+  std::atomic<bool> blocked(false);
+
+  {
+    tango::async::PriorityExecutor pool(1, 2, 2);
+    (*pool.lane(0))([opened, &blocked]() { blocked = true; opened.wait(); });
+    while (!blocked) {
+      std::this_thread::yield();
+    }
+
+    (*pool.lane(1))([&order]() { order.push_back(100); });
+    for (int i = 0; i < 4; ++i) {
+      (*pool.lane(0))([&order](int i) { order.push_back(i); }, i);
+    }
+    gate.set_value();
+  }
+
+  EXPECT_EQ((std::vector<int>{0, 1, 100, 2, 3}), order);
+}
+
+TEST_F(AsyncTest, ThenOnLane)
+{
+  tango::async::PriorityExecutor pool(2);
+
+  auto job = tango::async::make_job(
+    pool.lane(1),
+    []() { return 5; }
+  ).then(
+    pool.lane(0),
+    [](int num) { return std::to_string(num); }
+  );
+
+  EXPECT_EQ("5", job().get());
+}
+
+TEST_F(AsyncTest, Batch)
+{
+  ManualExecutor manual;
+  std::vector<size_t> batches;
+
+  auto lookup = tango::async::make_batcher(
+    &manual,
+    [&batches](std::vector<int> keys) {
+      batches.push_back(keys.size());
+      std::vector<std::string> values;
+      for (int k : keys) {
+        values.push_back(std::to_string(k * 10));
+      }
+      return values;
+    },
+    4);
+
+  std::vector<std::future<std::string>> results;
+  for (int i = 0; i < 6; ++i) {
+    results.push_back(
+      tango::async::make_job([i]() { return i; })
+      .then(lookup.job())
+      ());
+  }
+
+  // The first four were cut by max_batch, the rest wait for the executor
+  EXPECT_EQ(std::vector<size_t>{4}, batches);
+  manual.run_all();
+  EXPECT_EQ((std::vector<size_t>{4, 2}), batches);
+
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(std::to_string(i * 10), results[i].get());
+  }
+}
+
+TEST_F(AsyncTest, BatchError)
+{
+  ManualExecutor manual;
+
+  auto lookup = tango::async::make_batcher(
+    &manual,
+    [](const std::vector<int> &) -> std::vector<int> {
+      throw std::runtime_error("db down");
+    });
+
+  auto a = lookup.job()(1);
+  auto b = lookup.job()(2);
+  EXPECT_EQ(1u, manual.size());
+  lookup.flush();
+
+  EXPECT_THROW(a.get(), std::runtime_error);
+  EXPECT_THROW(b.get(), std::runtime_error);
+
+  // The queued flush finds nothing left to do
+  manual.run_all();
+}
+
+TEST(LatencyHistogram, Percentiles)
+{
+  tango::async::LatencyHistogram h;
+  for (uint64_t i = 1; i <= 1000; ++i) {
+    h.record(i);
+  }
+
+  EXPECT_EQ(1000u, h.count());
+  EXPECT_EQ(1000u, h.max());
+  EXPECT_DOUBLE_EQ(500.5, h.mean());
+  // Buckets are within 1/16 of the value
+  EXPECT_NEAR(500, h.percentile(0.5), 500 / 16);
+  EXPECT_NEAR(990, h.percentile(0.99), 990 / 16);
+  EXPECT_EQ(1000u, h.percentile(1.0));
+}
+
+TEST(LatencyHistogram, Buckets)
+{
+  typedef tango::async::LatencyHistogram H;
+  for (uint64_t v : {0ull, 1ull, 15ull, 16ull, 17ull, 31ull, 32ull, 1000ull, 123456789ull, ~0ull}) {
+    unsigned b = H::bucket_of(v);
+    EXPECT_LE(v, H::upper_bound_of(b));
+    EXPECT_LT(b, H::NumBuckets);
+    if (b) {
+      EXPECT_GT(v, H::upper_bound_of(b - 1));
+    }
+  }
+}
+
+#ifdef TANGO_ASYNC_INSTRUMENT
+TEST_F(AsyncTest, Instrumentation)
+{
+  auto first = []() { return 5; };
+  auto second = [](int num) { return num + 1; };
+
+  ManualExecutor manual;
+  for (int i = 0; i < 3; ++i) {
+    auto f = first;
+    auto s = second;
+    auto job = tango::async::make_job(std::move(f)).then(&manual, std::move(s));
+    auto result = job();
+    manual.run_all();
+    EXPECT_EQ(6, result.get());
+  }
+
+  using tango::async::details::StageKind;
+  auto *a = tango::async::details::stage_of<decltype(first), StageKind::Sync>();
+  auto *b = tango::async::details::stage_of<decltype(second), StageKind::Sync>();
+  EXPECT_EQ(3u, a->run.count());
+  EXPECT_EQ(0u, a->hops);
+  EXPECT_EQ(3u, b->run.count());
+  EXPECT_EQ(3u, b->queue_wait.count());
+  EXPECT_EQ(3u, b->hops);
+
+  std::ostringstream json;
+  tango::async::StageRegistry::instance().dump_json(json);
+  EXPECT_NE(std::string::npos, json.str().find("\"hops\":3"));
+}
+
+TEST_F(AsyncTest, InstrumentationKinds)
+{
+  // One functor type as a stage of two kinds: a stage each
+  auto step = [](int num) { return num; };
+  using tango::async::details::StageKind;
+  auto *sync = tango::async::details::stage_of<decltype(step), StageKind::Sync>();
+  auto *batch = tango::async::details::stage_of<decltype(step), StageKind::Batch>();
+  EXPECT_NE(sync, batch);
+  EXPECT_EQ("sync", sync->kind);
+  EXPECT_EQ("batch", batch->kind);
+  EXPECT_EQ(sync, (tango::async::details::stage_of<decltype(step), StageKind::Sync>()));
+}
+#endif
@@ -1,3 +1,83 @@
 /**
  * Implement a B-tree.
+ *
+ * The tree is bptree_t in b-tree.hpp; this compares it with std::map, the
+ * default index of db_mem, on the same keys:
+ *
+ *   usage: b-tree [keys [key-format]]
+ *
+ * 'key-format' is a printf format for the key numbers, "user%012zu" by
+ * default. Keys are added in random order, then looked up in another random
+ * order, then iterated over.
  */
+#include "b-tree.hpp"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+
+static double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+template<class Index>
+static void bench(const char *name, const vector<string> &keys, const vector<size_t> &add_order,
+                  const vector<size_t> &find_order)
+{
+    Index *index = new Index();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < add_order.size(); ++i) {
+        (*index)[keys[add_order[i]]] = keys[add_order[i]];
+    }
+    double add = seconds_since(start);
+
+    start = chrono::steady_clock::now();
+    size_t found = 0;
+    for(size_t i = 0; i < find_order.size(); ++i) {
+        found += index->find(keys[find_order[i]]) != index->end();
+    }
+    double find = seconds_since(start);
+
+    start = chrono::steady_clock::now();
+    size_t bytes = 0;
+    for(typename Index::const_iterator it = index->begin(); it != index->end(); ++it) {
+        bytes += it->first.size() + it->second.size();
+    }
+    double iterate = seconds_since(start);
+
+    start = chrono::steady_clock::now();
+    delete index;
+    double destroy = seconds_since(start);
+
+    size_t n = keys.size();
+    printf("%-10s add %7.1f ns  find %7.1f ns  iterate %6.1f ns  destroy %6.1f ns  (%zu found, %zu bytes)\n",
+           name, add * 1e9 / n, find * 1e9 / n, iterate * 1e9 / n, destroy * 1e9 / n, found, bytes);
+}
+
+int main(int argc, const char **argv)
+{
+    size_t n = argc > 1 ? atol(argv[1]) : 10000000;
+    const char *format = argc > 2 ? argv[2] : "user%012zu";
+
+    vector<string> keys(n);
+    char buf[256];
+    for(size_t i = 0; i < n; ++i) {
+        snprintf(buf, sizeof(buf), format, i);
+        keys[i] = buf;
+    }
+    mt19937_64 rng(42);
+    vector<size_t> add_order(n), find_order(n);
+    for(size_t i = 0; i < n; ++i) {
+        add_order[i] = find_order[i] = i;
+    }
+    shuffle(add_order.begin(), add_order.end(), rng);
+    shuffle(find_order.begin(), find_order.end(), rng);
+
+    printf("%zu keys, per key:\n", n);
+    bench<map<string, string> >("std::map", keys, add_order, find_order);
+    bench<bptree_t<string> >("bptree_t", keys, add_order, find_order);
+    return 0;
+}
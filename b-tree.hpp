@@ -0,0 +1,426 @@
+#ifndef B_TREE_HPP
+#define B_TREE_HPP
+
+#include <algorithm>
+#include <assert.h>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// bptree_t<V>: an ordered map from strings to V, as a B+-tree.
+//
+// Leaves hold up to LEAF_SIZE entries in sorted arrays and are chained for
+// iteration; inner nodes hold up to INNER_SIZE children. Within a leaf the
+// keys are prefix compressed: the prefix common to all of them is kept once
+// and only the suffixes are stored, so short suffixes fit in std::string's
+// inline buffer and most entries need no allocation of their own. Inner
+// nodes only keep the shortest separator that tells two leaves apart.
+//
+// The interface is the subset of std::map that db_mem needs. Dereferencing
+// an iterator rebuilds the full key inside the iterator, so 'it->first' is
+// only valid until the iterator moves.
+//
+// Erasing never rebalances: nodes are only dropped once empty. Read-mostly
+// indexes do not miss the merge logic, and leaves fill up again on inserts.
+template<class V>
+class bptree_t {
+    enum {
+        LEAF_SIZE = 64,
+        INNER_SIZE = 64
+    };
+
+    struct node_t {
+        explicit node_t(bool leaf) : leaf(leaf) {}
+        bool leaf;
+    };
+
+    struct inner_t : node_t {
+        inner_t() : node_t(false) {}
+        // keys[i] separates children[i] (smaller) from children[i + 1]
+        vector<string> keys;
+        vector<node_t *> children;
+    };
+
+    struct leaf_t : node_t {
+        leaf_t() : node_t(true), next(NULL), prev(NULL) {}
+        string prefix;
+        vector<string> suffixes;
+        vector<V> values;
+        leaf_t *next;
+        leaf_t *prev;
+
+        size_t size() const { return suffixes.size(); }
+
+        string key(size_t i) const { return prefix + suffixes[i]; }
+
+        // Compare 'k' with the i-th key
+        int compare(const string &k, size_t i) const {
+            size_t n = min(k.size(), prefix.size());
+            int c = k.compare(0, n, prefix, 0, n);
+            if(c || k.size() < prefix.size()) {
+                return c ? c : -1;
+            }
+            return k.compare(prefix.size(), string::npos, suffixes[i]);
+        }
+
+        // First index whose key is >= k
+        size_t lower_bound(const string &k) const {
+            size_t n = min(k.size(), prefix.size());
+            int c = k.compare(0, n, prefix, 0, n);
+            if(c < 0 || (c == 0 && k.size() < prefix.size())) {
+                return 0;
+            }
+            if(c > 0) {
+                return size();
+            }
+            size_t lo = 0, hi = size();
+            while(lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if(k.compare(prefix.size(), string::npos, suffixes[mid]) > 0) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+
+        // Shorten the prefix to its first 'len' characters
+        void shrink_prefix(size_t len) {
+            if(len == prefix.size()) {
+                return;
+            }
+            string moved = prefix.substr(len);
+            for(size_t i = 0; i < suffixes.size(); ++i) {
+                suffixes[i].insert(0, moved);
+            }
+            prefix.resize(len);
+        }
+
+        // Move what all the suffixes have in common into the prefix
+        void grow_prefix() {
+            if(suffixes.empty()) {
+                return;
+            }
+            const string &first = suffixes.front(), &last = suffixes.back();
+            size_t len = 0;
+            while(len < first.size() && len < last.size() && first[len] == last[len]) {
+                ++len;
+            }
+            if(!len) {
+                return;
+            }
+            prefix.append(first, 0, len);
+            for(size_t i = 0; i < suffixes.size(); ++i) {
+                suffixes[i].erase(0, len);
+            }
+        }
+    };
+
+public:
+    typedef string key_type;
+    typedef V mapped_type;
+    typedef size_t size_type;
+
+    // What dereferencing an iterator gives: a pair-like view of the entry.
+    template<class Value>
+    struct entry_ref_t {
+        entry_ref_t(const string &first, Value &second) : first(first), second(second) {}
+        const string &first;
+        Value &second;
+        const entry_ref_t *operator->() const { return this; }
+    };
+
+    template<class Value, class Leaf>
+    class iter_t {
+    public:
+        iter_t() : leaf(NULL), idx(0) {}
+        iter_t(Leaf *leaf, size_t idx) : leaf(leaf), idx(idx) { settle(); }
+        // iterator -> const_iterator
+        template<class V2, class L2>
+        iter_t(const iter_t<V2, L2> &o) : leaf(o.leaf), idx(o.idx) {}
+
+        entry_ref_t<Value> operator*() const {
+            key = leaf->key(idx);
+            return entry_ref_t<Value>(key, leaf->values[idx]);
+        }
+        entry_ref_t<Value> operator->() const { return **this; }
+
+        iter_t &operator++() {
+            ++idx;
+            settle();
+            return *this;
+        }
+
+        bool operator==(const iter_t &o) const { return leaf == o.leaf && idx == o.idx; }
+        bool operator!=(const iter_t &o) const { return !(*this == o); }
+
+    private:
+        template<class, class> friend class iter_t;
+        friend class bptree_t;
+
+        // Past the end of a leaf is the start of the next non-empty one
+        void settle() {
+            while(leaf && idx >= leaf->size()) {
+                leaf = leaf->next;
+                idx = 0;
+            }
+        }
+
+        Leaf *leaf;
+        size_t idx;
+        mutable string key;
+    };
+
+    typedef iter_t<V, leaf_t> iterator;
+    typedef iter_t<const V, const leaf_t> const_iterator;
+
+    bptree_t() : root(new leaf_t()), entries(0) {}
+
+    ~bptree_t() {
+        destroy(root);
+    }
+
+    iterator begin() { return iterator(first_leaf(), 0); }
+    iterator end() { return iterator(); }
+    const_iterator begin() const { return const_iterator(first_leaf(), 0); }
+    const_iterator end() const { return const_iterator(); }
+
+    size_t size() const { return entries; }
+    bool empty() const { return entries == 0; }
+
+    iterator find(const string &k) {
+        leaf_t *leaf = find_leaf(k, NULL);
+        size_t i = leaf->lower_bound(k);
+        if(i < leaf->size() && leaf->compare(k, i) == 0) {
+            return iterator(leaf, i);
+        }
+        return end();
+    }
+
+    const_iterator find(const string &k) const {
+        return const_cast<bptree_t *>(this)->find(k);
+    }
+
+    size_t count(const string &k) const {
+        return find(k) != end();
+    }
+
+    // First entry whose key is >= k
+    iterator lower_bound(const string &k) {
+        leaf_t *leaf = find_leaf(k, NULL);
+        return iterator(leaf, leaf->lower_bound(k));
+    }
+
+    const_iterator lower_bound(const string &k) const {
+        return const_cast<bptree_t *>(this)->lower_bound(k);
+    }
+
+    V &operator[](const string &k) {
+        return insert(k, V()).first;
+    }
+
+    // Like map::insert, but returning the value: (value, inserted)
+    pair<V &, bool> insert(const string &k, const V &v) {
+        vector<pair<inner_t *, size_t> > path;
+        leaf_t *leaf = find_leaf(k, &path);
+        size_t i = leaf->lower_bound(k);
+        if(i < leaf->size() && leaf->compare(k, i) == 0) {
+            return pair<V &, bool>(leaf->values[i], false);
+        }
+
+        if(k.compare(0, leaf->prefix.size(), leaf->prefix) != 0 ||
+           k.size() < leaf->prefix.size()) {
+            size_t len = 0;
+            while(len < leaf->prefix.size() && len < k.size() && leaf->prefix[len] == k[len]) {
+                ++len;
+            }
+            leaf->shrink_prefix(len);
+        }
+        leaf->suffixes.insert(leaf->suffixes.begin() + i, k.substr(leaf->prefix.size()));
+        leaf->values.insert(leaf->values.begin() + i, v);
+        ++entries;
+
+        if(leaf->size() <= LEAF_SIZE) {
+            return pair<V &, bool>(leaf->values[i], true);
+        }
+        leaf_t *right = split_leaf(leaf, path);
+        if(i >= leaf->size()) {
+            return pair<V &, bool>(right->values[i - leaf->size()], true);
+        }
+        return pair<V &, bool>(leaf->values[i], true);
+    }
+
+    size_t erase(const string &k) {
+        vector<pair<inner_t *, size_t> > path;
+        leaf_t *leaf = find_leaf(k, &path);
+        size_t i = leaf->lower_bound(k);
+        if(i >= leaf->size() || leaf->compare(k, i) != 0) {
+            return 0;
+        }
+        leaf->suffixes.erase(leaf->suffixes.begin() + i);
+        leaf->values.erase(leaf->values.begin() + i);
+        --entries;
+        if(leaf->suffixes.empty()) {
+            leaf->prefix.clear();
+            remove_empty(leaf, path);
+        }
+        return 1;
+    }
+
+    void clear() {
+        destroy(root);
+        root = new leaf_t();
+        entries = 0;
+    }
+
+private:
+    bptree_t(const bptree_t &);
+    bptree_t &operator=(const bptree_t &);
+
+    static void destroy(node_t *n) {
+        if(n->leaf) {
+            delete static_cast<leaf_t *>(n);
+            return;
+        }
+        inner_t *in = static_cast<inner_t *>(n);
+        for(size_t i = 0; i < in->children.size(); ++i) {
+            destroy(in->children[i]);
+        }
+        delete in;
+    }
+
+    leaf_t *first_leaf() const {
+        node_t *n = root;
+        while(!n->leaf) {
+            n = static_cast<inner_t *>(n)->children.front();
+        }
+        return static_cast<leaf_t *>(n);
+    }
+
+    // Descend to the leaf that holds (or would hold) k, recording the
+    // inner nodes and child indices on the way if 'path' is given.
+    leaf_t *find_leaf(const string &k, vector<pair<inner_t *, size_t> > *path) const {
+        node_t *n = root;
+        while(!n->leaf) {
+            inner_t *in = static_cast<inner_t *>(n);
+            size_t i = upper_bound(in->keys.begin(), in->keys.end(), k) - in->keys.begin();
+            if(path) {
+                path->push_back(make_pair(in, i));
+            }
+            n = in->children[i];
+        }
+        return static_cast<leaf_t *>(n);
+    }
+
+    leaf_t *split_leaf(leaf_t *leaf, vector<pair<inner_t *, size_t> > &path) {
+        leaf_t *right = new leaf_t();
+        size_t mid = leaf->size() / 2;
+        right->prefix = leaf->prefix;
+        // moved, not copied: a value's buffer stays where it is, for the
+        // views db_mem_t::find_view() hands out
+        right->suffixes.assign(make_move_iterator(leaf->suffixes.begin() + mid),
+                               make_move_iterator(leaf->suffixes.end()));
+        right->values.assign(make_move_iterator(leaf->values.begin() + mid),
+                             make_move_iterator(leaf->values.end()));
+        leaf->suffixes.resize(mid);
+        leaf->values.resize(mid);
+
+        // shortest string s with last(left) < s <= first(right)
+        const string &a = leaf->suffixes.back(), &b = right->suffixes.front();
+        size_t lcp = 0;
+        while(lcp < a.size() && lcp < b.size() && a[lcp] == b[lcp]) {
+            ++lcp;
+        }
+        string sep = leaf->prefix + b.substr(0, lcp + 1);
+
+        leaf->grow_prefix();
+        right->grow_prefix();
+
+        right->next = leaf->next;
+        right->prev = leaf;
+        if(leaf->next) {
+            leaf->next->prev = right;
+        }
+        leaf->next = right;
+
+        insert_in_parent(leaf, sep, right, path);
+        return right;
+    }
+
+    void insert_in_parent(node_t *left, const string &sep, node_t *right,
+                          vector<pair<inner_t *, size_t> > &path) {
+        if(path.empty()) {
+            inner_t *in = new inner_t();
+            in->keys.push_back(sep);
+            in->children.push_back(left);
+            in->children.push_back(right);
+            root = in;
+            return;
+        }
+        inner_t *parent = path.back().first;
+        size_t i = path.back().second;
+        path.pop_back();
+        parent->keys.insert(parent->keys.begin() + i, sep);
+        parent->children.insert(parent->children.begin() + i + 1, right);
+        if(parent->children.size() <= INNER_SIZE) {
+            return;
+        }
+
+        inner_t *sibling = new inner_t();
+        size_t mid = parent->keys.size() / 2;
+        string up = parent->keys[mid];
+        sibling->keys.assign(parent->keys.begin() + mid + 1, parent->keys.end());
+        sibling->children.assign(parent->children.begin() + mid + 1, parent->children.end());
+        parent->keys.resize(mid);
+        parent->children.resize(mid + 1);
+        insert_in_parent(parent, up, sibling, path);
+    }
+
+    // Unlink an empty leaf and drop the inner nodes left without children.
+    void remove_empty(leaf_t *leaf, vector<pair<inner_t *, size_t> > &path) {
+        if(path.empty()) {
+            return; // the root stays, even empty
+        }
+        if(leaf->prev) {
+            leaf->prev->next = leaf->next;
+        }
+        if(leaf->next) {
+            leaf->next->prev = leaf->prev;
+        }
+        node_t *gone = leaf;
+        while(!path.empty()) {
+            inner_t *parent = path.back().first;
+            size_t i = path.back().second;
+            path.pop_back();
+            destroy(gone);
+            parent->children.erase(parent->children.begin() + i);
+            if(!parent->keys.empty()) {
+                parent->keys.erase(parent->keys.begin() + (i ? i - 1 : 0));
+            }
+            if(!parent->children.empty()) {
+                break;
+            }
+            gone = parent;
+            if(path.empty()) {
+                // the whole tree is empty
+                delete parent;
+                root = new leaf_t();
+                return;
+            }
+        }
+        // collapse a root with a single child
+        while(!root->leaf && static_cast<inner_t *>(root)->children.size() == 1) {
+            inner_t *old = static_cast<inner_t *>(root);
+            root = old->children.front();
+            old->children.clear();
+            delete old;
+        }
+    }
+
+    node_t *root;
+    size_t entries;
+};
+#endif /* B_TREE_HPP */
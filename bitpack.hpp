@@ -0,0 +1,420 @@
+#ifndef BITPACK_HPP
+#define BITPACK_HPP
+
+#include <algorithm>
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+#include "bits.hpp"
+
+// Frame of reference bit packing of 32 bit integers, in blocks of 128.
+//
+// Each block is stored as its smallest value (the reference) and the
+// others' differences from it, in as many bits each as the block needs.
+// A few large values should not widen the whole block: those are patched
+// (PFOR), their low bits packed like the others and the rest kept aside
+// with their positions, when that takes less room.
+//
+// A sorted array is coded as the gaps between values instead, from the
+// first value of each block; the block's first value is kept in the index
+// with where the block starts, so any block decodes without the ones
+// before it, and find_block() skips to the one that holds a value.
+//
+// The 128 values are packed as 4 lanes of 32 (value i in lane i % 4), so
+// that with SSE2 one shift and one mask pack or unpack 4 values at once.
+// There is a kernel per bit width, 0 to 32, with every shift and word
+// offset a constant.
+
+namespace bitpack_detail {
+
+#ifdef __SSE2__
+typedef __m128i vec_t;
+
+inline vec_t load(const uint32_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+inline void store(uint32_t *p, vec_t v) { _mm_storeu_si128((__m128i *)p, v); }
+inline vec_t set1(uint32_t x) { return _mm_set1_epi32((int)x); }
+inline vec_t add(vec_t a, vec_t b) { return _mm_add_epi32(a, b); }
+inline vec_t sub(vec_t a, vec_t b) { return _mm_sub_epi32(a, b); }
+inline vec_t and_(vec_t a, vec_t b) { return _mm_and_si128(a, b); }
+inline vec_t or_(vec_t a, vec_t b) { return _mm_or_si128(a, b); }
+// 0 for N of 32
+template<int N> inline vec_t sll(vec_t v) { return _mm_slli_epi32(v, N); }
+template<int N> inline vec_t srl(vec_t v) { return _mm_srli_epi32(v, N); }
+#else
+// 4 lanes, one at a time
+struct vec_t {
+    uint32_t v[4];
+};
+
+inline vec_t load(const uint32_t *p) { vec_t r; for(int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+inline void store(uint32_t *p, vec_t v) { for(int i = 0; i < 4; ++i) p[i] = v.v[i]; }
+inline vec_t set1(uint32_t x) { vec_t r; for(int i = 0; i < 4; ++i) r.v[i] = x; return r; }
+inline vec_t add(vec_t a, vec_t b) { for(int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+inline vec_t sub(vec_t a, vec_t b) { for(int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+inline vec_t and_(vec_t a, vec_t b) { for(int i = 0; i < 4; ++i) a.v[i] &= b.v[i]; return a; }
+inline vec_t or_(vec_t a, vec_t b) { for(int i = 0; i < 4; ++i) a.v[i] |= b.v[i]; return a; }
+template<int N> inline vec_t sll(vec_t a) {
+    for(int i = 0; i < 4; ++i) a.v[i] = N >= 32 ? 0 : a.v[i] << (N & 31);
+    return a;
+}
+template<int N> inline vec_t srl(vec_t a) {
+    for(int i = 0; i < 4; ++i) a.v[i] = N >= 32 ? 0 : a.v[i] >> (N & 31);
+    return a;
+}
+#endif
+
+template<int BITS>
+inline vec_t mask() { return set1((uint32_t)(((uint64_t)1 << BITS) - 1)); }
+
+// Step I of 32: the Ith value of each lane, BITS bits from bit I * BITS of
+// the lane, which may straddle two words
+template<int BITS, int I>
+struct packer_t {
+    enum { WORD = I * BITS / 32, SHIFT = I * BITS % 32 };
+
+    static void pack(const uint32_t *in, uint32_t *out, vec_t base, vec_t acc) {
+        vec_t v = and_(sub(load(in + 4 * I), base), mask<BITS>());
+        acc = SHIFT != 0 ? or_(acc, sll<SHIFT>(v)) : v;
+        if(SHIFT + BITS >= 32) {
+            store(out + 4 * WORD, acc);
+            // what did not fit starts the next word
+            acc = srl<32 - SHIFT>(v);
+        }
+        packer_t<BITS, I + 1>::pack(in, out, base, acc);
+    }
+
+    static void unpack(const uint32_t *in, uint32_t *out, vec_t base) {
+        vec_t v = srl<SHIFT>(load(in + 4 * WORD));
+        if(SHIFT + BITS > 32) {
+            v = or_(v, sll<32 - SHIFT>(load(in + 4 * (WORD + 1))));
+        }
+        store(out + 4 * I, add(and_(v, mask<BITS>()), base));
+        packer_t<BITS, I + 1>::unpack(in, out, base);
+    }
+};
+
+template<int BITS>
+struct packer_t<BITS, 32> {
+    static void pack(const uint32_t *, uint32_t *, vec_t, vec_t) {}
+    static void unpack(const uint32_t *, uint32_t *, vec_t) {}
+};
+
+// 0 bits: all the values are the base
+template<int I>
+struct packer_t<0, I> {
+    static void pack(const uint32_t *, uint32_t *, vec_t, vec_t) {}
+    static void unpack(const uint32_t *, uint32_t *out, vec_t base) {
+        for(int i = 0; i < 32; ++i) {
+            store(out + 4 * i, base);
+        }
+    }
+};
+
+template<int BITS>
+void pack(const uint32_t *in, uint32_t base, uint32_t *out)
+{
+    packer_t<BITS, 0>::pack(in, out, set1(base), set1(0));
+}
+
+template<int BITS>
+void unpack(const uint32_t *in, uint32_t base, uint32_t *out)
+{
+    packer_t<BITS, 0>::unpack(in, out, set1(base));
+}
+
+typedef void (*kernel_t)(const uint32_t *in, uint32_t base, uint32_t *out);
+
+#define BITPACK_KERNELS(f) {                                                  \
+        f<0>, f<1>, f<2>, f<3>, f<4>, f<5>, f<6>, f<7>, f<8>, f<9>, f<10>,    \
+        f<11>, f<12>, f<13>, f<14>, f<15>, f<16>, f<17>, f<18>, f<19>, f<20>, \
+        f<21>, f<22>, f<23>, f<24>, f<25>, f<26>, f<27>, f<28>, f<29>, f<30>, \
+        f<31>, f<32> }
+
+inline kernel_t packer(int bits)
+{
+    static const kernel_t kernels[33] = BITPACK_KERNELS(pack);
+    return kernels[bits];
+}
+
+inline kernel_t unpacker(int bits)
+{
+    static const kernel_t kernels[33] = BITPACK_KERNELS(unpack);
+    return kernels[bits];
+}
+
+#undef BITPACK_KERNELS
+
+// Running sum of the 128 values at 'p', from 'first' on
+inline void prefix_sum(uint32_t *p, uint32_t first)
+{
+#ifdef __SSE2__
+    __m128i last = _mm_set1_epi32((int)first);
+    for(int i = 0; i < 128; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, last);
+        last = _mm_shuffle_epi32(v, 0xff);
+        _mm_storeu_si128((__m128i *)(p + i), v);
+    }
+#else
+    for(int i = 0; i < 128; ++i) {
+        p[i] = first += p[i];
+    }
+#endif
+}
+
+inline int bits_of(uint32_t x)
+{
+    return x ? 32 - __builtin_clz(x) : 0;
+}
+
+} // namespace bitpack_detail
+
+// Pack the 128 values at 'in', minus 'base', in 'bits' bits each (the
+// higher bits are dropped) into the 4 * 'bits' words at 'out'
+inline void bitpack_pack(int bits, const uint32_t *in, uint32_t base, uint32_t *out)
+{
+    bitpack_detail::packer(bits)(in, base, out);
+}
+
+// The reverse: 128 values to 'out'
+inline void bitpack_unpack(int bits, const uint32_t *in, uint32_t base, uint32_t *out)
+{
+    bitpack_detail::unpacker(bits)(in, base, out);
+}
+
+// An array of 32 bit integers, bit packed
+class bitpacked_array_t {
+public:
+    enum { BLOCK = 128 };
+
+    bitpacked_array_t() : count(0), sorted(false) {}
+
+    bitpacked_array_t(const uint32_t *values, size_t n, bool sorted = false) {
+        assign(values, n, sorted);
+    }
+
+    // 'sorted' codes the gaps between values, which then must not go down
+    void assign(const uint32_t *values, size_t n, bool sorted = false);
+
+    size_t size() const { return count; }
+    size_t blocks() const { return index.size(); }
+
+    // With the index
+    size_t bytes() const {
+        return words.size() * sizeof(uint32_t) + index.size() * sizeof(block_t);
+    }
+
+    // All size() values to 'out'
+    void decode(uint32_t *out) const;
+
+    // The values of block 'b' to 'out', which needs room for BLOCK of
+    // them; returns how many there are, BLOCK but for the last block
+    size_t decode_block(size_t b, uint32_t *out) const;
+
+    uint32_t block_first(size_t b) const { return index[b].first; }
+
+    // For a sorted array: the block where 'v' would be, the last one that
+    // starts with 'v' or less (0 if none does)
+    size_t find_block(uint32_t v) const;
+
+    uint32_t get(size_t i) const;
+
+private:
+    typedef SizedTypeForBits<6>::theType width_t;       // 0..32
+    typedef SizedTypeForBits<8>::theType exceptions_t;  // 0..128
+    typedef SizedTypeForBits<7>::theType position_t;    // 0..127
+
+    // Where a block is in 'words' and what it takes to decode it. In
+    // 'words': the packed values (4 * width words), the high bits of the
+    // exceptions and their positions (4 to a word).
+    struct block_t {
+        uint32_t first;
+        uint32_t offset;
+        uint32_t base;
+        width_t width;
+        exceptions_t exceptions;
+    };
+
+    void encode_block(uint32_t *x);
+    void patch(const block_t &block, uint32_t *out) const;
+
+    vector<uint32_t> words;
+    vector<block_t> index;
+    size_t count;
+    bool sorted;
+};
+
+// x: a block of BLOCK values, as they are to be packed
+inline void bitpacked_array_t::encode_block(uint32_t *x)
+{
+    using namespace bitpack_detail;
+    block_t block;
+    block.first = x[0];
+    block.offset = (uint32_t)words.size();
+    block.base = *min_element(x, x + BLOCK);
+    // how many need each width: the one that takes the least room,
+    // counting what the exceptions cost
+    size_t widths[33] = { 0 };
+    for(int i = 0; i < BLOCK; ++i) {
+        ++widths[bits_of(x[i] - block.base)];
+    }
+    int best = 32;
+    size_t best_cost = (size_t)BLOCK * 32, exceptions = 0;
+    for(int w = 32; w >= 0; --w) {
+        size_t cost = (size_t)BLOCK * w + exceptions * (32 + 8);
+        if(cost < best_cost) {
+            best = w;
+            best_cost = cost;
+        }
+        exceptions += widths[w];
+    }
+    block.width = (width_t)best;
+
+    words.resize(block.offset + 4 * best);
+    bitpack_pack(best, x, block.base, words.data() + block.offset);
+    position_t positions[BLOCK];
+    size_t n = 0;
+    for(int i = 0; i < BLOCK; ++i) {
+        uint32_t high = best == 32 ? 0 : (x[i] - block.base) >> best;
+        if(high) {
+            words.push_back(high);
+            positions[n++] = (position_t)i;
+        }
+    }
+    for(size_t i = 0; i < n; i += 4) {
+        uint32_t w = 0;
+        for(size_t j = i; j < n && j < i + 4; ++j) {
+            w |= (uint32_t)positions[j] << (8 * (j - i));
+        }
+        words.push_back(w);
+    }
+    block.exceptions = (exceptions_t)n;
+    index.push_back(block);
+}
+
+inline void bitpacked_array_t::assign(const uint32_t *values, size_t n, bool sorted)
+{
+    words.clear();
+    index.clear();
+    count = n;
+    this->sorted = sorted;
+    uint32_t x[BLOCK];
+    for(size_t start = 0; start < n; start += BLOCK) {
+        size_t len = min<size_t>(BLOCK, n - start);
+        const uint32_t *v = values + start;
+        if(sorted) {
+            // the gaps; the first value is in the index instead, and in
+            // its place goes a gap that does not change the reference
+            for(size_t i = 1; i < len; ++i) {
+                assert(v[i] >= v[i - 1]);
+                x[i] = v[i] - v[i - 1];
+            }
+            x[0] = len > 1 ? x[1] : 0;
+        } else {
+            copy(v, v + len, x);
+        }
+        // the last block runs on with copies of its last value
+        fill(x + len, x + BLOCK, x[len - 1]);
+        encode_block(x);
+        if(sorted) {
+            index.back().first = v[0];
+        }
+    }
+}
+
+// Add back the high bits of the exceptions
+inline void bitpacked_array_t::patch(const block_t &block, uint32_t *out) const
+{
+    const uint32_t *highs = words.data() + block.offset + 4 * block.width;
+    const uint32_t *positions = highs + block.exceptions;
+    for(size_t i = 0; i < block.exceptions; ++i) {
+        size_t pos = (positions[i / 4] >> (8 * (i % 4))) & 0xff;
+        out[pos] += highs[i] << block.width;
+    }
+}
+
+inline size_t bitpacked_array_t::decode_block(size_t b, uint32_t *out) const
+{
+    const block_t &block = index[b];
+    bitpack_unpack(block.width, words.data() + block.offset, block.base, out);
+    patch(block, out);
+    if(sorted) {
+        // what is in place of the first gap
+        out[0] = 0;
+        bitpack_detail::prefix_sum(out, block.first);
+    }
+    return b + 1 < index.size() ? (size_t)BLOCK : count - b * BLOCK;
+}
+
+inline void bitpacked_array_t::decode(uint32_t *out) const
+{
+    size_t b = 0;
+    // whole blocks straight to 'out', the last one through a copy
+    for(; (b + 1) * BLOCK <= count; ++b) {
+        decode_block(b, out + b * BLOCK);
+    }
+    if(b < index.size()) {
+        uint32_t last[BLOCK];
+        size_t n = decode_block(b, last);
+        copy(last, last + n, out + b * BLOCK);
+    }
+}
+
+inline size_t bitpacked_array_t::find_block(uint32_t v) const
+{
+    assert(sorted);
+    size_t lo = 0, hi = index.size();
+    // the first block that starts after v, then the one before it
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(index[mid].first <= v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? lo - 1 : 0;
+}
+
+inline uint32_t bitpacked_array_t::get(size_t i) const
+{
+    assert(i < count);
+    const block_t &block = index[i / BLOCK];
+    size_t pos = i % BLOCK;
+    if(sorted) {
+        uint32_t out[BLOCK];
+        decode_block(i / BLOCK, out);
+        return out[pos];
+    }
+    // one value of one lane
+    uint32_t v = 0;
+    if(block.width) {
+        const uint32_t *lane = words.data() + block.offset + pos % 4;
+        size_t bit = pos / 4 * block.width;
+        size_t word = bit / 32, shift = bit % 32;
+        uint64_t both = lane[4 * word];
+        if(shift + block.width > 32) {
+            both |= (uint64_t)lane[4 * (word + 1)] << 32;
+        }
+        v = (uint32_t)(both >> shift) & (uint32_t)(((uint64_t)1 << block.width) - 1);
+    }
+    const uint32_t *highs = words.data() + block.offset + 4 * block.width;
+    const uint32_t *positions = highs + block.exceptions;
+    for(size_t e = 0; e < block.exceptions; ++e) {
+        if(((positions[e / 4] >> (8 * (e % 4))) & 0xff) == pos) {
+            v += highs[e] << block.width;
+            break;
+        }
+    }
+    return v + block.base;
+}
+
+#endif /* BITPACK_HPP */
@@ -1,6 +1,17 @@
+#ifndef BITS_HPP
+#define BITS_HPP
+
+#include <assert.h>
+#include <stdint.h>
+
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+
 // Hamming weight (number of set bits)
 template<typename T>
-int hammingWeight(T u)
+inline int hammingWeight(T u)
 {
     int size = sizeof(T);
     int log = 1;
@@ -15,7 +26,7 @@ int hammingWeight(T u)
 }
 
 // swap(reverse) bits in a byte
-uint8_t swap1(uint8_t c)
+inline uint8_t swap1(uint8_t c)
 {
     uint8_t ret = 0;
     uint8_t idx = 7;
@@ -28,7 +39,7 @@ uint8_t swap1(uint8_t c)
 }
 
 // find if byte a palindrome or not
-bool is_palindrome(uint8_t c)
+inline bool is_palindrome(uint8_t c)
 {
     uint8_t i = 0, j = 7;
     while(i < j) {
@@ -125,3 +136,4 @@ DEF_INT_WITH_THIS_MANY_BITS(0100, uint64);
 
 #undef DEF_INT_WITH_THIS_MANY_BITS
 
+#endif /* BITS_HPP */
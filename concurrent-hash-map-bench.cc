@@ -0,0 +1,113 @@
+// concurrent_hash_map_t against hash_map_t behind one mutex.
+//
+// usage: concurrent-hash-map-bench [max-threads [keys [read-percent [seconds]]]]
+//
+// Fills both maps with 'keys' random keys (1M by default), then has 1, 2, 4, ...
+// 'max-threads' (64) threads pick keys at random and get them, or put
+// them 100 - 'read-percent' (90) percent of the time. Reports operations
+// per second.
+
+#include "concurrent-hash-map.hpp"
+#include "hash-map.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+// one per thread, padded so the counters do not share cache lines
+struct alignas(64) result_t {
+    result_t() : ops(0) {}
+    size_t ops;
+};
+
+struct locked_map_t {
+    bool get(const uint64_t &k, uint64_t &v) {
+        lock_guard<mutex> lock(m);
+        uint64_t *p = map.get(k);
+        if(p) {
+            v = *p;
+        }
+        return p != NULL;
+    }
+
+    void put(const uint64_t &k, const uint64_t &v) {
+        lock_guard<mutex> lock(m);
+        map.put(k, v);
+    }
+
+    mutex m;
+    hash_map_t<uint64_t, uint64_t> map;
+};
+
+template<class Map>
+static void worker(Map &map, const vector<uint64_t> &keys, int read_percent,
+                   const atomic<bool> &stop, unsigned seed, result_t &res)
+{
+    mt19937_64 rng(seed);
+    uniform_int_distribution<size_t> key(0, keys.size() - 1);
+    uniform_int_distribution<int> percent(0, 99);
+    uint64_t v;
+    while(!stop.load(memory_order_relaxed)) {
+        uint64_t k = keys[key(rng)];
+        if(percent(rng) < read_percent) {
+            map.get(k, v);
+        } else {
+            map.put(k, k);
+        }
+        ++res.ops;
+    }
+}
+
+template<class Map>
+static double run(Map &map, int threads, const vector<uint64_t> &keys, int read_percent,
+                  double seconds)
+{
+    atomic<bool> stop(false);
+    vector<result_t> results(threads);
+    vector<thread> pool;
+    for(int t = 0; t < threads; ++t) {
+        pool.push_back(thread(worker<Map>, ref(map), cref(keys), read_percent, cref(stop),
+                              unsigned(t + 1), ref(results[t])));
+    }
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    stop = true;
+    size_t ops = 0;
+    for(int t = 0; t < threads; ++t) {
+        pool[t].join();
+        ops += results[t].ops;
+    }
+    return ops / seconds;
+}
+
+int main(int argc, const char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 64;
+    size_t count = argc > 2 ? atol(argv[2]) : 1000000;
+    int read_percent = argc > 3 ? atoi(argv[3]) : 90;
+    double seconds = argc > 4 ? atof(argv[4]) : 1;
+
+    concurrent_hash_map_t<uint64_t, uint64_t> concurrent;
+    locked_map_t locked;
+    // not 0, 1, 2... which an identity hash would keep in order in memory
+    mt19937_64 rng(1);
+    vector<uint64_t> keys(count);
+    for(size_t i = 0; i < count; ++i) {
+        keys[i] = rng();
+        concurrent.put(keys[i], i);
+        locked.put(keys[i], i);
+    }
+
+    printf("%zu keys, %d%% reads, %.1fs per run\n", count, read_percent, seconds);
+    printf("threads   concurrent  mutex+hash_map (ops/sec)\n");
+    for(int threads = 1; threads <= max_threads; threads *= 2) {
+        double c = run(concurrent, threads, keys, read_percent, seconds);
+        double l = run(locked, threads, keys, read_percent, seconds);
+        printf("%7d %12.0f %12.0f\n", threads, c, l);
+    }
+    return 0;
+}
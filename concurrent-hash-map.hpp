@@ -0,0 +1,383 @@
+#ifndef CONCURRENT_HASH_MAP_HPP
+#define CONCURRENT_HASH_MAP_HPP
+
+#include <assert.h>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+using namespace std;
+
+#include "epoch.hpp"
+#include "hash-map.hpp"
+
+// concurrent_hash_map_t: hash_map_t for sharing between threads, made for
+// read-mostly use.
+//
+// The table is open addressing (linear probing) over atomic pointers to
+// immutable nodes. A get() takes no lock and writes nothing but its epoch
+// pin: it follows the pointers and copies the value out. A put() or
+// erase() locks one of STRIPES mutexes, picked by the key's hash, so that
+// writers of the same key go one at a time; slots are claimed with CAS.
+// An update swaps in a new node and an erase leaves a tombstone; the old
+// node is freed through epoch.hpp once no reader can be looking at it.
+//
+// Each slot also keeps the hash of the first key it held, so that probing
+// past other keys does not load their nodes. It is written once, after
+// the slot is claimed (until then lookups look at the node), and so a
+// tombstone can only be reused by a key with the same hash; the others
+// are cleared by the next resize.
+//
+// Once 3/4 of the slots have been used (tombstones included) the table is
+// replaced by one twice as large, or as large if mostly tombstones. Every
+// writer that comes along helps: they take chunks of CHUNK slots, move the
+// nodes (the pointers, not copies) to the new table and mark the old slots
+// MOVED, and the last one done makes the new table current. A reader that
+// meets MOVED carries on in the new table; a writer waits for the resize.
+template<class K, class V, class Hash = hash_t<K>, class Compare = compare_t<K> >
+class concurrent_hash_map_t {
+    enum {
+        MIN_SIZE = 64,
+        STRIPES = 256,
+        // slots a resize helper moves at a time
+        CHUNK = 1024
+    };
+
+    struct node_t {
+        node_t(size_t hash, const K &key, const V &value)
+            : hash(hash), key(key), value(value) {}
+        const size_t hash;
+        const K key;
+        const V value;
+    };
+
+    struct slot_t {
+        slot_t() : node(NULL), tag(0) {}
+        atomic<node_t *> node;
+        // tag_of() the hash of its key, 0 until known
+        atomic<size_t> tag;
+    };
+
+    struct table_t {
+        explicit table_t(size_t size)
+            : mask(size - 1), slots(new slot_t[size]), used(0),
+              next(NULL), migrate_pos(0), migrated(0) {}
+        ~table_t() { delete[] slots; }
+
+        size_t size() const { return mask + 1; }
+
+        const size_t mask;
+        slot_t *const slots;
+        // slots ever claimed, tombstones included
+        atomic<size_t> used;
+        // the table being resized into
+        atomic<table_t *> next;
+        // next slot to migrate, and slots migrated
+        atomic<size_t> migrate_pos;
+        atomic<size_t> migrated;
+    };
+
+public:
+    concurrent_hash_map_t() : root(new table_t(MIN_SIZE)), entries(0) {}
+
+    // No other thread may use the map any more.
+    ~concurrent_hash_map_t() {
+        table_t *t = root.load();
+        for(size_t i = 0; i < t->size(); ++i) {
+            node_t *n = t->slots[i].node.load();
+            if(is_node(n)) {
+                delete n;
+            }
+        }
+        delete t;
+    }
+
+    // Copies the value out. Lock-free.
+    bool get(const K &k, V &v) const {
+        size_t h = hash_of(k);
+        epoch_manager_t::guard_t guard = epochs.pin();
+        table_t *t = root.load(memory_order_acquire);
+        for(size_t i = h & t->mask;; i = (i + 1) & t->mask) {
+            node_t *n = t->slots[i].node.load(memory_order_acquire);
+            if(n == moved()) {
+                // what was here is in the next table by now
+                t = t->next.load(memory_order_acquire);
+                i = (h & t->mask) - 1;
+                continue;
+            }
+            if(!n) {
+                return false;
+            }
+            if(n != tombstone() && holds(t->slots[i], n, h) && compare(n->key, k)) {
+                v = n->value;
+                return true;
+            }
+        }
+    }
+
+    // Insert or replace
+    void put(const K &k, const V &v) {
+        size_t h = hash_of(k);
+        node_t *n = new node_t(h, k, v);
+        // other keys' nodes and old tables are only freed once we let go
+        epoch_manager_t::guard_t guard = epochs.pin();
+        for(;;) {
+            table_t *t = writable();
+            node_t *old = NULL;
+            result_t r;
+            {
+                lock_guard<mutex> lock(stripe_of(h));
+                r = store(t, n, old);
+            }
+            if(r == DONE) {
+                if(old) {
+                    epochs.retire(old);
+                } else {
+                    entries.fetch_add(1, memory_order_relaxed);
+                }
+                return;
+            }
+            if(r == FULL) {
+                start_resize(t);
+            }
+        }
+    }
+
+    bool erase(const K &k) {
+        size_t h = hash_of(k);
+        epoch_manager_t::guard_t guard = epochs.pin();
+        for(;;) {
+            table_t *t = writable();
+            node_t *old = NULL;
+            result_t r;
+            {
+                lock_guard<mutex> lock(stripe_of(h));
+                r = remove(t, h, k, old);
+            }
+            if(r == DONE) {
+                if(!old) {
+                    return false;
+                }
+                entries.fetch_sub(1, memory_order_relaxed);
+                epochs.retire(old);
+                return true;
+            }
+        }
+    }
+
+    size_t size() const {
+        return entries.load(memory_order_relaxed);
+    }
+
+private:
+    concurrent_hash_map_t(const concurrent_hash_map_t &);
+    concurrent_hash_map_t &operator=(const concurrent_hash_map_t &);
+
+    enum result_t {
+        DONE,
+        // the table is being resized: help, then try again
+        AGAIN,
+        // no free slot left without going over the load factor
+        FULL
+    };
+
+    // what a slot holds once its node was erased, or migrated
+    static node_t *tombstone() { return (node_t *)1; }
+    static node_t *moved() { return (node_t *)2; }
+
+    static bool is_node(node_t *n) {
+        return n && n != tombstone() && n != moved();
+    }
+
+    // never 0
+    static size_t tag_of(size_t h) {
+        return h | 1;
+    }
+
+    // Whether n, found in s, has hash h; without loading n if s knows
+    static bool holds(const slot_t &s, node_t *n, size_t h) {
+        size_t tag = s.tag.load(memory_order_relaxed);
+        if(tag && tag != tag_of(h)) {
+            return false;
+        }
+        return n->hash == h;
+    }
+
+    // Claim an empty slot for n
+    static bool claim(slot_t &s, node_t *n) {
+        node_t *expected = NULL;
+        if(!s.node.compare_exchange_strong(expected, n, memory_order_acq_rel)) {
+            return false;
+        }
+        s.tag.store(tag_of(n->hash), memory_order_relaxed);
+        return true;
+    }
+
+    // std::hash is often the identity, which linear probing does not like
+    static size_t hash_of(const K &k) {
+        return hash_mix64(Hash()(k));
+    }
+
+    mutex &stripe_of(size_t h) {
+        return stripes[(h >> 32) % STRIPES].m;
+    }
+
+    // The current table once no resize is under way, helping along the
+    // one that is
+    table_t *writable() {
+        for(;;) {
+            table_t *t = root.load(memory_order_acquire);
+            if(!t->next.load(memory_order_acquire)) {
+                return t;
+            }
+            help_resize(t);
+        }
+    }
+
+    // Put n in t, replacing the node with its key if any ('old'); under
+    // the key's stripe lock.
+    result_t store(table_t *t, node_t *n, node_t *&old) {
+        size_t first_free = NIL;
+        for(size_t i = n->hash & t->mask;; i = (i + 1) & t->mask) {
+            node_t *p = t->slots[i].node.load(memory_order_acquire);
+            if(p == moved()) {
+                return AGAIN;
+            }
+            if(p == tombstone()) {
+                if(first_free == NIL &&
+                   t->slots[i].tag.load(memory_order_relaxed) == tag_of(n->hash)) {
+                    first_free = i;
+                }
+                continue;
+            }
+            if(p) {
+                if(holds(t->slots[i], p, n->hash) && compare(p->key, n->key)) {
+                    // while we hold the stripe only a resize can change
+                    // the slot: then try again
+                    if(!t->slots[i].node.compare_exchange_strong(p, n, memory_order_acq_rel)) {
+                        return AGAIN;
+                    }
+                    old = p;
+                    return DONE;
+                }
+                continue;
+            }
+            // the end of the probe sequence: the key is not there
+            if(first_free != NIL) {
+                node_t *expected = tombstone();
+                if(t->slots[first_free].node.compare_exchange_strong(expected, n,
+                                                                     memory_order_acq_rel)) {
+                    return DONE;
+                }
+                // taken by a key with the same hash, or moved: start over
+                return AGAIN;
+            }
+            if((t->used.load(memory_order_relaxed) + 1) * 4 > t->size() * 3) {
+                return FULL;
+            }
+            if(claim(t->slots[i], n)) {
+                t->used.fetch_add(1, memory_order_relaxed);
+                return DONE;
+            }
+            return AGAIN;
+        }
+    }
+
+    // Tombstone the node with key k ('old'), if any; under its stripe lock
+    result_t remove(table_t *t, size_t h, const K &k, node_t *&old) {
+        for(size_t i = h & t->mask;; i = (i + 1) & t->mask) {
+            node_t *p = t->slots[i].node.load(memory_order_acquire);
+            if(p == moved()) {
+                return AGAIN;
+            }
+            if(!p) {
+                return DONE;
+            }
+            if(p != tombstone() && holds(t->slots[i], p, h) && compare(p->key, k)) {
+                if(!t->slots[i].node.compare_exchange_strong(p, tombstone(),
+                                                             memory_order_acq_rel)) {
+                    return AGAIN;
+                }
+                old = p;
+                return DONE;
+            }
+        }
+    }
+
+    void start_resize(table_t *t) {
+        if(t->next.load(memory_order_acquire)) {
+            return;
+        }
+        // mostly tombstones: the same size will do
+        size_t live = entries.load(memory_order_relaxed);
+        size_t size = live * 2 > t->size() / 2 ? t->size() * 2 : t->size();
+        table_t *next = new table_t(size);
+        table_t *expected = NULL;
+        if(!t->next.compare_exchange_strong(expected, next, memory_order_acq_rel)) {
+            delete next;
+        }
+    }
+
+    // Move chunks of t to t->next until none are left, then wait for the
+    // other helpers; the last one done makes the new table current.
+    void help_resize(table_t *t) {
+        table_t *next = t->next.load(memory_order_acquire);
+        size_t start;
+        while((start = t->migrate_pos.fetch_add(CHUNK)) < t->size()) {
+            size_t end = min<size_t>(start + CHUNK, t->size());
+            for(size_t i = start; i < end; ++i) {
+                migrate(t, next, i);
+            }
+            if(t->migrated.fetch_add(end - start) + (end - start) == t->size()) {
+                root.store(next, memory_order_release);
+                epochs.retire(t);
+                return;
+            }
+        }
+        while(root.load(memory_order_acquire) == t) {
+            this_thread::yield();
+        }
+    }
+
+    void migrate(table_t *t, table_t *next, size_t i) {
+        for(;;) {
+            node_t *p = t->slots[i].node.load(memory_order_acquire);
+            if(!is_node(p)) {
+                if(t->slots[i].node.compare_exchange_strong(p, moved(), memory_order_acq_rel)) {
+                    return;
+                }
+                continue;
+            }
+            // keep writers of this key off it while it moves
+            lock_guard<mutex> lock(stripe_of(p->hash));
+            if(t->slots[i].node.load(memory_order_acquire) != p) {
+                continue;
+            }
+            // nothing else inserts in next yet but other helpers
+            for(size_t j = p->hash & next->mask;; j = (j + 1) & next->mask) {
+                if(claim(next->slots[j], p)) {
+                    next->used.fetch_add(1, memory_order_relaxed);
+                    break;
+                }
+            }
+            t->slots[i].node.store(moved(), memory_order_release);
+            return;
+        }
+    }
+
+    static const size_t NIL = ~(size_t)0;
+
+    // one per cache line
+    struct stripe_t {
+        mutex m;
+        char pad[64 - sizeof(mutex) % 64];
+    };
+
+    atomic<table_t *> root;
+    atomic<size_t> entries;
+    Compare compare;
+    stripe_t stripes[STRIPES];
+    mutable epoch_manager_t epochs;
+};
+
+#endif /* CONCURRENT_HASH_MAP_HPP */
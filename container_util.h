@@ -70,7 +70,7 @@ inline typename const_reverse_iterator_wrapper<C>::type get_const_reverse_iterat
 
 /// general
 template<typename C, typename K>
-inline bool contains(C c, K k)
+inline bool contains(const C &c, const K &k)
 {
   return c.find(k) != c.end();
 }
@@ -1,63 +1,161 @@
 #ifndef DB_MEM_HPP
 #define DB_MEM_HPP
 
+#include <string.h>
+
+#include "epoch.hpp"
+
+// Receives every change made to a db_mem before it is applied, e.g. to
+// make it durable (see db-wal.hpp).
+struct db_commit_listener_t {
+    virtual ~db_commit_listener_t() {}
+    // A transaction (or a single add/delete outside one) is about to be
+    // applied: 'clear' first, then 'deletes', then 'adds'.
+    virtual void log_commit(const map<string, string> &adds,
+                            const set<string> &deletes,
+                            bool clear) = 0;
+    // The change above is now visible in the db.
+    virtual void applied() {}
+};
+
+// A value found by find_view(), without copying it: points at the db's
+// own copy. Values shorter than a string object are copied in, since they
+// live inside the index's nodes rather than in a buffer of their own.
+class db_value_view_t {
+public:
+    enum { SHORT_SIZE = sizeof(string) };
+
+    db_value_view_t() : data_(short_), size_(0) {}
+    db_value_view_t(const db_value_view_t &o) { *this = o; }
+    db_value_view_t &operator=(const db_value_view_t &o) {
+        if(o.data_ == o.short_) {
+            set(o.data_, o.size_);
+        } else {
+            data_ = o.data_;
+            size_ = o.size_;
+        }
+        return *this;
+    }
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    string str() const { return string(data_, size_); }
+
+    void set(const string &value) {
+        set(value.data(), value.size());
+    }
+
+private:
+    void set(const char *data, size_t size) {
+        if(size < SHORT_SIZE) {
+            memcpy(short_, data, size);
+            data_ = short_;
+        } else {
+            data_ = data;
+        }
+        size_ = size;
+    }
+
+    const char *data_;
+    size_t size_;
+    char short_[SHORT_SIZE];
+};
+
 // implement an in-memory db.
 // with its transaction data also in memory.
-class db_mem{
+//
+// 'Index' holds the committed data: any ordered map from string to string
+// with map's find/count/lower_bound/operator[]/erase/clear/size and iterators whose
+// ->first/->second are the key and value, e.g. bptree_t<string>
+// (b-tree.hpp) for large dbs.
+template<class Index = map<string, string> >
+class db_mem_t{
 public:
-    db_mem() : db(), transactionData_() {
+    typedef Index index_type;
+
+    db_mem_t() : db_(), transactionData_(), listener_(NULL), epochs_(NULL) {
     }
 
-    ~db_mem() {
+    ~db_mem_t() {
 
     }
 
     bool find(const blob_t &key, string &value) const {
-        if(transactionData_) {
-            if(contains(transactionData_->adds, key)) {
-                value= transactionData_->adds[key];
-                return true;
-            } else if(contains(transactionData_->deletes, key)) {
-                return false;
-            }
+        const string *found = lookup(key);
+        if(found) {
+            value = *found;
         }
-        if(contains(db, key)) {
-            value = db[key];
-            return true;
+        return found != NULL;
+    }
+
+    // Like find(), without copying the value. The view is valid until the
+    // key is changed or deleted; with set_epochs(), for as long as the
+    // reader keeps an epoch pinned from before the lookup. The Index must
+    // move, not copy, the values it shuffles between nodes (map and
+    // bptree_t do), so that other keys' inserts leave the buffer in place.
+    bool find_view(const blob_t &key, db_value_view_t &view) const {
+        const string *found = lookup(key);
+        if(found) {
+            view.set(*found);
         }
-        return false;
+        return found != NULL;
     }
 
     bool has_key(const blob_t &key) const {
-        string xxx;
-        return find(key, xxx);
+        return lookup(key) != NULL;
     }
 
     void add(const blob_t &key,
              const blob_t &value,
              bool replace) {
         if(transactionData_) {
-            if(has_key(key) && !replace) {
+            bool exists = has_key(key);
+            if(exists && !replace) {
                 return;
             }
+            if(!exists) {
+                transactionData_->delta++;
+            }
             transactionData_->adds[key] = value;
             transactionData_->deletes.erase(key);
         } else {
-            if(contains(db, key) && !replace) {
+            if(contains(db_, key) && !replace) {
                 return;
             }
-            db[key] = value;
+            if(listener_) {
+                map<string, string> adds;
+                adds[key] = value;
+                listener_->log_commit(adds, set<string>(), false);
+            }
+            db_put(key, value);
+            if(listener_) {
+                listener_->applied();
+            }
         }
     }
 
     void delete_key(const blob_t &key) {
         if(transactionData_) {
+            if(has_key(key)) {
+                transactionData_->delta--;
+            }
             transactionData_->adds.erase(key);
-            if(contains(db, key)) {
-                transactionData_->deletes.insert(k);
+            if(!transactionData_->cleared && contains(db_, key)) {
+                transactionData_->deletes.insert(key);
             }
         } else {
-            db.erase(key);
+            if(!contains(db_, key)) {
+                return;
+            }
+            if(listener_) {
+                set<string> deletes;
+                deletes.insert(key);
+                listener_->log_commit(map<string, string>(), deletes, false);
+            }
+            db_erase(key);
+            if(listener_) {
+                listener_->applied();
+            }
         }
     }
 
@@ -68,13 +166,24 @@ public:
 
     void end_transaction() {
         assert(transactionData_);
-        foreach(i, transactionData_->adds) {
-            db_[i->first] = i->second;
+        if(listener_) {
+            listener_->log_commit(transactionData_->adds,
+                                  transactionData_->deletes,
+                                  transactionData_->cleared);
+        }
+        if(transactionData_->cleared) {
+            db_clear();
         }
         foreach(i, transactionData_->deletes) {
-            db_.erase(*i);
+            db_erase(*i);
+        }
+        foreach(i, transactionData_->adds) {
+            db_put(i->first, i->second);
         }
         transactionData_.reset();
+        if(listener_) {
+            listener_->applied();
+        }
     }
 
     void abort_transaction() {
@@ -83,114 +192,318 @@ public:
     }
 
     bool in_transaction() const {
-        return transactionData_;
+        return transactionData_.get() != NULL;
+    }
+
+    // At most one; NULL to detach. Changes made while attached are passed
+    // to it before they are applied.
+    void set_commit_listener(db_commit_listener_t *listener) {
+        listener_ = listener;
+    }
+
+    // Hand the committed values that get overwritten or deleted to
+    // 'epochs' instead of freeing them, so that find_view() results stay
+    // valid for readers pinned in it (see db_sharded_t::find_view). NULL
+    // to free them right away again.
+    void set_epochs(epoch_manager_t *epochs) {
+        epochs_ = epochs;
     }
 
-    // what? can't clear in a transaction?
+    // In a transaction, only marks the db as cleared; it is emptied on
+    // commit.
     void clear() {
         if(transactionData_) {
             transactionData_->adds.clear();
             transactionData_->deletes.clear();
-            foreach(it, db) {
-                transactionData_->deletes.add(it->first);
-            }
+            transactionData_->cleared = true;
+            transactionData_->delta = 0;
         } else {
-            db.clear();
+            if(listener_) {
+                listener_->log_commit(map<string, string>(), set<string>(), true);
+            }
+            db_clear();
+            if(listener_) {
+                listener_->applied();
+            }
         }
     }
 
-    // return false if:
-    // 1) there are adds (replace?)
-    // 2) if there is at least one in db but not in deletes
     bool empty() const {
+        return size() == 0;
+    }
+
+    // return sizeof(db) (or 0 if cleared) + the transaction's net change
+    size_t size() const {
         if(transactionData_) {
-            if(!transactionData_->adds.empty()) {
-                return false;
+            return (transactionData_->cleared ? 0 : db_.size()) + transactionData_->delta;
+        }
+        return db_.size();
+    }
+
+    // Cursor over a range of keys in order, as seen from the transaction
+    // if there is one: the transaction's adds are merged with the db while
+    // walking it, and its deletes are skipped. Any change to the db or the
+    // transaction invalidates it.
+    //
+    //   for(db_mem::cursor_t c = db.prefix("user:"); c.valid(); c.next()) {
+    //       use(c.key(), c.value());
+    //   }
+    class cursor_t {
+    public:
+        bool valid() const { return valid_; }
+        // Read through the iterators rather than kept as pointers: a
+        // bptree_t iterator holds the key it returns, so a pointer to it
+        // would not survive copying the cursor.
+        const string &key() const { return from_adds ? adds_it->first : db_it->first; }
+        const string &value() const { return from_adds ? adds_it->second : db_it->second; }
+
+        void next() {
+            assert(valid());
+            if(from_adds) {
+                ++adds_it;
+            } else {
+                ++db_it;
+            }
+            settle();
+        }
+
+    private:
+        friend class db_mem_t;
+
+        cursor_t(const db_mem_t *impl, const blob_t &lo, const blob_t &hi, bool bounded)
+            : impl(impl),
+              txn(impl->transactionData_.get()),
+              hi(hi),
+              bounded(bounded),
+              db_it(txn && txn->cleared ? impl->db_.end() : impl->db_.lower_bound(lo)) {
+            if(txn) {
+                adds_it = txn->adds.lower_bound(lo);
+                deletes_it = txn->deletes.lower_bound(lo);
             }
-            foreach(it, db) {
-                if(!contains(transactionData_, it->first)) {
-                    return false;
+            settle();
+        }
+
+        bool in_range(const string &k) const {
+            return !bounded || k < hi;
+        }
+
+        // Move to the smallest remaining entry, from_adds telling whose.
+        void settle() {
+            const string *db_key = NULL;
+            for(; db_it != impl->db_.end(); ++db_it) {
+                db_key = &db_it->first;
+                if(!txn) {
+                    break;
+                }
+                // both sets are walked along with the db, so this is
+                // only ever a comparison with their next key
+                while(deletes_it != txn->deletes.end() && *deletes_it < *db_key) {
+                    ++deletes_it;
                 }
+                bool deleted = deletes_it != txn->deletes.end() && *deletes_it == *db_key;
+                bool replaced = adds_it != txn->adds.end() && adds_it->first == *db_key;
+                if(!deleted && !replaced) {
+                    break;
+                }
+                db_key = NULL;
+            }
+            if(db_key && !in_range(*db_key)) {
+                db_key = NULL;
             }
+            from_adds = txn && adds_it != txn->adds.end() && in_range(adds_it->first) &&
+                        (!db_key || adds_it->first < *db_key);
+            valid_ = from_adds || db_key;
         }
-        return db.empty();
+
+        const db_mem_t *impl;
+        const typename db_mem_t::TransactionData *txn;
+        string hi;
+        bool bounded;
+
+        typename Index::const_iterator db_it;
+        map<string, string>::const_iterator adds_it;
+        set<string>::const_iterator deletes_it;
+        // whether the current entry is adds_it's or db_it's
+        bool from_adds;
+        bool valid_;
+    };
+
+    // Keys in [lo, hi)
+    cursor_t scan(const blob_t &lo, const blob_t &hi) const {
+        return cursor_t(this, lo, hi, true);
     }
 
-    // return sizeof(db) + sizeof(db-adds) - sizeof(deletes)
-    size_t size() const {
-       size_t rv = db.size();
-       if(transactionData_)  {
-           foreach(it, transactionData_->adds) {
-               if(!contains(db, it->first)) {
-                   rv++;
-               }
-           }
-           rv -= (transactionData_->deletes).size();
-       }
-       return rv;
+    // Keys from lo on
+    cursor_t scan(const blob_t &lo) const {
+        return cursor_t(this, lo, string(), false);
+    }
+
+    // Keys starting with p
+    cursor_t prefix(const blob_t &p) const {
+        // the first string after all those starting with p, if any
+        string hi = p;
+        while(!hi.empty() && (unsigned char)hi[hi.size() - 1] == 0xff) {
+            hi.resize(hi.size() - 1);
+        }
+        if(hi.empty()) {
+            return scan(p);
+        }
+        hi[hi.size() - 1]++;
+        return scan(p, hi);
     }
 
 protected:
 
     // it will be iterates (adds + db - deletes)
     // to make it simple, output adds first, then db.
-    friend struct value_iterator {
-        value_iterator(db_mem* impl, bool &isValid) 
-            : db(impl->db),
-            db_it(db.begin()) {
-                if(impl->transactionData_) {
+    struct value_iterator {
+        value_iterator(const db_mem_t* impl, bool &isValid)
+            : impl(impl),
+            db_it(impl->db_.begin()),
+            in_adds(impl->transactionData_.get() != NULL) {
+                if(in_adds) {
                     adds_it = (impl->transactionData_->adds).begin();
+                    if(impl->transactionData_->cleared) {
+                        db_it = impl->db_.end();
+                    }
                 }
-                if(!inc(true)) {
-                    isValid = false;
-                } else {
-                    isValid = true;
-                }
+                isValid = inc(true);
         }
 
+        // Move to the next entry (or settle on the first one if 'skip');
+        // returns false once everything has been seen.
         bool inc(bool skip) {
-            if(impl->transactionData_) {
-                map<string>::const_iterator adds_end = (impl->transactionData_->adds).end();
+            if(in_adds) {
+                map<string, string>::const_iterator adds_end = (impl->transactionData_->adds).end();
+                if(!skip && adds_it != adds_end) {
+                    ++adds_it;
+                    skip = true;
+                }
                 if(adds_it != adds_end) {
-                    if(!skip) {
-                        ++adds_it;
-                    } 
-                    if((it = adds_it) != adds_end) {
-                        return true;
-                    }
-                } 
+                    return true;
+                }
+                in_adds = false;
             }
             if(!skip) {
                 ++db_it;
             }
-            return (it == db_it) != db.end();
+            // entries overridden or deleted by the transaction were
+            // already output, or must not be
+            while(db_it != impl->db_.end() && impl->transactionData_ &&
+                  (impl->transactionData_->adds.count(db_it->first) ||
+                   impl->transactionData_->deletes.count(db_it->first))) {
+                ++db_it;
+            }
+            return db_it != impl->db_.end();
         }
 
+        const string &key() const { return in_adds ? adds_it->first : db_it->first; }
+        const string &value() const { return in_adds ? adds_it->second : db_it->second; }
+
     private:
-        const map<string, string> &db;
+        const db_mem_t *impl;
 
-        map<string, string>::const_iterator db_it;
+        typename Index::const_iterator db_it;
         map<string, string>::const_iterator adds_it;
-
-        // it points to either db_it or adds_it
-        map<string, string>::const_iterator it;
+        // whether the current entry is adds_it's or db_it's
+        bool in_adds;
     };
+    friend struct value_iterator;
 
     key_iterator_impl_base *key_begin_ptr() const;
 
     key_value_iterator_impl_base *key_value_begin_ptr() const;
 
 private:
-    map<string, string> db_;
+    const string *lookup(const blob_t &key) const {
+        if(transactionData_) {
+            map<string, string>::const_iterator it = transactionData_->adds.find(key);
+            if(it != transactionData_->adds.end()) {
+                return &it->second;
+            } else if(transactionData_->cleared ||
+                      contains(transactionData_->deletes, key)) {
+                return NULL;
+            }
+        }
+        typename Index::const_iterator it = db_.find(key);
+        if(it != db_.end()) {
+            return &it->second;
+        }
+        return NULL;
+    }
+
+    // All changes to db_ go through these, for set_epochs().
+
+    void db_put(const string &key, const string &value) {
+        if(epochs_) {
+            typename Index::iterator it = db_.find(key);
+            if(it != db_.end()) {
+                retire_value(it->second);
+                it->second = value;
+                return;
+            }
+        }
+        db_[key] = value;
+    }
+
+    void db_erase(const string &key) {
+        if(epochs_) {
+            typename Index::iterator it = db_.find(key);
+            if(it == db_.end()) {
+                return;
+            }
+            retire_value(it->second);
+        }
+        db_.erase(key);
+    }
+
+    void db_clear() {
+        if(epochs_) {
+            foreach(it, db_) {
+                retire_value(it->second);
+            }
+        }
+        db_.clear();
+    }
+
+    // Views of short values are copies; the others point at the value's
+    // buffer, which moving the string hands over to the retired copy.
+    void retire_value(string &value) {
+        if(value.size() >= db_value_view_t::SHORT_SIZE) {
+            const char *data = value.data();
+            string *retired = new string(std::move(value));
+            assert(retired->data() == data);
+            (void)data;
+            epochs_->retire(retired);
+        }
+    }
+
+    // db-wal.hpp reads the committed state to write snapshots
+    template<class> friend class db_wal_t;
+
+    Index db_;
 
-    // journal
+    // journal; deletes only holds keys of the db, never in adds
     struct TransactionData {
+        TransactionData() : cleared(false), delta(0) {}
         map<string, string> adds;
         set<string> deletes;
+        // the db was cleared first: none of its entries are visible and
+        // deletes is empty
+        bool cleared;
+        // size() - the size of the db (0 if cleared), kept up to date by
+        // add/delete_key/clear
+        ptrdiff_t delta;
     };
 
     // Set if in a transaction; contains enough information to commit
     // or abort the transaction.
     scoped_ptr<TransactionData> transactionData_;
+
+    db_commit_listener_t *listener_;
+
+    epoch_manager_t *epochs_;
 };
+
+typedef db_mem_t<> db_mem;
 #endif /* DB_MEM_HPP */
@@ -0,0 +1,99 @@
+// Throughput of db_mvcc under a mixed find/add load.
+//
+// usage: db-mvcc-bench [max-threads [keys [seconds [write-percent]]]]
+//
+// Every thread runs transactions of 4 operations on uniformly chosen keys;
+// 'write-percent' of the operations are adds. Reports committed operations
+// per second and the abort rate for 1, 2, 4, ... max-threads threads.
+
+#include "db-mvcc.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+static string key_of(size_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key%012zu", i);
+    return buf;
+}
+
+// one per thread, padded so the counters do not share cache lines
+struct alignas(64) result_t {
+    result_t() : ops(0), commits(0), aborts(0) {}
+    size_t ops;
+    size_t commits;
+    size_t aborts;
+};
+
+static void worker(db_mvcc &db, size_t keys, int write_percent,
+                   const atomic<bool> &stop, unsigned seed, result_t &res)
+{
+    mt19937_64 rng(seed);
+    uniform_int_distribution<size_t> pick(0, keys - 1);
+    uniform_int_distribution<int> percent(0, 99);
+    string value;
+    while(!stop.load(memory_order_relaxed)) {
+        db_mvcc::transaction_t txn;
+        db.begin_transaction(txn);
+        for(int i = 0; i < 4; ++i) {
+            string key = key_of(pick(rng));
+            if(percent(rng) < write_percent) {
+                db.add(txn, key, key, true);
+            } else {
+                db.find(txn, key, value);
+            }
+        }
+        if(db.end_transaction(txn)) {
+            res.ops += 4;
+            ++res.commits;
+        } else {
+            ++res.aborts;
+        }
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+    size_t keys = argc > 2 ? atol(argv[2]) : 1000000;
+    double seconds = argc > 3 ? atof(argv[3]) : 2;
+    int write_percent = argc > 4 ? atoi(argv[4]) : 10;
+
+    db_mvcc db;
+    for(size_t i = 0; i < keys; ++i) {
+        string key = key_of(i);
+        db.add(key, key, true);
+    }
+
+    printf("%zu keys, %d%% writes, %.1fs per run\n", keys, write_percent, seconds);
+    printf("threads      ops/sec   abort%%\n");
+    for(int threads = 1; threads <= max_threads; threads *= 2) {
+        atomic<bool> stop(false);
+        vector<result_t> results(threads);
+        vector<thread> pool;
+        for(int t = 0; t < threads; ++t) {
+            pool.push_back(thread(worker, ref(db), keys, write_percent,
+                                  cref(stop), unsigned(t + 1), ref(results[t])));
+        }
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        stop = true;
+        for(int t = 0; t < threads; ++t) {
+            pool[t].join();
+        }
+
+        result_t total;
+        for(int t = 0; t < threads; ++t) {
+            total.ops += results[t].ops;
+            total.commits += results[t].commits;
+            total.aborts += results[t].aborts;
+        }
+        printf("%7d %12.0f %8.3f\n", threads, total.ops / seconds,
+               100.0 * total.aborts / max<size_t>(1, total.commits + total.aborts));
+    }
+    return 0;
+}
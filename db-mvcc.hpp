@@ -0,0 +1,384 @@
+#ifndef DB_MVCC_HPP
+#define DB_MVCC_HPP
+
+#include <assert.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+// A multi-version variant of db_mem: any number of transactions can be open
+// at the same time, from any number of threads.
+//
+// - every commit gets the next version number; a key maps to the chain of
+//   values it had, oldest first.
+// - a transaction reads the snapshot that was committed when it began, plus
+//   its own writes, which it buffers exactly like db_mem::TransactionData.
+// - end_transaction validates optimistically: if a key the transaction read
+//   or wrote was committed by someone else after the snapshot, the
+//   transaction is aborted and end_transaction returns false.
+// - versions no open snapshot can see any more are garbage collected every
+//   'gc_interval' commits that wrote something, or on demand; only keys
+//   written since the last collection are looked at.
+//
+// The key space is split in partitions with their own lock so that readers
+// only share a lock with the few writers installing into the same partition;
+// commits themselves are serialized.
+class db_mvcc {
+public:
+    typedef uint64_t version_t;
+
+    class transaction_t {
+    public:
+        transaction_t() : db(NULL), snapshot(0) {}
+        ~transaction_t() {
+            if(db) {
+                db->abort_transaction(*this);
+            }
+        }
+
+        bool active() const { return db != NULL; }
+        version_t get_snapshot() const { return snapshot; }
+
+    private:
+        friend class db_mvcc;
+        transaction_t(const transaction_t &);
+        transaction_t &operator=(const transaction_t &);
+
+        db_mvcc *db;
+        version_t snapshot;
+        // journal, as in db_mem
+        map<string, string> adds;
+        set<string> deletes;
+        // keys read from the snapshot, for validation
+        set<string> reads;
+    };
+
+    explicit db_mvcc(size_t partitions = 64, size_t gc_interval = 1024)
+        : parts(partitions ? partitions : 1),
+          committed(0),
+          gc_interval(gc_interval),
+          commits_since_gc(0) {
+    }
+
+    // Transactions must be ended or aborted before the db goes away.
+    ~db_mvcc() {}
+
+    void begin_transaction(transaction_t &txn) {
+        assert(!txn.db);
+        lock_guard<mutex> lock(snapshots_mutex);
+        txn.db = this;
+        txn.snapshot = committed.load(memory_order_acquire);
+        snapshots.insert(txn.snapshot);
+    }
+
+    bool find(transaction_t &txn, const string &key, string &value) const {
+        assert(txn.db == this);
+        map<string, string>::const_iterator a = txn.adds.find(key);
+        if(a != txn.adds.end()) {
+            value = a->second;
+            return true;
+        }
+        if(txn.deletes.count(key)) {
+            return false;
+        }
+        txn.reads.insert(key);
+        return find_at(txn.snapshot, key, value);
+    }
+
+    bool has_key(transaction_t &txn, const string &key) const {
+        string xxx;
+        return find(txn, key, xxx);
+    }
+
+    void add(transaction_t &txn,
+             const string &key,
+             const string &value,
+             bool replace) {
+        assert(txn.db == this);
+        if(!replace && has_key(txn, key)) {
+            return;
+        }
+        txn.adds[key] = value;
+        txn.deletes.erase(key);
+    }
+
+    void delete_key(transaction_t &txn, const string &key) {
+        assert(txn.db == this);
+        txn.adds.erase(key);
+        txn.deletes.insert(key);
+    }
+
+    // Returns false, and leaves the db untouched, if the transaction
+    // conflicts with one committed after its snapshot. Either way the
+    // transaction is over.
+    bool end_transaction(transaction_t &txn) {
+        assert(txn.db == this);
+        bool ok = true, installed = false;
+        if(!txn.adds.empty() || !txn.deletes.empty()) {
+            unique_lock<mutex> lock(commit_mutex);
+            ok = validate(txn);
+            if(ok) {
+                install(txn, committed.load(memory_order_relaxed) + 1);
+                installed = true;
+            }
+        }
+        release(txn);
+        if(installed) {
+            count_commit();
+        }
+        return ok;
+    }
+
+    void abort_transaction(transaction_t &txn) {
+        assert(txn.db == this);
+        release(txn);
+    }
+
+    // Reads and single-key writes outside of a transaction; the writes
+    // commit immediately and cannot conflict.
+    // No snapshot is registered for the read, so the version is picked under
+    // the partition lock: collect_garbage() trims under it too, and never
+    // past a 'committed' it loaded earlier, so the newest record at or below
+    // the 'committed' loaded here is still there.
+    bool find(const string &key, string &value) const {
+        const partition_t &p = partition_of(key);
+        shared_lock<shared_timed_mutex> lock(p.lock);
+        return find_locked(p, committed.load(memory_order_acquire), key, value);
+    }
+
+    bool has_key(const string &key) const {
+        string xxx;
+        return find(key, xxx);
+    }
+
+    void add(const string &key, const string &value, bool replace) {
+        {
+            lock_guard<mutex> lock(commit_mutex);
+            version_t v = committed.load(memory_order_relaxed);
+            string old;
+            if(!replace && find_at(v, key, old)) {
+                return;
+            }
+            install_one(key, value, false, v + 1);
+            committed.store(v + 1, memory_order_release);
+        }
+        count_commit();
+    }
+
+    void delete_key(const string &key) {
+        {
+            lock_guard<mutex> lock(commit_mutex);
+            version_t v = committed.load(memory_order_relaxed);
+            string old;
+            if(!find_at(v, key, old)) {
+                return;
+            }
+            install_one(key, string(), true, v + 1);
+            committed.store(v + 1, memory_order_release);
+        }
+        count_commit();
+    }
+
+    version_t committed_version() const {
+        return committed.load(memory_order_acquire);
+    }
+
+    // Drop every version that no open transaction can read: for each key
+    // only the newest version at or below the oldest snapshot is kept, and
+    // the key goes away entirely if that version is a delete. Only the keys
+    // on the partitions' dirty lists can have such versions, so only those
+    // are looked at.
+    void collect_garbage() {
+        version_t horizon;
+        {
+            lock_guard<mutex> lock(snapshots_mutex);
+            horizon = snapshots.empty() ?
+                committed.load(memory_order_acquire) : *snapshots.begin();
+        }
+        for(size_t i = 0; i < parts.size(); ++i) {
+            partition_t &p = parts[i];
+            unique_lock<shared_timed_mutex> lock(p.lock);
+            vector<string> dirty;
+            dirty.swap(p.dirty);
+            for(size_t d = 0; d < dirty.size(); ++d) {
+                chain_map::iterator it = p.chains.find(dirty[d]);
+                if(it == p.chains.end()) {
+                    // listed twice, and erased the first time
+                    continue;
+                }
+                chain_t &chain = it->second;
+                size_t keep = chain.size();
+                while(keep > 0 && chain[keep - 1].version > horizon) {
+                    --keep;
+                }
+                // chain[keep - 1] is the version seen at the horizon
+                if(keep > 1) {
+                    chain.erase(chain.begin(), chain.begin() + (keep - 1));
+                }
+                if(chain.size() == 1 && chain[0].deleted && chain[0].version <= horizon) {
+                    p.chains.erase(it);
+                } else if(chain.size() > 1 || chain[0].deleted) {
+                    // still newer than the horizon: next time
+                    p.dirty.push_back(dirty[d]);
+                }
+            }
+        }
+    }
+
+    // Number of (key, version) records held, for tests and GC tuning.
+    size_t version_count() const {
+        size_t rv = 0;
+        for(size_t i = 0; i < parts.size(); ++i) {
+            const partition_t &p = parts[i];
+            shared_lock<shared_timed_mutex> lock(p.lock);
+            for(chain_map::const_iterator it = p.chains.begin(); it != p.chains.end(); ++it) {
+                rv += it->second.size();
+            }
+        }
+        return rv;
+    }
+
+private:
+    struct version_rec_t {
+        version_rec_t(version_t version, bool deleted, const string &value)
+            : version(version), deleted(deleted), value(value) {}
+        version_t version;
+        bool deleted;
+        string value;
+    };
+    // oldest first
+    typedef vector<version_rec_t> chain_t;
+    typedef map<string, chain_t> chain_map;
+
+    struct partition_t {
+        mutable shared_timed_mutex lock;
+        chain_map chains;
+        // keys whose chain has more than one version, or a delete: all
+        // that collect_garbage() may trim. A key can be listed twice.
+        vector<string> dirty;
+    };
+
+    partition_t &partition_of(const string &key) {
+        return parts[hash<string>()(key) % parts.size()];
+    }
+
+    const partition_t &partition_of(const string &key) const {
+        return parts[hash<string>()(key) % parts.size()];
+    }
+
+    bool find_at(version_t snapshot, const string &key, string &value) const {
+        const partition_t &p = partition_of(key);
+        shared_lock<shared_timed_mutex> lock(p.lock);
+        return find_locked(p, snapshot, key, value);
+    }
+
+    // Called with p.lock held.
+    bool find_locked(const partition_t &p, version_t snapshot, const string &key,
+                     string &value) const {
+        chain_map::const_iterator it = p.chains.find(key);
+        if(it == p.chains.end()) {
+            return false;
+        }
+        const chain_t &chain = it->second;
+        for(size_t i = chain.size(); i-- > 0; ) {
+            if(chain[i].version <= snapshot) {
+                if(chain[i].deleted) {
+                    return false;
+                }
+                value = chain[i].value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    version_t latest_version(const string &key) const {
+        const partition_t &p = partition_of(key);
+        shared_lock<shared_timed_mutex> lock(p.lock);
+        chain_map::const_iterator it = p.chains.find(key);
+        return it == p.chains.end() ? 0 : it->second.back().version;
+    }
+
+    // Called with commit_mutex held.
+    bool validate(const transaction_t &txn) const {
+        const set<string> *keysets[] = { &txn.reads, &txn.deletes };
+        for(size_t s = 0; s < 2; ++s) {
+            for(set<string>::const_iterator it = keysets[s]->begin(); it != keysets[s]->end(); ++it) {
+                if(latest_version(*it) > txn.snapshot) {
+                    return false;
+                }
+            }
+        }
+        for(map<string, string>::const_iterator it = txn.adds.begin(); it != txn.adds.end(); ++it) {
+            if(latest_version(it->first) > txn.snapshot) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Called with commit_mutex held. The new version only becomes visible
+    // to new snapshots once 'committed' is bumped, after everything is in.
+    void install(const transaction_t &txn, version_t v) {
+        for(map<string, string>::const_iterator it = txn.adds.begin(); it != txn.adds.end(); ++it) {
+            install_one(it->first, it->second, false, v);
+        }
+        for(set<string>::const_iterator it = txn.deletes.begin(); it != txn.deletes.end(); ++it) {
+            install_one(*it, string(), true, v);
+        }
+        committed.store(v, memory_order_release);
+    }
+
+    void install_one(const string &key, const string &value, bool deleted, version_t v) {
+        partition_t &p = partition_of(key);
+        unique_lock<shared_timed_mutex> lock(p.lock);
+        chain_t &chain = p.chains[key];
+        chain.push_back(version_rec_t(v, deleted, value));
+        // listed once there can be something to trim; a longer chain is
+        // listed already
+        if(chain.size() == 2 || (chain.size() == 1 && deleted)) {
+            p.dirty.push_back(key);
+        }
+    }
+
+    // After a commit that installed versions, outside commit_mutex.
+    void count_commit() {
+        if(gc_interval &&
+           commits_since_gc.fetch_add(1, memory_order_relaxed) + 1 >= gc_interval) {
+            commits_since_gc.store(0, memory_order_relaxed);
+            collect_garbage();
+        }
+    }
+
+    void release(transaction_t &txn) {
+        {
+            lock_guard<mutex> lock(snapshots_mutex);
+            snapshots.erase(snapshots.find(txn.snapshot));
+        }
+        txn.db = NULL;
+        txn.adds.clear();
+        txn.deletes.clear();
+        txn.reads.clear();
+    }
+
+    vector<partition_t> parts;
+
+    // last committed version; snapshots are taken from it
+    atomic<version_t> committed;
+    mutex commit_mutex;
+
+    // snapshots of the open transactions, oldest first
+    mutex snapshots_mutex;
+    multiset<version_t> snapshots;
+
+    size_t gc_interval;
+    atomic<size_t> commits_since_gc;
+};
+#endif /* DB_MVCC_HPP */
@@ -0,0 +1,109 @@
+// YCSB-style load on db_sharded.
+//
+// usage: db-sharded-bench [max-threads [records [seconds [shards [value-size [copy]]]]]]
+//
+// Runs the core workloads on 'records' keys with 'value-size' byte values
+// (100 by default), the keys being picked from a scrambled zipfian
+// distribution (theta 0.99) as YCSB does:
+//   A  50% reads, 50% updates
+//   B  95% reads,  5% updates
+//   C  100% reads
+// and reports operations per second for 1, 2, 4, ... max-threads threads.
+// With 'shards' set to 1 this is a single db_mem behind one lock. Reads use
+// find_view(), or find() with 'copy'.
+
+#include "db-sharded.hpp"
+#include "zipfian.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+static string key_of(uint64_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "user%016llx", (unsigned long long)i);
+    return buf;
+}
+
+// one per thread, padded so the counters do not share cache lines
+struct alignas(64) result_t {
+    result_t() : ops(0) {}
+    size_t ops;
+};
+
+static void worker(db_sharded &db, const vector<string> &keys, zipfian_t zipf,
+                   int read_percent, size_t value_size, bool copy,
+                   const atomic<bool> &stop, unsigned seed, result_t &res)
+{
+    mt19937_64 rng(seed);
+    uniform_int_distribution<int> percent(0, 99);
+    string value(value_size, 'v'), found;
+    db_sharded::value_handle_t handle;
+    while(!stop.load(memory_order_relaxed)) {
+        const string &key = keys[zipf.next(rng)];
+        if(percent(rng) < read_percent) {
+            if(copy) {
+                db.find(key, found);
+            } else {
+                db.find_view(key, handle);
+                handle.release();
+            }
+        } else {
+            db.add(key, value, true);
+        }
+        ++res.ops;
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+    size_t records = argc > 2 ? atol(argv[2]) : 1000000;
+    double seconds = argc > 3 ? atof(argv[3]) : 2;
+    size_t shards = argc > 4 ? atol(argv[4]) : 64;
+    size_t value_size = argc > 5 ? atol(argv[5]) : 100;
+    bool copy = argc > 6;
+
+    db_sharded db(shards);
+    vector<string> keys(records);
+    string value(value_size, 'v');
+    for(size_t i = 0; i < records; ++i) {
+        keys[i] = key_of(i);
+        db.add(keys[i], value, true);
+    }
+    zipfian_t zipf(records);
+
+    struct {
+        const char *name;
+        int read_percent;
+    } workloads[] = { { "A", 50 }, { "B", 95 }, { "C", 100 } };
+
+    printf("%zu records of %zu bytes, %zu shards, %.1fs per run, reads %s\n", records,
+           value_size, db.shard_count(), seconds, copy ? "copy" : "in place");
+    printf("workload threads      ops/sec\n");
+    for(size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w) {
+        for(int threads = 1; threads <= max_threads; threads *= 2) {
+            atomic<bool> stop(false);
+            vector<result_t> results(threads);
+            vector<thread> pool;
+            for(int t = 0; t < threads; ++t) {
+                pool.push_back(thread(worker, ref(db), cref(keys), zipf,
+                                      workloads[w].read_percent, value_size, copy,
+                                      cref(stop), unsigned(t + 1), ref(results[t])));
+            }
+            this_thread::sleep_for(chrono::duration<double>(seconds));
+            stop = true;
+            size_t ops = 0;
+            for(int t = 0; t < threads; ++t) {
+                pool[t].join();
+                ops += results[t].ops;
+            }
+            printf("%-8s %7d %12.0f\n", workloads[w].name, threads, ops / seconds);
+        }
+    }
+    return 0;
+}
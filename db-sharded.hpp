@@ -0,0 +1,326 @@
+#ifndef DB_SHARDED_HPP
+#define DB_SHARDED_HPP
+
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "db-mem.hpp"
+
+// db_mem for many threads: keys are hashed to one of N shards, each a
+// db_mem_t with its own reader/writer lock, so readers never wait for each
+// other and writers only wait for those of the same shard.
+//
+// Transactions buffer their writes per shard, the way db_mem does in its
+// TransactionData, and commit in two phases:
+// - prepare: lock every shard written to, in shard order so that commits
+//   cannot deadlock, and stage the writes into that shard's own db_mem
+//   transaction.
+// - commit: end all the shard transactions, then unlock. If staging fails,
+//   the shard transactions already opened are aborted instead.
+// All the writes of a transaction become visible together. Reads are not
+// validated (read committed): a transaction sees its own writes and the
+// latest committed data.
+//
+// find_view() gives readers the stored value itself rather than a copy; it
+// stays valid after the shard lock is released, even if the key is
+// overwritten or deleted, because the shards retire old values through an
+// epoch_manager_t (epoch.hpp) that the view keeps pinned.
+//
+// Each shard's db_mem can have its own commit listener, e.g. a db_wal_t,
+// set up through shard() before the db is shared between threads. Every
+// shard then logs its part of a transaction as one record; recovery does
+// not know about the other shards.
+template<class Index = map<string, string> >
+class db_sharded_t {
+public:
+    typedef db_mem_t<Index> shard_db_t;
+
+    // A value found by find_view(), valid for as long as the handle lives.
+    // Holding many handles at once, or one for long, delays freeing every
+    // value replaced meanwhile.
+    class value_handle_t {
+    public:
+        const char *data() const { return view.data(); }
+        size_t size() const { return view.size(); }
+        string str() const { return view.str(); }
+
+        void release() { guard.release(); }
+
+    private:
+        friend class db_sharded_t;
+        epoch_manager_t::guard_t guard;
+        db_value_view_t view;
+    };
+
+    class transaction_t {
+    public:
+        transaction_t() : db(NULL), cleared(false) {}
+        ~transaction_t() {
+            if(db) {
+                db->abort_transaction(*this);
+            }
+        }
+
+        bool active() const { return db != NULL; }
+
+    private:
+        friend class db_sharded_t;
+        transaction_t(const transaction_t &);
+        transaction_t &operator=(const transaction_t &);
+
+        // what one shard has to apply
+        struct journal_t {
+            map<string, string> adds;
+            set<string> deletes;
+        };
+
+        db_sharded_t *db;
+        // by shard, which is also the order they are locked in
+        map<size_t, journal_t> journals;
+        // clear every shard before applying the journals
+        bool cleared;
+    };
+
+    // 'shards' is rounded up to a power of 2.
+    explicit db_sharded_t(size_t shards = 64)
+        : mask(0) {
+        size_t n = 1;
+        while(n < shards) {
+            n *= 2;
+        }
+        mask = n - 1;
+        shards_.reserve(n);
+        for(size_t i = 0; i < n; ++i) {
+            shards_.push_back(new shard_t());
+            shards_.back()->db.set_epochs(&epochs);
+        }
+    }
+
+    // No value_handle_t may outlive the db.
+    ~db_sharded_t() {
+        for(size_t i = 0; i < shards_.size(); ++i) {
+            delete shards_[i];
+        }
+    }
+
+    size_t shard_count() const { return shards_.size(); }
+
+    size_t shard_of(const string &key) const {
+        return hash<string>()(key) & mask;
+    }
+
+    // Only while no other thread uses the db.
+    shard_db_t &shard(size_t i) { return shards_[i]->db; }
+
+    ////////// single operations ////////////////////////////
+
+    bool find(const string &key, string &value) const {
+        const shard_t &s = *shards_[shard_of(key)];
+        shared_lock<shared_timed_mutex> lock(s.lock);
+        return s.db.find(key, value);
+    }
+
+    bool find_view(const string &key, value_handle_t &handle) const {
+        // pinned before looking, so whatever is found outlives the lock
+        handle.guard = epochs.pin();
+        const shard_t &s = *shards_[shard_of(key)];
+        shared_lock<shared_timed_mutex> lock(s.lock);
+        return s.db.find_view(key, handle.view);
+    }
+
+    bool has_key(const string &key) const {
+        const shard_t &s = *shards_[shard_of(key)];
+        shared_lock<shared_timed_mutex> lock(s.lock);
+        return s.db.has_key(key);
+    }
+
+    void add(const string &key, const string &value, bool replace) {
+        shard_t &s = *shards_[shard_of(key)];
+        unique_lock<shared_timed_mutex> lock(s.lock);
+        s.db.add(key, value, replace);
+    }
+
+    void delete_key(const string &key) {
+        shard_t &s = *shards_[shard_of(key)];
+        unique_lock<shared_timed_mutex> lock(s.lock);
+        s.db.delete_key(key);
+    }
+
+    // Each shard is cleared on its own; use a transaction to clear them
+    // all at once.
+    void clear() {
+        for(size_t i = 0; i < shards_.size(); ++i) {
+            unique_lock<shared_timed_mutex> lock(shards_[i]->lock);
+            shards_[i]->db.clear();
+        }
+    }
+
+    size_t size() const {
+        size_t rv = 0;
+        for(size_t i = 0; i < shards_.size(); ++i) {
+            shared_lock<shared_timed_mutex> lock(shards_[i]->lock);
+            rv += shards_[i]->db.size();
+        }
+        return rv;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    ////////// transactions ////////////////////////////
+
+    void begin_transaction(transaction_t &txn) {
+        assert(!txn.db);
+        txn.db = this;
+    }
+
+    bool find(const transaction_t &txn, const string &key, string &value) const {
+        assert(txn.db == this);
+        size_t i = shard_of(key);
+        typename map<size_t, typename transaction_t::journal_t>::const_iterator j = txn.journals.find(i);
+        if(j != txn.journals.end()) {
+            map<string, string>::const_iterator a = j->second.adds.find(key);
+            if(a != j->second.adds.end()) {
+                value = a->second;
+                return true;
+            }
+            if(j->second.deletes.count(key)) {
+                return false;
+            }
+        }
+        if(txn.cleared) {
+            return false;
+        }
+        return find(key, value);
+    }
+
+    bool has_key(const transaction_t &txn, const string &key) const {
+        string xxx;
+        return find(txn, key, xxx);
+    }
+
+    void add(transaction_t &txn, const string &key, const string &value, bool replace) {
+        assert(txn.db == this);
+        if(!replace && has_key(txn, key)) {
+            return;
+        }
+        typename transaction_t::journal_t &j = txn.journals[shard_of(key)];
+        j.adds[key] = value;
+        j.deletes.erase(key);
+    }
+
+    void delete_key(transaction_t &txn, const string &key) {
+        assert(txn.db == this);
+        typename transaction_t::journal_t &j = txn.journals[shard_of(key)];
+        j.adds.erase(key);
+        if(!txn.cleared) {
+            j.deletes.insert(key);
+        }
+    }
+
+    void clear(transaction_t &txn) {
+        assert(txn.db == this);
+        txn.journals.clear();
+        txn.cleared = true;
+    }
+
+    // Applies all of the transaction's writes, or none of them if staging
+    // throws. A commit listener throwing in the second phase leaves the
+    // shards before it committed and the others not. Either way the
+    // transaction is over.
+    void end_transaction(transaction_t &txn) {
+        assert(txn.db == this);
+        vector<shard_t *> prepared;
+        typename map<size_t, typename transaction_t::journal_t>::const_iterator j = txn.journals.begin();
+        try {
+            for(size_t i = 0; i < shards_.size(); ++i) {
+                bool written = j != txn.journals.end() && j->first == i;
+                if(!written && !txn.cleared) {
+                    if(j == txn.journals.end()) {
+                        break;
+                    }
+                    continue;
+                }
+                shard_t &s = *shards_[i];
+                s.lock.lock();
+                prepared.push_back(&s);
+                s.db.begin_transaction();
+                if(txn.cleared) {
+                    s.db.clear();
+                }
+                if(written) {
+                    foreach(it, j->second.deletes) {
+                        s.db.delete_key(*it);
+                    }
+                    foreach(it, j->second.adds) {
+                        s.db.add(it->first, it->second, true);
+                    }
+                    ++j;
+                }
+            }
+        } catch(...) {
+            for(size_t i = 0; i < prepared.size(); ++i) {
+                if(prepared[i]->db.in_transaction()) {
+                    prepared[i]->db.abort_transaction();
+                }
+                prepared[i]->lock.unlock();
+            }
+            release(txn);
+            throw;
+        }
+
+        size_t committed = 0;
+        try {
+            for(; committed < prepared.size(); ++committed) {
+                prepared[committed]->db.end_transaction();
+            }
+        } catch(...) {
+            for(size_t i = committed; i < prepared.size(); ++i) {
+                if(prepared[i]->db.in_transaction()) {
+                    prepared[i]->db.abort_transaction();
+                }
+            }
+            for(size_t i = 0; i < prepared.size(); ++i) {
+                prepared[i]->lock.unlock();
+            }
+            release(txn);
+            throw;
+        }
+        for(size_t i = 0; i < prepared.size(); ++i) {
+            prepared[i]->lock.unlock();
+        }
+        release(txn);
+    }
+
+    void abort_transaction(transaction_t &txn) {
+        assert(txn.db == this);
+        release(txn);
+    }
+
+private:
+    db_sharded_t(const db_sharded_t &);
+    db_sharded_t &operator=(const db_sharded_t &);
+
+    // allocated one by one, away from the other shards' locks
+    struct shard_t {
+        mutable shared_timed_mutex lock;
+        shard_db_t db;
+    };
+
+    static void release(transaction_t &txn) {
+        txn.journals.clear();
+        txn.cleared = false;
+        txn.db = NULL;
+    }
+
+    size_t mask;
+    vector<shard_t *> shards_;
+    // where the shards retire replaced values
+    epoch_manager_t epochs;
+};
+
+typedef db_sharded_t<> db_sharded;
+#endif /* DB_SHARDED_HPP */
@@ -0,0 +1,64 @@
+// Commit throughput of db_mem with a write-ahead log.
+//
+// usage: db-wal-bench dir [threads [commits-per-thread [nofsync]]]
+//
+// Each thread commits one small transaction at a time and waits for it to
+// be durable before starting the next one; the db lock is released before
+// waiting so that concurrent commits share an fdatasync.
+
+#include "db-wal.hpp"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+int main(int argc, const char **argv)
+{
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s dir [threads [commits-per-thread [nofsync]]]\n", argv[0]);
+        return 1;
+    }
+    string dir = argv[1];
+    int threads = argc > 2 ? atoi(argv[2]) : 16;
+    int commits = argc > 3 ? atoi(argv[3]) : 20000;
+
+    db_wal_t<>::options_t options;
+    options.sync_commit = false;
+    options.fsync = argc <= 4;
+    options.snapshot_interval = 0;
+
+    db_mem db;
+    db_wal_t<> wal(dir, options);
+    wal.open(db);
+    mutex db_mutex;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for(int t = 0; t < threads; ++t) {
+        pool.push_back(thread([&, t]() {
+            char key[32];
+            for(int i = 0; i < commits; ++i) {
+                snprintf(key, sizeof(key), "t%d-%d", t, i % 1024);
+                uint64_t lsn;
+                {
+                    lock_guard<mutex> lock(db_mutex);
+                    db.begin_transaction();
+                    db.add(key, "value", true);
+                    db.end_transaction();
+                    lsn = wal.last_lsn();
+                }
+                wal.wait_durable(lsn);
+            }
+        }));
+    }
+    for(size_t t = 0; t < pool.size(); ++t) {
+        pool[t].join();
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("%d threads, %d commits in %.2fs: %.0f commits/sec%s\n",
+           threads, threads * commits, secs, threads * commits / secs,
+           options.fsync ? "" : " (no fsync)");
+    return 0;
+}
@@ -0,0 +1,548 @@
+#ifndef DB_WAL_HPP
+#define DB_WAL_HPP
+
+#include <condition_variable>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "db-mem.hpp"
+#include "varwidth.h"
+
+// Write-ahead log for db_mem.
+//
+// <dir>/wal.log is an append-only sequence of records, one per commit;
+// <dir>/snapshot holds the whole db as of some commit. Recovery loads the
+// snapshot and replays the log records that are newer than it.
+//
+// Every record is framed as
+//   crc32c (4 bytes, little endian) of what follows
+//   payload length (4 bytes, little endian)
+//   payload
+// and the integers inside the payload use the varwidth.h encoding. A torn
+// or corrupt record at the end of the log is where recovery stops; the log
+// is truncated there.
+//
+// Commit payload:   lsn, flags (1: clear), #deletes, keys, #adds, key/values
+// Snapshot payload: first record: lsn, #entries; then records of up to
+//                   SNAPSHOT_BATCH key/values; then an empty record.
+// where a key or value is its length followed by its bytes.
+//
+// Group commit: log_commit() only appends to an in-memory buffer; a flusher
+// thread writes and fdatasync()s everything buffered at once, so commits
+// arriving while a sync is in progress share the next one. With
+// 'sync_commit' set (default) log_commit() waits until its record is
+// durable; otherwise the caller decides when to wait_durable(), e.g. after
+// releasing its own locks.
+//
+// 'Index' is the db's, see db_mem_t.
+template<class Index = map<string, string> >
+class db_wal_t : public db_commit_listener_t {
+public:
+    struct options_t {
+        options_t() : sync_commit(true), fsync(true), snapshot_interval(100000) {}
+        // log_commit returns only once the record is on disk
+        bool sync_commit;
+        // fdatasync after every write; without it a crash of the machine
+        // (not of the process) may lose the tail of the log
+        bool fsync;
+        // commits between two snapshots; 0 for never
+        size_t snapshot_interval;
+    };
+
+    db_wal_t(const string &dir, const options_t &options = options_t())
+        : dir(dir),
+          options(options),
+          db(NULL),
+          fd(-1),
+          next_lsn(1),
+          durable_lsn(0),
+          snapshot_lsn(0),
+          commits_since_snapshot(0),
+          flushing(false),
+          stopping(false),
+          error(0) {
+    }
+
+    ~db_wal_t() {
+        close();
+    }
+
+    // Recover 'db' (which should be empty and not in a transaction) from
+    // the directory, and log its changes from now on.
+    void open(db_mem_t<Index> &db) {
+        assert(!this->db);
+        mkdir(dir.c_str(), 0777);
+        recover(db);
+        fd = ::open(log_path().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if(fd < 0) {
+            throw_errno("open " + log_path());
+        }
+        this->db = &db;
+        stopping = false;
+        flusher = thread(&db_wal_t::flush_loop, this);
+        db.set_commit_listener(this);
+    }
+
+    // Make everything durable and detach from the db.
+    void close() {
+        if(!db) {
+            return;
+        }
+        db->set_commit_listener(NULL);
+        {
+            unique_lock<mutex> lock(m);
+            stopping = true;
+        }
+        work.notify_all();
+        flusher.join();
+        ::close(fd);
+        fd = -1;
+        db = NULL;
+    }
+
+    void log_commit(const map<string, string> &adds,
+                    const set<string> &deletes,
+                    bool clear) {
+        string payload;
+        uint64_t lsn;
+        {
+            unique_lock<mutex> lock(m);
+            lsn = next_lsn++;
+            put_int(payload, lsn);
+            put_int(payload, clear ? 1 : 0);
+            put_int(payload, deletes.size());
+            foreach(it, deletes) {
+                put_bytes(payload, *it);
+            }
+            put_int(payload, adds.size());
+            foreach(it, adds) {
+                put_bytes(payload, it->first);
+                put_bytes(payload, it->second);
+            }
+            frame(pending, payload);
+        }
+        work.notify_one();
+        if(options.sync_commit) {
+            wait_durable(lsn);
+        }
+    }
+
+    void applied() {
+        if(options.snapshot_interval &&
+           ++commits_since_snapshot >= options.snapshot_interval) {
+            checkpoint();
+        }
+    }
+
+    // Last lsn handed out, i.e. the one of the latest commit.
+    uint64_t last_lsn() {
+        unique_lock<mutex> lock(m);
+        return next_lsn - 1;
+    }
+
+    // Block until the commit with that lsn (and all before it) is durable.
+    void wait_durable(uint64_t lsn) {
+        unique_lock<mutex> lock(m);
+        while(durable_lsn < lsn && !error) {
+            done.wait(lock);
+        }
+        if(error) {
+            errno = error;
+            throw_errno("write " + log_path());
+        }
+    }
+
+    // Write a snapshot of the db and empty the log. The db must not be in
+    // the middle of applying a commit.
+    void checkpoint() {
+        assert(db);
+        uint64_t lsn = last_lsn();
+        wait_durable(lsn);
+
+        string tmp = dir + "/snapshot.tmp";
+        int sfd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(sfd < 0) {
+            throw_errno("open " + tmp);
+        }
+        string buf, payload;
+        put_int(payload, lsn);
+        put_int(payload, db->db_.size());
+        frame(buf, payload);
+        size_t in_batch = 0;
+        payload.clear();
+        foreach(it, db->db_) {
+            put_bytes(payload, it->first);
+            put_bytes(payload, it->second);
+            if(++in_batch == SNAPSHOT_BATCH) {
+                frame(buf, payload);
+                payload.clear();
+                in_batch = 0;
+                if(buf.size() >= (1 << 20)) {
+                    write_all(sfd, buf, tmp);
+                    buf.clear();
+                }
+            }
+        }
+        if(in_batch) {
+            frame(buf, payload);
+            payload.clear();
+        }
+        frame(buf, payload);
+        write_all(sfd, buf, tmp);
+        if(fsync(sfd) < 0) {
+            throw_errno("fsync " + tmp);
+        }
+        ::close(sfd);
+        if(rename(tmp.c_str(), snapshot_path().c_str()) < 0) {
+            throw_errno("rename " + tmp);
+        }
+        sync_dir();
+
+        // Everything in the log is now in the snapshot. Nothing else can
+        // be appended meanwhile, the db is ours.
+        {
+            unique_lock<mutex> lock(m);
+            while(flushing) {
+                done.wait(lock);
+            }
+            if(ftruncate(fd, 0) < 0) {
+                throw_errno("truncate " + log_path());
+            }
+        }
+        snapshot_lsn = lsn;
+        commits_since_snapshot = 0;
+    }
+
+private:
+    enum { SNAPSHOT_BATCH = 4096 };
+
+    string log_path() const { return dir + "/wal.log"; }
+    string snapshot_path() const { return dir + "/snapshot"; }
+
+    static void throw_errno(const string &what) {
+        throw runtime_error(what + ": " + strerror(errno));
+    }
+
+    ////////// encoding ////////////////////////////
+
+    static void put_int(string &out, sint64 value) {
+        unsigned char buf[VARWIDTH_MAX_WIDTH];
+        unsigned char *p = buf;
+        varWidthEncodeInt64(&p, value);
+        out.append((const char *)buf, p - buf);
+    }
+
+    static void put_bytes(string &out, const string &bytes) {
+        put_int(out, bytes.size());
+        out.append(bytes);
+    }
+
+    static void put_fixed32(string &out, uint32_t v) {
+        for(int i = 0; i < 4; ++i) {
+            out.push_back((char)(v >> (8 * i)));
+        }
+    }
+
+    static uint32_t get_fixed32(const unsigned char *p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    static void frame(string &out, const string &payload) {
+        string len;
+        put_fixed32(len, payload.size());
+        uint32_t crc = crc32c(0, (const unsigned char *)len.data(), len.size());
+        crc = crc32c(crc, (const unsigned char *)payload.data(), payload.size());
+        put_fixed32(out, crc);
+        out.append(len);
+        out.append(payload);
+    }
+
+    // Reads the payloads out of framed records, refusing to run past the
+    // end of what it is given.
+    struct reader_t {
+        reader_t(const string &buf) : p((const unsigned char *)buf.data()), end(p + buf.size()) {}
+
+        // Next record's payload; false at the end or on a bad record.
+        bool next_record(reader_t &payload) {
+            if(end - p < 8) {
+                return false;
+            }
+            uint32_t crc = get_fixed32(p);
+            uint32_t len = get_fixed32(p + 4);
+            if((size_t)(end - p - 8) < len) {
+                return false;
+            }
+            uint32_t actual = crc32c(0, p + 4, 4);
+            actual = crc32c(actual, p + 8, len);
+            if(actual != crc) {
+                return false;
+            }
+            payload.p = p + 8;
+            payload.end = p + 8 + len;
+            p += 8 + len;
+            return true;
+        }
+
+        bool get_int(sint64 &value) {
+            if(p == end) {
+                return false;
+            }
+            int width = 1;
+            for(unsigned char b = *p; (b & 0x80) && width < VARWIDTH_MAX_WIDTH; b <<= 1) {
+                ++width;
+            }
+            if(end - p < width) {
+                return false;
+            }
+            varWidthDecodeInt64(&p, &value);
+            return true;
+        }
+
+        bool get_bytes(string &bytes) {
+            sint64 len;
+            if(!get_int(len) || len < 0 || end - p < len) {
+                return false;
+            }
+            bytes.assign((const char *)p, len);
+            p += len;
+            return true;
+        }
+
+        bool at_end() const { return p == end; }
+
+        reader_t() : p(NULL), end(NULL) {}
+        const unsigned char *p;
+        const unsigned char *end;
+    };
+
+    // CRC-32C (Castagnoli), bytewise
+    static uint32_t crc32c(uint32_t crc, const unsigned char *p, size_t n) {
+        static uint32_t table[256];
+        static once_flag init;
+        call_once(init, []() {
+            for(uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for(int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+                }
+                table[i] = c;
+            }
+        });
+        crc = ~crc;
+        while(n--) {
+            crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    ////////// files ////////////////////////////
+
+    static bool read_file(const string &path, string &contents) {
+        int rfd = ::open(path.c_str(), O_RDONLY);
+        if(rfd < 0) {
+            if(errno == ENOENT) {
+                return false;
+            }
+            throw_errno("open " + path);
+        }
+        char buf[1 << 16];
+        ssize_t got;
+        while((got = read(rfd, buf, sizeof(buf))) > 0) {
+            contents.append(buf, got);
+        }
+        ::close(rfd);
+        if(got < 0) {
+            throw_errno("read " + path);
+        }
+        return true;
+    }
+
+    static void write_all(int wfd, const string &buf, const string &path) {
+        const char *p = buf.data();
+        size_t left = buf.size();
+        while(left) {
+            ssize_t n = write(wfd, p, left);
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                throw_errno("write " + path);
+            }
+            p += n;
+            left -= n;
+        }
+    }
+
+    void sync_dir() {
+        int dfd = ::open(dir.c_str(), O_RDONLY);
+        if(dfd >= 0) {
+            fsync(dfd);
+            ::close(dfd);
+        }
+    }
+
+    ////////// recovery ////////////////////////////
+
+    static void corrupt(const string &path) {
+        throw runtime_error(path + ": corrupt snapshot");
+    }
+
+    void recover(db_mem_t<Index> &db) {
+        Index &data = db.db_;
+        assert(!db.in_transaction());
+
+        string contents;
+        if(read_file(snapshot_path(), contents)) {
+            reader_t in(contents), rec;
+            sint64 lsn, count;
+            if(!in.next_record(rec) || !rec.get_int(lsn) || !rec.get_int(count)) {
+                corrupt(snapshot_path());
+            }
+            data.clear();
+            bool complete = false;
+            while(!complete && in.next_record(rec)) {
+                complete = rec.at_end();
+                string k, v;
+                while(!rec.at_end()) {
+                    if(!rec.get_bytes(k) || !rec.get_bytes(v)) {
+                        corrupt(snapshot_path());
+                    }
+                    data[k] = v;
+                }
+            }
+            if(!complete || (sint64)data.size() != count) {
+                corrupt(snapshot_path());
+            }
+            snapshot_lsn = lsn;
+        }
+        next_lsn = snapshot_lsn + 1;
+
+        contents.clear();
+        if(read_file(log_path(), contents)) {
+            reader_t in(contents), rec;
+            const unsigned char *good_end = in.p;
+            while(in.next_record(rec) && replay(rec, data)) {
+                good_end = in.p;
+            }
+            size_t good = good_end - (const unsigned char *)contents.data();
+            if(good != contents.size() && truncate(log_path().c_str(), good) < 0) {
+                throw_errno("truncate " + log_path());
+            }
+        }
+        durable_lsn = next_lsn - 1;
+    }
+
+    // Apply one commit record; false if it does not decode.
+    bool replay(reader_t &rec, Index &data) {
+        sint64 lsn, flags, n;
+        if(!rec.get_int(lsn) || !rec.get_int(flags) || !rec.get_int(n)) {
+            return false;
+        }
+        set<string> deletes;
+        map<string, string> adds;
+        string k, v;
+        for(sint64 i = 0; i < n; ++i) {
+            if(!rec.get_bytes(k)) {
+                return false;
+            }
+            deletes.insert(k);
+        }
+        if(!rec.get_int(n)) {
+            return false;
+        }
+        for(sint64 i = 0; i < n; ++i) {
+            if(!rec.get_bytes(k) || !rec.get_bytes(v)) {
+                return false;
+            }
+            adds[k] = v;
+        }
+        if(!rec.at_end()) {
+            return false;
+        }
+        // already in the snapshot
+        if((uint64_t)lsn <= snapshot_lsn) {
+            return true;
+        }
+        if(flags & 1) {
+            data.clear();
+        }
+        foreach(it, deletes) {
+            data.erase(*it);
+        }
+        foreach(it, adds) {
+            data[it->first] = it->second;
+        }
+        next_lsn = lsn + 1;
+        return true;
+    }
+
+    ////////// group commit ////////////////////////////
+
+    void flush_loop() {
+        unique_lock<mutex> lock(m);
+        for(;;) {
+            while(pending.empty() && !stopping) {
+                work.wait(lock);
+            }
+            if(pending.empty()) {
+                return;
+            }
+            string batch;
+            batch.swap(pending);
+            uint64_t lsn = next_lsn - 1;
+            flushing = true;
+            lock.unlock();
+
+            int rv = 0;
+            try {
+                write_all(fd, batch, log_path());
+                if(options.fsync && fdatasync(fd) < 0) {
+                    rv = errno;
+                }
+            } catch(const runtime_error &) {
+                rv = errno ? errno : EIO;
+            }
+
+            lock.lock();
+            flushing = false;
+            if(rv) {
+                error = rv;
+            } else {
+                durable_lsn = lsn;
+            }
+            done.notify_all();
+        }
+    }
+
+    string dir;
+    options_t options;
+    db_mem_t<Index> *db;
+    int fd;
+
+    // protects everything below
+    mutex m;
+    // signaled when there is something to flush, or on close
+    condition_variable work;
+    // signaled when a flush finishes
+    condition_variable done;
+    thread flusher;
+
+    // encoded records not written yet
+    string pending;
+    uint64_t next_lsn;
+    uint64_t durable_lsn;
+    uint64_t snapshot_lsn;
+    size_t commits_since_snapshot;
+    bool flushing;
+    bool stopping;
+    // errno of a failed flush; the log is unusable from then on
+    int error;
+};
+#endif /* DB_WAL_HPP */
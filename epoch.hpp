@@ -0,0 +1,182 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <assert.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Epoch-based reclamation: lets readers use memory that writers may unlink
+// at any time, without locks or reference counts on the read side.
+//
+// A reader pins the current epoch for as long as it uses what it found:
+//
+//     epoch_manager_t::guard_t guard = epochs.pin();
+//     ... find p, use p ...
+//
+// A writer that unlinks p (so that no reader pinning from now on can find
+// it) calls epochs.retire(p) instead of deleting it. p is deleted once
+// every reader that was pinned when it was retired has let go.
+//
+// Every pin takes one of a fixed number of slots, so at most MAX_PINS
+// guards can be alive at once; pin() spins when they are all taken.
+class epoch_manager_t {
+    enum {
+        MAX_PINS = 256,
+        // reclaim() every so many retire()
+        RECLAIM_INTERVAL = 64
+    };
+
+    // epoch pinned by a reader, 0 when free; one per cache line
+    struct slot_t {
+        slot_t() : epoch(0) {}
+        atomic<uint64_t> epoch;
+        char pad[64 - sizeof(atomic<uint64_t>)];
+    };
+
+public:
+    class guard_t {
+    public:
+        guard_t() : slot(NULL) {}
+        guard_t(guard_t &&o) : slot(o.slot) { o.slot = NULL; }
+        guard_t &operator=(guard_t &&o) {
+            if(this != &o) {
+                release();
+                slot = o.slot;
+                o.slot = NULL;
+            }
+            return *this;
+        }
+        ~guard_t() { release(); }
+
+        bool pinned() const { return slot != NULL; }
+
+        void release() {
+            if(slot) {
+                slot->epoch.store(0, memory_order_release);
+                slot = NULL;
+            }
+        }
+
+    private:
+        friend class epoch_manager_t;
+        guard_t(const guard_t &);
+        guard_t &operator=(const guard_t &);
+
+        explicit guard_t(slot_t *slot) : slot(slot) {}
+
+        slot_t *slot;
+    };
+
+    epoch_manager_t() : epoch(1), retired_since_reclaim(0) {}
+
+    // Frees everything still retired; no guard may be alive.
+    ~epoch_manager_t() {
+        for(size_t i = 0; i < MAX_PINS; ++i) {
+            assert(!slots[i].epoch.load());
+        }
+        for(size_t i = 0; i < retired.size(); ++i) {
+            retired[i].dispose(retired[i].p);
+        }
+    }
+
+    guard_t pin() const {
+        // start where other threads are unlikely to
+        size_t i = hash<thread::id>()(this_thread::get_id()) % MAX_PINS;
+        for(;; i = (i + 1) % MAX_PINS) {
+            uint64_t expected = 0;
+            uint64_t now = epoch.load(memory_order_seq_cst);
+            if(slots[i].epoch.load(memory_order_relaxed) == 0 &&
+               slots[i].epoch.compare_exchange_strong(expected, now, memory_order_seq_cst)) {
+                return guard_t(&slots[i]);
+            }
+        }
+    }
+
+    // Delete p once no reader can be using it. p must not be reachable
+    // by readers that pin from now on.
+    template<class T>
+    void retire(T *p) {
+        retire(p, &delete_as<T>);
+    }
+
+    void retire(void *p, void (*dispose)(void *)) {
+        bool reclaim_now;
+        {
+            lock_guard<mutex> lock(m);
+            retired_t r = { epoch.load(memory_order_seq_cst), p, dispose };
+            retired.push_back(r);
+            reclaim_now = ++retired_since_reclaim >= RECLAIM_INTERVAL;
+        }
+        if(reclaim_now) {
+            reclaim();
+        }
+    }
+
+    // Free what no pinned reader can be using any more.
+    void reclaim() {
+        vector<retired_t> ready;
+        {
+            lock_guard<mutex> lock(m);
+            retired_since_reclaim = 0;
+            // readers pinning from now on get a newer epoch than anything
+            // retired so far
+            epoch.fetch_add(1, memory_order_seq_cst);
+            uint64_t oldest = UINT64_MAX;
+            for(size_t i = 0; i < MAX_PINS; ++i) {
+                uint64_t e = slots[i].epoch.load(memory_order_seq_cst);
+                if(e && e < oldest) {
+                    oldest = e;
+                }
+            }
+            // a reader pinned at epoch e may have found what was retired
+            // at e or later
+            size_t kept = 0;
+            for(size_t i = 0; i < retired.size(); ++i) {
+                if(retired[i].epoch < oldest) {
+                    ready.push_back(retired[i]);
+                } else {
+                    retired[kept++] = retired[i];
+                }
+            }
+            retired.resize(kept);
+        }
+        for(size_t i = 0; i < ready.size(); ++i) {
+            ready[i].dispose(ready[i].p);
+        }
+    }
+
+    // Retired objects not freed yet
+    size_t pending() const {
+        lock_guard<mutex> lock(m);
+        return retired.size();
+    }
+
+private:
+    epoch_manager_t(const epoch_manager_t &);
+    epoch_manager_t &operator=(const epoch_manager_t &);
+
+    struct retired_t {
+        uint64_t epoch;
+        void *p;
+        void (*dispose)(void *);
+    };
+
+    template<class T>
+    static void delete_as(void *p) {
+        delete static_cast<T *>(p);
+    }
+
+    atomic<uint64_t> epoch;
+    mutable slot_t slots[MAX_PINS];
+
+    // protects everything below
+    mutable mutex m;
+    vector<retired_t> retired;
+    size_t retired_since_reclaim;
+};
+#endif /* EPOCH_HPP */
@@ -0,0 +1,100 @@
+// flat_hash_map_t against std::unordered_map, uint64_t keys and values.
+//
+// usage: flat-hash-map-bench [max-elements [min-elements]]
+//
+// For 'min-elements' (1000 by default), 10 times that, ... up to
+// 'max-elements' (10M by default; 100M needs some 10GB for both maps),
+// reports nanoseconds per operation for:
+//   insert     random keys into an empty map, growing as it goes
+//   find-hit   the same keys, in another order
+//   miss       finding keys that are not there
+//   iterate    one step over the whole map
+//   erase      every key, in another order
+
+#include "flat-hash-map.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unordered_map>
+#include <vector>
+
+typedef flat_hash_map_t<uint64_t, uint64_t> flat_t;
+typedef unordered_map<uint64_t, uint64_t> std_t;
+
+static void insert_into(flat_t &m, uint64_t k, uint64_t v) { m.insert(k, v); }
+static void insert_into(std_t &m, uint64_t k, uint64_t v) { m.insert(make_pair(k, v)); }
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<class Map>
+static void run(const char *name, const vector<uint64_t> &keys,
+                const vector<uint64_t> &shuffled, const vector<uint64_t> &missing)
+{
+    size_t n = keys.size();
+    double ns[5];
+    uint64_t sum = 0;
+    {
+        Map m;
+        double start = now();
+        for(size_t i = 0; i < n; ++i) {
+            insert_into(m, keys[i], i);
+        }
+        ns[0] = (now() - start) * 1e9 / n;
+
+        start = now();
+        for(size_t i = 0; i < n; ++i) {
+            sum += m.find(shuffled[i])->second;
+        }
+        ns[1] = (now() - start) * 1e9 / n;
+
+        start = now();
+        for(size_t i = 0; i < n; ++i) {
+            sum += m.find(missing[i]) != m.end();
+        }
+        ns[2] = (now() - start) * 1e9 / n;
+
+        start = now();
+        for(typename Map::const_iterator it = m.begin(); it != m.end(); ++it) {
+            sum += it->second;
+        }
+        ns[3] = (now() - start) * 1e9 / n;
+
+        start = now();
+        for(size_t i = 0; i < n; ++i) {
+            sum += m.erase(shuffled[i]);
+        }
+        ns[4] = (now() - start) * 1e9 / n;
+    }
+    printf("%11zu %-14s %8.1f %8.1f %8.1f %8.1f %8.1f   (%llu)\n", n, name,
+           ns[0], ns[1], ns[2], ns[3], ns[4], (unsigned long long)sum % 10);
+}
+
+int main(int argc, const char **argv)
+{
+    size_t max_elements = argc > 1 ? atol(argv[1]) : 10000000;
+    size_t min_elements = argc > 2 ? atol(argv[2]) : 1000;
+
+    printf("%11s %-14s %8s %8s %8s %8s %8s   (ns/op)\n", "elements", "map",
+           "insert", "find-hit", "miss", "iterate", "erase");
+    for(size_t n = min_elements; n <= max_elements; n *= 10) {
+        mt19937_64 rng(n);
+        vector<uint64_t> keys(n), missing(n);
+        for(size_t i = 0; i < n; ++i) {
+            // odd keys are in the map, even ones are not
+            keys[i] = rng() | 1;
+            missing[i] = rng() & ~(uint64_t)1;
+        }
+        vector<uint64_t> shuffled(keys);
+        shuffle(shuffled.begin(), shuffled.end(), rng);
+
+        run<flat_t>("flat_hash_map", keys, shuffled, missing);
+        run<std_t>("unordered_map", keys, shuffled, missing);
+    }
+    return 0;
+}
@@ -0,0 +1,323 @@
+#ifndef FLAT_HASH_MAP_HPP
+#define FLAT_HASH_MAP_HPP
+
+#include <algorithm>
+#include <assert.h>
+#include <functional>
+#include <new>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+using namespace std;
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "hash-fns.hpp"
+
+// flat_hash_map_t<K, V>: an unordered map that stores its entries in one
+// array, in the manner of Abseil's "Swiss tables".
+//
+// Next to the entries is an array of control bytes, one per slot: EMPTY,
+// or 7 bits of the key's hash. A lookup compares 16 control bytes at once
+// (with SSE2, else one at a time) and only compares keys where those bits
+// match, so it rarely touches an entry that is not the one it looks for.
+//
+// Probing is linear, a group of 16 slots at a time, which lets erase()
+// shift the rest of the probe sequence back into the hole (recomputing
+// their hashes) instead of leaving a tombstone: a table that sees many
+// erases never fills up with them, and lookups stop at the first empty
+// slot as they would in a fresh table. The table doubles when it is 7/8
+// full.
+//
+// Hash is mixed with a 64 bit finalizer first, since std::hash is often
+// the identity and both the slot and the control bits come from it.
+//
+// Entries move when the table grows or on erase(): pointers and iterators
+// into the map are only valid until the next insert or erase.
+template<class K, class V, class Hash = hash<K>, class Eq = equal_to<K> >
+class flat_hash_map_t {
+    enum {
+        GROUP = 16
+    };
+    static const uint8_t EMPTY = 0x80;
+
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    // 'first' must not be changed through an iterator
+    typedef pair<K, V> value_type;
+    typedef size_t size_type;
+
+    template<class Value, class Map>
+    class iter_t {
+    public:
+        iter_t() : map(NULL), idx(0) {}
+        iter_t(Map *map, size_t idx) : map(map), idx(idx) { settle(); }
+        // iterator -> const_iterator
+        template<class V2, class M2>
+        iter_t(const iter_t<V2, M2> &o) : map(o.map), idx(o.idx) {}
+
+        Value &operator*() const { return map->slots[idx]; }
+        Value *operator->() const { return &map->slots[idx]; }
+
+        iter_t &operator++() {
+            ++idx;
+            settle();
+            return *this;
+        }
+
+        bool operator==(const iter_t &o) const { return idx == o.idx; }
+        bool operator!=(const iter_t &o) const { return !(*this == o); }
+
+    private:
+        template<class, class> friend class iter_t;
+        friend class flat_hash_map_t;
+
+        // On the next full slot, or at capacity; a group at a time
+        void settle() {
+            size_t cap = map->capacity();
+            while(idx < cap) {
+                uint32_t full = ~group_t(map->ctrl + idx).match(EMPTY) & 0xffff;
+                if(full) {
+                    idx = min(idx + __builtin_ctz(full), cap);
+                    return;
+                }
+                idx += GROUP;
+            }
+            idx = cap;
+        }
+
+        Map *map;
+        size_t idx;
+    };
+
+    typedef iter_t<value_type, flat_hash_map_t> iterator;
+    typedef iter_t<const value_type, const flat_hash_map_t> const_iterator;
+
+    flat_hash_map_t() : ctrl(empty_group()), slots(NULL), mask(0), entries(0) {}
+
+    ~flat_hash_map_t() {
+        destroy();
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, capacity()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, capacity()); }
+
+    size_t size() const { return entries; }
+    bool empty() const { return entries == 0; }
+    // Number of slots; 0 until the first insert
+    size_t capacity() const { return slots ? mask + 1 : 0; }
+
+    iterator find(const K &k) {
+        size_t i = lookup(k, hash_of(k));
+        return i == NIL ? end() : iterator(this, i);
+    }
+
+    const_iterator find(const K &k) const {
+        return const_cast<flat_hash_map_t *>(this)->find(k);
+    }
+
+    size_t count(const K &k) const {
+        return lookup(k, hash_of(k)) != NIL;
+    }
+
+    V &operator[](const K &k) {
+        return insert(k, V()).first->second;
+    }
+
+    // Like map::insert: (entry, inserted)
+    pair<iterator, bool> insert(const K &k, const V &v) {
+        size_t h = hash_of(k);
+        size_t i = lookup(k, h);
+        if(i != NIL) {
+            return make_pair(iterator(this, i), false);
+        }
+        if((entries + 1) * 8 > capacity() * 7) {
+            rehash(capacity() ? capacity() * 2 : (size_t)GROUP);
+        }
+        i = free_slot(h);
+        new(&slots[i]) value_type(k, v);
+        set_ctrl(i, h & 0x7f);
+        ++entries;
+        return make_pair(iterator(this, i), true);
+    }
+
+    size_t erase(const K &k) {
+        size_t i = lookup(k, hash_of(k));
+        if(i == NIL) {
+            return 0;
+        }
+        slots[i].~value_type();
+        set_ctrl(i, EMPTY);
+        --entries;
+        // Backward shift: move later entries of the probe sequence into
+        // the hole unless that would put them before their home.
+        for(size_t j = (i + 1) & mask; ctrl[j] != EMPTY; j = (j + 1) & mask) {
+            size_t home = home_of(hash_of(slots[j].first));
+            // can j move to i, i.e. is home cyclically outside (i, j]?
+            if(((j - home) & mask) >= ((j - i) & mask)) {
+                new(&slots[i]) value_type(std::move(slots[j]));
+                slots[j].~value_type();
+                set_ctrl(i, ctrl[j]);
+                set_ctrl(j, EMPTY);
+                i = j;
+            }
+        }
+        return 1;
+    }
+
+    // Keeps the capacity
+    void clear() {
+        for(size_t i = 0; i < capacity(); ++i) {
+            if(ctrl[i] != EMPTY) {
+                slots[i].~value_type();
+            }
+        }
+        if(slots) {
+            memset(ctrl, EMPTY, capacity() + GROUP);
+        }
+        entries = 0;
+    }
+
+    // Make room for n entries without growing
+    void reserve(size_t n) {
+        size_t cap = GROUP;
+        while(n * 8 > cap * 7) {
+            cap *= 2;
+        }
+        if(cap > capacity()) {
+            rehash(cap);
+        }
+    }
+
+private:
+    flat_hash_map_t(const flat_hash_map_t &);
+    flat_hash_map_t &operator=(const flat_hash_map_t &);
+
+    static const size_t NIL = ~(size_t)0;
+
+    // The control bytes of GROUP slots from some position
+    struct group_t {
+#ifdef __SSE2__
+        explicit group_t(const uint8_t *p)
+            : bytes(_mm_loadu_si128((const __m128i *)p)) {}
+
+        // bit i set if slot i's control byte is 'c'
+        uint32_t match(uint8_t c) const {
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)c)));
+        }
+
+        __m128i bytes;
+#else
+        explicit group_t(const uint8_t *p) : p(p) {}
+
+        uint32_t match(uint8_t c) const {
+            uint32_t rv = 0;
+            for(int i = 0; i < GROUP; ++i) {
+                rv |= (uint32_t)(p[i] == c) << i;
+            }
+            return rv;
+        }
+
+        const uint8_t *p;
+#endif
+    };
+
+    // What an empty map probes, so that lookups need no special case
+    static uint8_t *empty_group() {
+        static uint8_t group[GROUP] = {
+            EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY,
+            EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY, EMPTY
+        };
+        return group;
+    }
+
+    // std::hash is often the identity; spread it over all the bits since
+    // the low ones are the control bits and the high ones the slot.
+    static size_t hash_of(const K &k) {
+        return hash_mix64(Hash()(k));
+    }
+
+    size_t home_of(size_t h) const {
+        return (h >> 7) & mask;
+    }
+
+    size_t lookup(const K &k, size_t h) const {
+        uint8_t bits = h & 0x7f;
+        for(size_t pos = home_of(h);; pos = (pos + GROUP) & mask) {
+            group_t g(ctrl + pos);
+            for(uint32_t m = g.match(bits); m; m &= m - 1) {
+                size_t i = (pos + __builtin_ctz(m)) & mask;
+                if(Eq()(slots[i].first, k)) {
+                    return i;
+                }
+            }
+            // the probe sequence ends at the first empty slot
+            if(g.match(EMPTY)) {
+                return NIL;
+            }
+        }
+    }
+
+    // The first empty slot from h's home on; there is one
+    size_t free_slot(size_t h) const {
+        for(size_t pos = home_of(h);; pos = (pos + GROUP) & mask) {
+            uint32_t m = group_t(ctrl + pos).match(EMPTY);
+            if(m) {
+                return (pos + __builtin_ctz(m)) & mask;
+            }
+        }
+    }
+
+    // The first GROUP control bytes are repeated after the last one, so
+    // that a group read near the end wraps around.
+    void set_ctrl(size_t i, uint8_t c) {
+        ctrl[i] = c;
+        if(i < GROUP) {
+            ctrl[capacity() + i] = c;
+        }
+    }
+
+    void rehash(size_t cap) {
+        assert(cap >= GROUP && (cap & (cap - 1)) == 0);
+        uint8_t *old_ctrl = ctrl;
+        value_type *old_slots = slots;
+        size_t old_cap = capacity();
+
+        ctrl = new uint8_t[cap + GROUP];
+        memset(ctrl, EMPTY, cap + GROUP);
+        slots = static_cast<value_type *>(::operator new(cap * sizeof(value_type)));
+        mask = cap - 1;
+        for(size_t i = 0; i < old_cap; ++i) {
+            if(old_ctrl[i] != EMPTY) {
+                size_t h = hash_of(old_slots[i].first);
+                size_t j = free_slot(h);
+                new(&slots[j]) value_type(std::move(old_slots[i]));
+                set_ctrl(j, h & 0x7f);
+                old_slots[i].~value_type();
+            }
+        }
+        if(old_slots) {
+            delete[] old_ctrl;
+            ::operator delete(old_slots);
+        }
+    }
+
+    void destroy() {
+        if(slots) {
+            clear();
+            delete[] ctrl;
+            ::operator delete(slots);
+        }
+    }
+
+    uint8_t *ctrl;
+    value_type *slots;
+    size_t mask;
+    size_t entries;
+};
+#endif /* FLAT_HASH_MAP_HPP */
@@ -0,0 +1,170 @@
+// Fixed width against varwidth encoding of the same records through
+// Flatten.
+//
+// usage: flatten-bench [records [rounds]]
+//
+// Makes 'records' (1M by default) records, as an analysis would: an id,
+// a line number, a kind, a count, a time offset, a file name and a few
+// event numbers. Writes them to a string and reads them back 'rounds' (5)
+// times over, with
+//   fixed   every integer in its full width, strings and vectors after a
+//           32 bit length
+//   varint  xferVarInt / xferVarUInt, and xferGeneric's varwidth lengths
+//   fields  FLATTEN_XFER_FIELDS: the integers in full width, all in one
+//           block; xferGeneric's strings and vectors
+// Reports the bytes per record, and the nanoseconds per record and MB/s
+// of the output, writing and reading.
+
+#include "flatten-fields.hpp"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The integers widest first, with no padding between them
+struct record_t {
+    uint64_t id;
+    // seconds from the start of the analysis; can be before it
+    int64_t time;
+    int32_t line;
+    uint32_t count;
+    uint16_t kind;
+    string file;
+    vector<uint32_t> events;
+
+    bool operator==(const record_t &o) const {
+        return id == o.id && line == o.line && kind == o.kind && count == o.count &&
+               time == o.time && file == o.file && events == o.events;
+    }
+
+    void xferFieldsFixed(Flatten &flat) {
+        flat.xferUint64(id);
+        flat.xferInt32(line);
+        flat.xferUint16(kind);
+        flat.xferUint32(count);
+        flat.xferInt64(time);
+        uint32_t size = file.size();
+        flat.xferUint32(size);
+        file.resize(size);
+        flat.xferFullBlock(&file[0], size);
+        size = events.size();
+        flat.xferUint32(size);
+        events.resize(size);
+        for(uint32_t i = 0; i < size; ++i) {
+            flat.xferUint32(events[i]);
+        }
+    }
+
+    void xferFields(Flatten &flat) {
+        flat.xferVarUInt(id);
+        flat.xferVarInt(line);
+        flat.xferVarUInt(kind);
+        flat.xferVarUInt(count);
+        flat.xferVarInt(time);
+        flat.xferString(file);
+        uint64_t size = events.size();
+        flat.xferVarUInt(size);
+        events.resize(size);
+        for(uint64_t i = 0; i < size; ++i) {
+            flat.xferVarUInt(events[i]);
+        }
+    }
+
+    void xferFieldsGenerated(Flatten &flat) {
+        FLATTEN_XFER_FIELDS(flat, record_t, id, time, line, count, kind, file, events);
+    }
+};
+
+static vector<record_t> make_records(size_t n)
+{
+    mt19937_64 rng(1);
+    geometric_distribution<int> small(0.3);
+    uniform_int_distribution<int> line(1, 5000), file_len(10, 40), kind(0, 200);
+    normal_distribution<double> time(3600, 7200);
+    vector<record_t> records(n);
+    uint64_t id = 1000000;
+    for(size_t i = 0; i < n; ++i) {
+        record_t &r = records[i];
+        r.id = id += 1 + small(rng);
+        r.line = line(rng);
+        r.kind = (uint16_t)kind(rng);
+        r.count = small(rng);
+        r.time = (int64_t)time(rng);
+        r.file.assign(file_len(rng), 'a' + i % 26);
+        r.events.resize(small(rng));
+        for(size_t e = 0; e < r.events.size(); ++e) {
+            r.events[e] = line(rng);
+        }
+    }
+    return records;
+}
+
+template<class Xfer>
+static void run(const char *name, vector<record_t> &records, int rounds, Xfer xfer)
+{
+    size_t n = records.size();
+    string s;
+    double write = 0, read = 0;
+    bool ok = true;
+    vector<record_t> back(n);
+    for(int r = 0; r < rounds; ++r) {
+        s.clear();
+        double start = now();
+        {
+            StringFlatten flat(s, false);
+            for(size_t i = 0; i < n; ++i) {
+                xfer(records[i], flat);
+            }
+        }
+        write += now() - start;
+
+        start = now();
+        StringFlatten flat((const string &)s);
+        for(size_t i = 0; i < n; ++i) {
+            xfer(back[i], flat);
+        }
+        read += now() - start;
+    }
+    ok = back == records;
+    printf("%-8s %8.1f %10.1f %10.1f %10.0f %10.0f%s\n", name, (double)s.size() / n,
+           write * 1e9 / n / rounds, read * 1e9 / n / rounds, s.size() * rounds / write / 1e6,
+           s.size() * rounds / read / 1e6, ok ? "" : "   MISMATCH");
+}
+
+static void xfer_fixed(record_t &r, Flatten &flat)
+{
+    r.xferFieldsFixed(flat);
+}
+
+static void xfer_varint(record_t &r, Flatten &flat)
+{
+    r.xferFields(flat);
+}
+
+static void xfer_fields(record_t &r, Flatten &flat)
+{
+    r.xferFieldsGenerated(flat);
+}
+
+int main(int argc, const char **argv)
+{
+    size_t n = argc > 1 ? atol(argv[1]) : 1000000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+    vector<record_t> records = make_records(n);
+    printf("%zu records, %d rounds\n", n, rounds);
+    printf("%-8s %8s %10s %10s %10s %10s\n", "encoding", "bytes", "write-ns", "read-ns",
+           "write-MB/s", "read-MB/s");
+    run("fixed", records, rounds, xfer_fixed);
+    run("varint", records, rounds, xfer_varint);
+    run("fields", records, rounds, xfer_fields);
+    return 0;
+}
@@ -0,0 +1,205 @@
+#ifndef FLATTEN_FIELDS_HPP
+#define FLATTEN_FIELDS_HPP
+
+#include <stddef.h>
+#include <type_traits>
+using namespace std;
+
+#include "flatten.hpp"
+#include "text-flatten.hpp"
+
+// xferFields and xferFieldsText from a list of the fields, instead of by
+// hand:
+//
+//   struct point_t {
+//       int32_t x, y;
+//       string label;
+//       FLATTEN_FIELDS(point_t, x, y, label)
+//   };
+//
+// or, where the class only declares them (as md5_pair_t), in the bodies:
+//   void point_t::xferFields(Flatten &flat)
+//   {
+//       FLATTEN_XFER_FIELDS(flat, point_t, x, y, label);
+//   }
+//   void point_t::xferFieldsText(TextFlatten &flat, const char *fieldName)
+//   {
+//       FLATTEN_XFER_FIELDS_TEXT(flat, fieldName, point_t, x, y, label);
+//   }
+//
+// Binary, the fields go in the order listed, each through xferGeneric, in
+// the same bytes as the xfers written out by hand would be. But a run of
+// integers next to each other in memory, with no padding between them,
+// goes as one block, one memcpy, on a little endian machine: the run is
+// found at compile time, from offsetof, so the class must be standard
+// layout. Text, each field goes through xferGenericText under its name.
+// Up to 16 fields.
+
+namespace flatten_fields {
+
+template<class C, class T, T C::*M, size_t OFFSET>
+struct field_t
+{
+    typedef T type;
+    enum { offset = OFFSET };
+
+    static T &get(C &c)
+    {
+        return c.*M;
+    }
+};
+
+template<class... Fs>
+struct list_t {};
+
+// Integers whose bytes in memory are their xferInt bytes
+template<class T>
+struct is_raw
+    : integral_constant<bool, is_integral<T>::value && !is_same<T, bool>::value &&
+                                  (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ || sizeof(T) == 1)>
+{
+};
+
+// The run at the front of the fields: how many, and their bytes
+template<class... Fs>
+struct run_t
+{
+    enum { count = 0, size = 0 };
+};
+
+template<class F>
+struct run_t<F>
+{
+    enum { count = is_raw<typename F::type>::value ? 1 : 0, size = count * sizeof(typename F::type) };
+};
+
+template<class F, class G, class... Fs>
+struct run_t<F, G, Fs...>
+{
+    typedef run_t<G, Fs...> rest;
+    enum {
+        head = is_raw<typename F::type>::value,
+        joins = head && is_raw<typename G::type>::value &&
+                (size_t)G::offset == F::offset + sizeof(typename F::type),
+        count = joins ? 1 + rest::count : head,
+        size = head * sizeof(typename F::type) + (joins ? rest::size : 0)
+    };
+};
+
+// The list without its first N
+template<size_t N, class L, bool = N == 0>
+struct drop_t
+{
+    typedef L type;
+};
+
+template<size_t N, class F, class... Fs>
+struct drop_t<N, list_t<F, Fs...>, false>
+{
+    typedef typename drop_t<N - 1, list_t<Fs...> >::type type;
+};
+
+template<class C>
+inline void xferFieldList(Flatten &, C &, list_t<>)
+{
+}
+
+template<class C, class F, class... Fs>
+inline void xferFieldList(Flatten &flat, C &c, list_t<F, Fs...>)
+{
+    typedef run_t<F, Fs...> run;
+    enum { count = run::count > 1 ? run::count : 1 };
+    if(run::count > 1) {
+        flat.xferFullBlock((char *)&c + F::offset, run::size);
+    } else {
+        xferGeneric(flat, F::get(c));
+    }
+    xferFieldList(flat, c, typename drop_t<count, list_t<F, Fs...> >::type());
+}
+
+template<class C>
+inline void xferFieldListText(TextFlatten &, C &, const char *const *, list_t<>)
+{
+}
+
+template<class C, class F, class... Fs>
+inline void xferFieldListText(TextFlatten &flat, C &c, const char *const *names,
+                              list_t<F, Fs...>)
+{
+    xferGenericText(flat, F::get(c), names[0]);
+    xferFieldListText(flat, c, names + 1, list_t<Fs...>());
+}
+
+} // namespace flatten_fields
+
+#define FLATTEN_FIELDS_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, \
+                              _15, _16, n, ...) \
+    n
+#define FLATTEN_FIELDS_NARGS(...) \
+    FLATTEN_FIELDS_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define FLATTEN_FIELDS_CAT_(a, b) a##b
+#define FLATTEN_FIELDS_CAT(a, b) FLATTEN_FIELDS_CAT_(a, b)
+
+// m(C, field) for each field, comma separated
+#define FLATTEN_FIELDS_MAP(m, C, ...) \
+    FLATTEN_FIELDS_CAT(FLATTEN_FIELDS_MAP_, FLATTEN_FIELDS_NARGS(__VA_ARGS__))(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_1(m, C, f) m(C, f)
+#define FLATTEN_FIELDS_MAP_2(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_1(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_3(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_2(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_4(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_3(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_5(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_4(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_6(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_5(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_7(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_6(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_8(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_7(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_9(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_8(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_10(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_9(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_11(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_10(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_12(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_11(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_13(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_12(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_14(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_13(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_15(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_14(m, C, __VA_ARGS__)
+#define FLATTEN_FIELDS_MAP_16(m, C, f, ...) m(C, f), FLATTEN_FIELDS_MAP_15(m, C, __VA_ARGS__)
+
+#define FLATTEN_FIELDS_FIELD(C, f) \
+    flatten_fields::field_t<C, decltype(C::f), &C::f, offsetof(C, f)>
+#define FLATTEN_FIELDS_NAME(C, f) #f
+
+// offsetof, and so the runs, only mean something for a standard layout C
+#define FLATTEN_FIELDS_CHECK_LAYOUT(C) \
+    static_assert(is_standard_layout<C>::value, \
+                  "FLATTEN_XFER_FIELDS: " #C " must be standard layout")
+
+// In a member function of C
+#define FLATTEN_XFER_FIELDS(flat, C, ...) \
+    do { \
+        FLATTEN_FIELDS_CHECK_LAYOUT(C); \
+        flatten_fields::xferFieldList( \
+            flat, *this, \
+            flatten_fields::list_t<FLATTEN_FIELDS_MAP(FLATTEN_FIELDS_FIELD, C, __VA_ARGS__)>()); \
+    } while(0)
+
+#define FLATTEN_XFER_FIELDS_TEXT(flat, fieldName, C, ...) \
+    do { \
+        FLATTEN_FIELDS_CHECK_LAYOUT(C); \
+        static const char *const flatten_names[] = { \
+            FLATTEN_FIELDS_MAP(FLATTEN_FIELDS_NAME, C, __VA_ARGS__) \
+        }; \
+        (flat).beginRecord(fieldName); \
+        flatten_fields::xferFieldListText( \
+            flat, *this, flatten_names, \
+            flatten_fields::list_t<FLATTEN_FIELDS_MAP(FLATTEN_FIELDS_FIELD, C, __VA_ARGS__)>()); \
+        (flat).endRecord(); \
+    } while(0)
+
+// In the body of C: defines both
+#define FLATTEN_FIELDS(C, ...) \
+    void xferFields(Flatten &flat) \
+    { \
+        FLATTEN_XFER_FIELDS(flat, C, __VA_ARGS__); \
+    } \
+    void xferFieldsText(TextFlatten &flat, const char *fieldName) \
+    { \
+        FLATTEN_XFER_FIELDS_TEXT(flat, fieldName, C, __VA_ARGS__); \
+    }
+
+#endif
@@ -1,107 +1,737 @@
 #ifndef FLATTEN_HPP
 #define FLATTEN_HPP
 
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+using namespace std;
+
+#include "varwidth.h"
+
 // cpp lacks the support for (de-)serialization, which could be implemented
 // recursively at highlevel with the support of flatten which supports
 // xfer-basic-types.
+//
+// A persistent class has one xferFields(Flatten &) for both directions:
+// each xfer call copies a field into the flatten when writing, and out of
+// it when reading. Integers are fixed width, little endian, or with
+// xferVarInt / xferVarUInt in the varwidth.h format: as many bytes as the
+// value needs, 1 up to 127. Strings and vectors are length prefixed.
+// xferGeneric(flat, x) picks the xfer for the type of x.
+//
+// A Flatten keeps a window [next, end) of its backend's memory: the bytes
+// left to read, or the room left to write. An xfer that fits in the window
+// is an inline memcpy and a pointer bump; only when it runs out is the
+// backend called (virtually) to refill or drain it. The backends:
+//   MemoryFlatten    reads a range of memory, in place
+//   StringFlatten    reads a string in place, or appends to one
+//   BufferedFlatten  a buffer (BUFFER_SIZE) in front of fillBuf/emptyBuf
+//   IOSFlatten       an istream or an ostream
+//   FileFlatten      reads a file mmap'ed, in place; writes through a
+//                    buffer, with blocks too big for it going out in the
+//                    same writev as what was buffered
+// Reading in place, readInPlace() hands out pointers to the bytes
+// themselves.
 class Flatten
 {
 public:
-    // write the dest or read the dest for size
-    int xferPartialBlock(char *dest, int size)
+    virtual ~Flatten() {}
+
+    bool reading() const
     {
-       if(m_reading) {
-           return readBlock(dest, size);
-       } else {
-           return writeBlock(dest, size);
-       }
+        return m_reading;
     }
-    // throw an exception if can't read size
-    int xferFullBlock(char *dest, int size)
+
+    // write the dest or read the dest for size; returns what was read,
+    // less than size at the end of the input
+    size_t xferPartialBlock(char *dest, size_t size)
     {
-        cond_assert_return(xferPartialBlock(dest, size) == size, -1);
+        if((size_t)(end - next) >= size) {
+            if(m_reading) {
+                memcpy(dest, next, size);
+            } else {
+                memcpy(next, dest, size);
+            }
+            next += size;
+            return size;
+        }
+        if(m_reading) {
+            return readBlock(dest, size);
+        }
+        writeBlock(dest, size);
         return size;
     }
 
-    void xferByte(char *dest)
+    // throw an exception if can't read size
+    void xferFullBlock(char *dest, size_t size)
     {
-        xferFullBlock(dest, 1);
+        if(xferPartialBlock(dest, size) != size) {
+            throw runtime_error("Flatten: unexpected end of input");
+        }
     }
 
-    void xferUint16(char *dest)
+    void xferByte(char &c)
     {
-        xferFullBlock(dest, 2);
+        xferFullBlock(&c, 1);
     }
-    // etc.
-protected:
-    virtual int innerReadBlock(char *dest, int size) == 0
 
-private:
-    int readBlock(char *dest, int size)
+    void xferBool(bool &b)
     {
-        if(end - next > size) {
-            memcpy(dest, next, size);
-            next += size;
+        char c = m_reading ? 0 : b;
+        xferByte(c);
+        b = c != 0;
+    }
+
+    // Any integer type, in sizeof(T) bytes
+    template<class T>
+    void xferInt(T &v)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        char bytes[sizeof(T)];
+        if(!m_reading) {
+            for(size_t i = 0; i < sizeof(T); ++i) {
+                bytes[i] = (char)((uint64_t)v >> (8 * i));
+            }
+        }
+        xferFullBlock(bytes, sizeof(T));
+        if(m_reading) {
+            uint64_t u = 0;
+            for(size_t i = 0; i < sizeof(T); ++i) {
+                u |= (uint64_t)(unsigned char)bytes[i] << (8 * i);
+            }
+            v = (T)u;
+        }
+#else
+        xferFullBlock((char *)&v, sizeof(T));
+#endif
+    }
+
+    void xferUint16(uint16_t &v) { xferInt(v); }
+    void xferUint32(uint32_t &v) { xferInt(v); }
+    void xferUint64(uint64_t &v) { xferInt(v); }
+    void xferInt16(int16_t &v) { xferInt(v); }
+    void xferInt32(int32_t &v) { xferInt(v); }
+    void xferInt64(int64_t &v) { xferInt(v); }
+
+    // Signed integers in the varwidth.h format: 1 byte for -64..63, 2 for
+    // -8192..8191, ... 9 for the largest
+    template<class T>
+    void xferVarInt(T &v)
+    {
+        if(m_reading) {
+            sint64 x;
+            const unsigned char *p = readVarWidth();
+            varWidthDecodeInt64(&p, &x);
+            v = (T)x;
         } else {
-            innerReadBlock(dest, size);
+            sint64 x = v;
+            unsigned char *p = startVarWidth();
+            varWidthEncodeArray(&p, &x, 1);
+            endVarWidth(p);
         }
-    } 
+    }
+
+    // Unsigned: 1 byte for 0..127, 2 for 0..16383...
+    template<class T>
+    void xferVarUInt(T &v)
+    {
+        if(m_reading) {
+            uint64_t x;
+            const unsigned char *p = readVarWidth();
+            varWidthDecodeUInt64(&p, &x);
+            v = (T)x;
+        } else {
+            unsigned char *p = startVarWidth();
+            varWidthEncodeUInt64(&p, (uint64_t)v);
+            endVarWidth(p);
+        }
+    }
+
+    // The length, then the bytes
+    void xferString(string &s)
+    {
+        uint64_t size = s.size();
+        xferVarUInt(size);
+        if(!m_reading) {
+            xferFullBlock(&s[0], size);
+            return;
+        }
+        s.clear();
+        readPieces(s, size);
+    }
+
+    // Reading 'size' elements of integer type onto the end of 'v', a
+    // string or a vector: a piece at a time, so that a garbled length
+    // runs out of input before it runs out of memory
+    template<class V>
+    void readPieces(V &v, uint64_t size)
+    {
+        enum { PIECE = 1 << 20 };
+        typedef typename V::value_type T;
+        while(size) {
+            size_t n = (size_t)min<uint64_t>(size, PIECE / sizeof(T));
+            size_t old = v.size();
+            v.resize(old + n);
+            xferFullBlock((char *)&v[old], n * sizeof(T));
+            size -= n;
+        }
+    }
+
+    // Reading: the next 'size' bytes, without copying them where the
+    // backend holds them all (memory, strings, files); valid until the
+    // next xfer. Throws at the end of the input.
+    const char *readInPlace(size_t size)
+    {
+        if((size_t)(end - next) < size && fill(size) < size) {
+            throw runtime_error("Flatten: unexpected end of input");
+        }
+        const char *p = next;
+        next += size;
+        return p;
+    }
+
+    // Writing: hand what is buffered to the backend
+    virtual void flush() {}
+
+protected:
+    explicit Flatten(bool reading) : m_reading(reading), next(NULL), end(NULL) {}
+
+    // Reading, the window is short of 'size' bytes: make them the start
+    // of the window, with the ones left in it first. Returns the bytes
+    // in the window, fewer than 'size' only at the end of the input.
+    virtual size_t fill(size_t size) = 0;
+
+    // Writing, the window is short of 'size' bytes: make room, and write
+    virtual void writeBlock(const char *src, size_t size) = 0;
+
+    // Reading 'size' bytes, more than the window has
+    virtual size_t readBlock(char *dest, size_t size)
+    {
+        size_t done = 0;
+        while(done < size) {
+            size_t n = end - next;
+            if(!n && !(n = fill(1))) {
+                break;
+            }
+            n = min(n, size - done);
+            memcpy(dest + done, next, n);
+            next += n;
+            done += n;
+        }
+        return done;
+    }
 
-    int innerWriteBlock(char *dest, int size);
     // read or write
     bool m_reading;
-    //
-    char *next, end;
+    // the window
+    char *next, *end;
+
+private:
+    Flatten(const Flatten &);
+    Flatten &operator=(const Flatten &);
+
+    // Writing a varwidth: where to encode it, in place when there is
+    // room for the longest
+    unsigned char *startVarWidth()
+    {
+        if((size_t)(end - next) >= VARWIDTH_MAX_WIDTH) {
+            return (unsigned char *)next;
+        }
+        return varwidth;
+    }
+
+    void endVarWidth(unsigned char *p)
+    {
+        if(p >= varwidth && p <= varwidth + VARWIDTH_MAX_WIDTH) {
+            xferFullBlock((char *)varwidth, p - varwidth);
+        } else {
+            next = (char *)p;
+        }
+    }
+
+    // Reading a varwidth: its bytes, in place if the window has them
+    const unsigned char *readVarWidth()
+    {
+        if(next == end && !fill(1)) {
+            throw runtime_error("Flatten: unexpected end of input");
+        }
+        size_t size = varWidthLength((unsigned char)*next);
+        return (const unsigned char *)readInPlace(size);
+    }
+
+    unsigned char varwidth[VARWIDTH_MAX_WIDTH];
 };
 
-#define BUFFER_SIZE 0x100;
-// Has a buffer to cache the write/read
-class BufferedFlatten : public Flatten
+// xferGeneric: the xfer for the type. Classes have xferFields; others
+// can add overloads (Filename does).
+template<class T>
+void xferGeneric(Flatten &flat, T &x)
+{
+    x.xferFields(flat);
+}
+
+#define FLATTEN_XFER_INT(type) \
+    inline void xferGeneric(Flatten &flat, type &x) { flat.xferInt(x); }
+FLATTEN_XFER_INT(char)
+FLATTEN_XFER_INT(signed char)
+FLATTEN_XFER_INT(unsigned char)
+FLATTEN_XFER_INT(short)
+FLATTEN_XFER_INT(unsigned short)
+FLATTEN_XFER_INT(int)
+FLATTEN_XFER_INT(unsigned)
+FLATTEN_XFER_INT(long)
+FLATTEN_XFER_INT(unsigned long)
+FLATTEN_XFER_INT(long long)
+FLATTEN_XFER_INT(unsigned long long)
+#undef FLATTEN_XFER_INT
+
+inline void xferGeneric(Flatten &flat, bool &x)
+{
+    flat.xferBool(x);
+}
+
+inline void xferGeneric(Flatten &flat, string &x)
+{
+    flat.xferString(x);
+}
+
+template<class T>
+void xferElements(Flatten &flat, vector<T> &v, uint64_t size, true_type)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(flat.reading()) {
+        flat.readPieces(v, size);
+    } else if(size) {
+        flat.xferFullBlock((char *)&v[0], size * sizeof(T));
+    }
+#else
+    xferElements(flat, v, size, false_type());
+#endif
+}
+
+template<class T>
+void xferElements(Flatten &flat, vector<T> &v, uint64_t size, false_type)
+{
+    if(!flat.reading()) {
+        for(size_t i = 0; i < size; ++i) {
+            xferGeneric(flat, v[i]);
+        }
+        return;
+    }
+    for(uint64_t i = 0; i < size; ++i) {
+        v.push_back(T());
+        xferGeneric(flat, v.back());
+    }
+}
+
+// vector<bool>'s elements are proxies, not bool &
+inline void xferElements(Flatten &flat, vector<bool> &v, uint64_t size, false_type)
+{
+    for(uint64_t i = 0; i < size; ++i) {
+        bool b = flat.reading() ? false : (bool)v[i];
+        flat.xferBool(b);
+        if(flat.reading()) {
+            v.push_back(b);
+        }
+    }
+}
+
+// The length, then the elements; integers all in one block (not bools:
+// vector<bool> is packed bits, with no &v[0] to copy from)
+template<class T>
+void xferGeneric(Flatten &flat, vector<T> &v)
+{
+    uint64_t size = v.size();
+    flat.xferVarUInt(size);
+    if(flat.reading()) {
+        v.clear();
+    }
+    xferElements(flat, v, size,
+                 integral_constant<bool, is_integral<T>::value && !is_same<T, bool>::value>());
+}
+
+// Reads 'size' bytes at 'data', in place
+class MemoryFlatten : public Flatten
 {
+public:
+    MemoryFlatten(const void *data, size_t size) : Flatten(true)
+    {
+        next = (char *)data;
+        end = next + size;
+    }
+
 protected:
-    int innerReadBlock(char *dest, int size)
+    size_t fill(size_t)
     {
-        int cpysize = size;
-        while(true) {
-            int bufLen = next - end;
-            if(bufLen > size) {
-                //
-            }
+        return end - next;
+    }
 
-            memcpy(dest, next, bufLen);
-            dest += bufLen;
-            size -= bufLen;
+    void writeBlock(const char *, size_t)
+    {
+        throw logic_error("MemoryFlatten: read only");
+    }
+};
 
-            int got = fillBuf(buffer, BUFFER_SIZE);
+// use a string to implement fill/empty buffer: reading takes its bytes in
+// place, writing appends to it, growing it as a vector would
+class StringFlatten : public Flatten
+{
+public:
+    // Reading
+    explicit StringFlatten(const string &s) : Flatten(true), s(const_cast<string &>(s))
+    {
+        next = (char *)s.data();
+        end = next + s.size();
+    }
 
-            if(got == 0) {
-                return cpysize -= size; 
-            }
-            
-            next = buffer;
-            end = buffer + got;
+    StringFlatten(string &s, bool reading) : Flatten(reading), s(s)
+    {
+        next = &s[0];
+        end = next + s.size();
+        if(!reading) {
+            next = end;
+        }
+    }
+
+    ~StringFlatten()
+    {
+        flush();
+    }
+
+    // Writing: cut the string down to what was written
+    void flush()
+    {
+        if(!m_reading) {
+            s.resize(next - &s[0]);
+            next = end = &s[0] + s.size();
         }
     }
 
-    virtual fillBuf(char *buffer, int size) = 0;
-    virtual emptyBuf(char *buffer, int size) = 0;
+    // Writing: the bytes written so far, flushed or not
+    size_t written() const
+    {
+        return next - s.data();
+    }
+
+    // Writing: start over on an empty string, keeping its buffer
+    void clear()
+    {
+        s.clear();
+        next = end = &s[0];
+    }
+
+protected:
+    size_t fill(size_t)
+    {
+        return end - next;
+    }
+
+    void writeBlock(const char *src, size_t size)
+    {
+        size_t used = next - &s[0];
+        s.resize(max(max(used + size, s.size() * 2), (size_t)256));
+        next = &s[0] + used;
+        end = &s[0] + s.size();
+        memcpy(next, src, size);
+        next += size;
+    }
+
 private:
-    char buffer[BUFFER_SIZE];
+    string &s;
 };
 
-// use a string to implement fill/empty buffer
-class StringFlatten : public BufferedFlatten
+// Has a buffer to cache the write/read
+class BufferedFlatten : public Flatten
 {
+public:
+    enum { BUFFER_SIZE = 1 << 20 };
+
+    ~BufferedFlatten()
+    {
+        delete[] buffer;
+    }
+
+    void flush()
+    {
+        if(!m_reading && next != buffer) {
+            emptyBuf(buffer, next - buffer);
+            next = buffer;
+        }
+    }
+
+protected:
+    // Derived classes flush() in their destructor: emptyBuf is theirs.
+    BufferedFlatten(bool reading, size_t capacity = BUFFER_SIZE)
+        : Flatten(reading), buffer(new char[capacity]), capacity(capacity)
+    {
+        next = buffer;
+        end = reading ? buffer : buffer + capacity;
+    }
+
+    // Read up to 'size' bytes into 'buf'; 0 at the end
+    virtual size_t fillBuf(char *buf, size_t size) = 0;
+    // Write all of them
+    virtual void emptyBuf(const char *buf, size_t size) = 0;
+
+    size_t fill(size_t size)
+    {
+        size_t left = end - next;
+        if(size > capacity) {
+            char *bigger = new char[size];
+            memcpy(bigger, next, left);
+            delete[] buffer;
+            buffer = bigger;
+            capacity = size;
+        } else {
+            memmove(buffer, next, left);
+        }
+        next = buffer;
+        end = buffer + left;
+        while(left < size) {
+            size_t got = fillBuf(end, capacity - left);
+            if(!got) {
+                break;
+            }
+            end += got;
+            left += got;
+        }
+        return left;
+    }
+
+    size_t readBlock(char *dest, size_t size)
+    {
+        size_t done = end - next;
+        memcpy(dest, next, done);
+        next = end = buffer;
+        // large reads skip the buffer
+        while(size - done >= capacity) {
+            size_t got = fillBuf(dest + done, size - done);
+            if(!got) {
+                return done;
+            }
+            done += got;
+        }
+        size_t n = min(fill(size - done), size - done);
+        memcpy(dest + done, next, n);
+        next += n;
+        return done + n;
+    }
+
+    void writeBlock(const char *src, size_t size)
+    {
+        flush();
+        if(size >= capacity) {
+            emptyBuf(src, size);
+        } else {
+            memcpy(next, src, size);
+            next += size;
+        }
+    }
+
+    char *buffer;
+    size_t capacity;
 };
 
 // Use iostream to implement fill/empty buffer
+// Writing: flush() to know that the data made it to the stream; the
+// destructor flushes too, but cannot throw.
 class IOSFlatten : public BufferedFlatten
 {
+public:
+    explicit IOSFlatten(istream &is) : BufferedFlatten(true), is(&is), os(NULL) {}
+    explicit IOSFlatten(ostream &os) : BufferedFlatten(false), is(NULL), os(&os) {}
+
+    ~IOSFlatten()
+    {
+        try {
+            flush();
+        } catch(const runtime_error &) {
+            // flush() to know
+        }
+    }
+
+protected:
+    size_t fillBuf(char *buf, size_t size)
+    {
+        is->read(buf, size);
+        return is->gcount();
+    }
+
+    void emptyBuf(const char *buf, size_t size)
+    {
+        if(!os->write(buf, size)) {
+            throw runtime_error("IOSFlatten: write failed");
+        }
+    }
+
+private:
+    istream *is;
+    ostream *os;
 };
 
-// write/read a file
-class FileFlatten : public IOSFlatten
+// write/read a file. Reading maps all of it and reads it in place.
+// Writing buffers, and a block too big for what is left of the buffer goes
+// out in one writev with what is in it.
+class FileFlatten : public BufferedFlatten
 {
+public:
+    FileFlatten(const string &path, bool reading)
+        : BufferedFlatten(reading, reading ? 0 : (size_t)BUFFER_SIZE),
+          path(path), fd(-1), map(NULL), map_size(0)
+    {
+        fd = reading ? ::open(path.c_str(), O_RDONLY)
+                     : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if(fd < 0) {
+            throw_errno("open");
+        }
+        if(reading) {
+            try {
+                map_file();
+            } catch(const runtime_error &) {
+                ::close(fd);
+                throw;
+            }
+        }
+    }
+
+    ~FileFlatten()
+    {
+        try {
+            close();
+        } catch(const runtime_error &) {
+            // close() to know
+        }
+        if(fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Reading: the size of the file, all of it mapped; readInPlace(size())
+    // at the start is the whole of it
+    size_t size() const
+    {
+        return map_size;
+    }
+
+    // Flush and close, throwing if the data did not make it
+    void close()
+    {
+        if(fd < 0) {
+            return;
+        }
+        flush();
+        if(map) {
+            munmap(map, map_size);
+            map = NULL;
+        }
+        next = end = buffer;
+        int rv = ::close(fd);
+        fd = -1;
+        if(rv < 0) {
+            throw_errno("close");
+        }
+    }
+
+protected:
+    size_t fill(size_t)
+    {
+        // all of it is mapped
+        return end - next;
+    }
+
+    size_t readBlock(char *dest, size_t size)
+    {
+        return Flatten::readBlock(dest, size);
+    }
+
+    size_t fillBuf(char *, size_t)
+    {
+        return 0;
+    }
 
+    void emptyBuf(const char *buf, size_t size)
+    {
+        struct iovec iov = { (void *)buf, size };
+        writeAll(&iov, 1);
+    }
+
+    void writeBlock(const char *src, size_t size)
+    {
+        if(size < capacity / 2) {
+            BufferedFlatten::writeBlock(src, size);
+            return;
+        }
+        struct iovec iov[2] = {
+            { buffer, (size_t)(next - buffer) },
+            { (void *)src, size }
+        };
+        writeAll(iov, 2);
+        next = buffer;
+    }
+
+private:
+    void map_file()
+    {
+        struct stat st;
+        if(fstat(fd, &st) < 0) {
+            throw_errno("stat");
+        }
+        map_size = st.st_size;
+        if(map_size) {
+            map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map == MAP_FAILED) {
+                map = NULL;
+                throw_errno("mmap");
+            }
+            madvise(map, map_size, MADV_SEQUENTIAL);
+        }
+        next = (char *)map;
+        end = next + map_size;
+    }
+
+    void writeAll(struct iovec *iov, int count)
+    {
+        while(count) {
+            ssize_t n = ::writev(fd, iov, count);
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                throw_errno("write");
+            }
+            // skip what went out, which may end inside a block
+            while(count && (size_t)n >= iov->iov_len) {
+                n -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if(count) {
+                iov->iov_base = (char *)iov->iov_base + n;
+                iov->iov_len -= n;
+            }
+        }
+    }
+
+    void throw_errno(const char *what)
+    {
+        throw runtime_error(string(what) + " " + path + ": " + strerror(errno));
+    }
+
+    string path;
+    int fd;
+    void *map;
+    size_t map_size;
 };
+
 #endif /* FLATTEN_HPP */
@@ -0,0 +1,11 @@
+// xferFields of classes declared where flatten.hpp cannot be included,
+// for dependency reasons
+
+#include "flatten-fields.hpp"
+#include "md5.hpp"
+
+// 16 bytes, hi then lo: one block
+void md5_pair_t::xferFields(Flatten &flat)
+{
+    FLATTEN_XFER_FIELDS(flat, md5_pair_t, hi, lo);
+}
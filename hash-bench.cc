@@ -0,0 +1,203 @@
+// Speed and quality of the hash functions in hash-fns.hpp, against
+// std::hash.
+//
+// usage: hash-bench [keys]
+//
+// Speed: nanoseconds per integer hash, and GB/s hashing strings of 4 bytes
+// to 4KB.
+//
+// Quality, for 'keys' keys (1M by default) of each of: integers 0, 1, 2...,
+// multiples of 4096, heap pointers and strings "user0", "user1"...:
+//   low, high   chi-squared / degrees of freedom of the spread over 64K
+//               buckets picked by the low, resp. high, 16 bits of the hash;
+//               about 1 is uniform, thousands is clustering
+//   max         the fullest of those buckets, against an average of
+//               keys / 64K
+//   dups        keys whose 64 bit hash another key has too
+// and avalanche: how far from 1/2 the chance that an output bit flips when
+// one input bit does gets, at worst (0 is ideal, 0.5 the identity).
+
+#include "hash-fns.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct std_int_t {
+    static const char *name() { return "std::hash"; }
+    size_t operator()(uint64_t x) const { return hash<uint64_t>()(x); }
+};
+
+struct mix64_t {
+    static const char *name() { return "hash_mix64"; }
+    size_t operator()(uint64_t x) const { return hash_mix64(x); }
+};
+
+struct int_t {
+    static const char *name() { return "hash_int"; }
+    size_t operator()(uint64_t x) const { return hash_int(x); }
+};
+
+template<class H>
+static void int_speed(size_t n)
+{
+    H h;
+    uint64_t sum = 0;
+    double start = now();
+    for(uint64_t i = 0; i < n; ++i) {
+        // chained so that the calls cannot overlap
+        sum += h(i ^ (sum & 1));
+    }
+    printf("%-12s %8.2f ns/hash   (%llu)\n", H::name(), (now() - start) * 1e9 / n,
+           (unsigned long long)sum % 10);
+}
+
+static void bytes_speed()
+{
+    size_t lens[] = { 4, 8, 16, 32, 64, 256, 1024, 4096 };
+    printf("\n%8s %14s %14s   (GB/s)\n", "length", "std::hash", "hash_bytes");
+    for(size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); ++l) {
+        string s(lens[l], 'x');
+        size_t n = (256 << 20) / lens[l];
+        uint64_t sum = 0;
+        double start = now();
+        for(size_t i = 0; i < n; ++i) {
+            s[0] = (char)sum;
+            sum += hash<string>()(s);
+        }
+        double std_secs = now() - start;
+        start = now();
+        for(size_t i = 0; i < n; ++i) {
+            s[0] = (char)sum;
+            sum += hash_bytes(s.data(), s.size());
+        }
+        double ours = now() - start;
+        printf("%8zu %14.2f %14.2f   (%llu)\n", lens[l], n * lens[l] / std_secs / 1e9,
+               n * lens[l] / ours / 1e9, (unsigned long long)sum % 10);
+    }
+}
+
+static void quality(const char *keys, const char *name, vector<uint64_t> hashes)
+{
+    enum { BITS = 16 };
+    size_t n = hashes.size();
+    double expected = (double)n / (1 << BITS);
+    double chi[2];
+    size_t max_load = 0;
+    for(int high = 0; high < 2; ++high) {
+        vector<size_t> buckets(1 << BITS);
+        for(size_t i = 0; i < n; ++i) {
+            ++buckets[high ? hashes[i] >> (64 - BITS) : hashes[i] & ((1 << BITS) - 1)];
+        }
+        chi[high] = 0;
+        for(size_t b = 0; b < buckets.size(); ++b) {
+            chi[high] += (buckets[b] - expected) * (buckets[b] - expected) / expected;
+            max_load = max(max_load, buckets[b]);
+        }
+        chi[high] /= buckets.size() - 1;
+    }
+    sort(hashes.begin(), hashes.end());
+    size_t dups = 0;
+    for(size_t i = 1; i < n; ++i) {
+        dups += hashes[i] == hashes[i - 1];
+    }
+    printf("%-10s %-12s %10.2f %10.2f %8zu %8zu\n", keys, name, chi[0], chi[1], max_load, dups);
+}
+
+template<class H>
+static void int_quality(const char *keys, const vector<uint64_t> &in)
+{
+    H h;
+    vector<uint64_t> hashes(in.size());
+    for(size_t i = 0; i < in.size(); ++i) {
+        hashes[i] = h(in[i]);
+    }
+    quality(keys, H::name(), hashes);
+}
+
+template<class H>
+static void avalanche(const char *name, H h)
+{
+    enum { SAMPLES = 20000 };
+    mt19937_64 rng(1);
+    // flips[in][out]
+    vector<size_t> flips(64 * 64);
+    for(int s = 0; s < SAMPLES; ++s) {
+        uint64_t x = rng();
+        uint64_t hx = h(x);
+        for(int in = 0; in < 64; ++in) {
+            uint64_t d = hx ^ h(x ^ ((uint64_t)1 << in));
+            for(int out = 0; out < 64; ++out) {
+                flips[in * 64 + out] += (d >> out) & 1;
+            }
+        }
+    }
+    double worst = 0;
+    for(size_t i = 0; i < flips.size(); ++i) {
+        worst = max(worst, fabs((double)flips[i] / SAMPLES - 0.5));
+    }
+    printf("%-12s %6.3f\n", name, worst);
+}
+
+static uint64_t bytes8(uint64_t x)
+{
+    return hash_bytes(&x, sizeof(x));
+}
+
+int main(int argc, const char **argv)
+{
+    size_t n = argc > 1 ? atol(argv[1]) : 1000000;
+
+    int_speed<std_int_t>(100000000);
+    int_speed<mix64_t>(100000000);
+    int_speed<int_t>(100000000);
+    bytes_speed();
+
+    printf("\n%-10s %-12s %10s %10s %8s %8s\n", "keys", "hash", "low", "high", "max", "dups");
+    vector<uint64_t> seq(n), stride(n), ptrs(n);
+    vector<void *> blocks(n);
+    for(size_t i = 0; i < n; ++i) {
+        seq[i] = i;
+        stride[i] = i * 4096;
+        blocks[i] = malloc(32);
+        ptrs[i] = (uintptr_t)blocks[i];
+    }
+    int_quality<std_int_t>("0,1,2...", seq);
+    int_quality<mix64_t>("0,1,2...", seq);
+    int_quality<int_t>("0,1,2...", seq);
+    int_quality<std_int_t>("i*4096", stride);
+    int_quality<mix64_t>("i*4096", stride);
+    int_quality<int_t>("i*4096", stride);
+    int_quality<std_int_t>("pointers", ptrs);
+    int_quality<mix64_t>("pointers", ptrs);
+    int_quality<int_t>("pointers", ptrs);
+    for(size_t i = 0; i < n; ++i) {
+        free(blocks[i]);
+    }
+
+    vector<uint64_t> std_hashes(n), our_hashes(n);
+    for(size_t i = 0; i < n; ++i) {
+        string s = "user" + to_string(i);
+        std_hashes[i] = hash<string>()(s);
+        our_hashes[i] = hash_t<string>()(s);
+    }
+    quality("strings", "std::hash", std_hashes);
+    quality("strings", "hash_bytes", our_hashes);
+
+    printf("\n%-12s %6s\n", "avalanche", "bias");
+    avalanche("std::hash", std_int_t());
+    avalanche("hash_mix64", mix64_t());
+    avalanche("hash_int", int_t());
+    avalanche("hash_bytes", bytes8);
+    return 0;
+}
@@ -0,0 +1,168 @@
+#ifndef HASH_FNS_HPP
+#define HASH_FNS_HPP
+
+#include <functional>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+using namespace std;
+
+// Hash functions for hash tables whose size is a power of 2, which take
+// some bits of the hash (low or high) as the bucket: every bit of the
+// result has to depend on every bit of the key. std::hash does not do
+// that for integers and pointers (it is the identity in libstdc++), so
+// keys that differ only in their high bits, e.g. multiples of 4096 or
+// pointers to 16 byte aligned blocks, all land in a handful of buckets.
+//
+// - hash_mix64: the 64 bit finalizer of MurmurHash3, to fix up a hash
+//   that may be weak.
+// - hash_int: an integer, through two 64x64->128 bit multiplies whose
+//   halves are folded together (wyhash's "mum").
+// - hash_bytes: a byte range, after wyhash (Wang Yi): 16 bytes at a time
+//   through the same multiply, 48 with three independent lanes for long
+//   inputs. Not meant to resist attackers picking keys.
+//
+// hash_t<T> picks one of them for T, and is what the maps take as their
+// Hash parameter by default.
+
+// MurmurHash3 fmix64
+inline uint64_t hash_mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+namespace hash_detail {
+
+static const uint64_t P0 = 0x2d358dccaa6c78a5ULL;
+static const uint64_t P1 = 0x8bb84b93962eacc9ULL;
+static const uint64_t P2 = 0x4b33a62ed433d4a3ULL;
+static const uint64_t P3 = 0x4d5a2da51de1aa47ULL;
+
+// 128 bit product of a and b, high half xor low half
+inline uint64_t mum(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+inline uint64_t read8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t read4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+} // namespace hash_detail
+
+inline uint64_t hash_int(uint64_t x)
+{
+    using namespace hash_detail;
+    // one multiply by a constant leaves a flip of a high bit of x a fixed
+    // difference in the product: the second mixes its two halves
+    __uint128_t r = (__uint128_t)(x ^ P0) * P1;
+    return mum((uint64_t)r ^ P0, (uint64_t)(r >> 64) ^ P1);
+}
+
+inline uint64_t hash_bytes(const void *data, size_t len, uint64_t seed = 0)
+{
+    using namespace hash_detail;
+    const uint8_t *p = (const uint8_t *)data;
+    seed ^= mum(seed ^ P0, P1);
+    uint64_t a, b;
+    if(len <= 16) {
+        if(len >= 4) {
+            // two overlapping pairs of 4 bytes cover 4 to 16
+            size_t mid = (len >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + mid);
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - mid);
+        } else if(len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if(i > 48) {
+            uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed = mum(read8(p) ^ P1, read8(p + 8) ^ seed);
+                seed1 = mum(read8(p + 16) ^ P2, read8(p + 24) ^ seed1);
+                seed2 = mum(read8(p + 32) ^ P3, read8(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while(i > 16) {
+            seed = mum(read8(p) ^ P1, read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // the last 16 bytes, overlapping what came before if need be
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+    __uint128_t r = (__uint128_t)(a ^ P1) * (b ^ seed);
+    return mum((uint64_t)r ^ P0 ^ len, (uint64_t)(r >> 64) ^ P1);
+}
+
+// Anything std::hash knows, mixed
+template<class T>
+struct hash_t
+{
+    size_t operator() (const T& i) const
+    {
+        return hash_mix64(hash<T>()(i));
+    }
+};
+
+template<class T>
+struct int_hash_t
+{
+    size_t operator() (const T& i) const
+    {
+        return hash_int((uint64_t)i);
+    }
+};
+
+template<> struct hash_t<char> : int_hash_t<char> {};
+template<> struct hash_t<short> : int_hash_t<short> {};
+template<> struct hash_t<unsigned short> : int_hash_t<unsigned short> {};
+template<> struct hash_t<int> : int_hash_t<int> {};
+template<> struct hash_t<unsigned> : int_hash_t<unsigned> {};
+template<> struct hash_t<long> : int_hash_t<long> {};
+template<> struct hash_t<unsigned long> : int_hash_t<unsigned long> {};
+template<> struct hash_t<long long> : int_hash_t<long long> {};
+template<> struct hash_t<unsigned long long> : int_hash_t<unsigned long long> {};
+
+template<class T>
+struct hash_t<T*>
+{
+    size_t operator() (T* const& i) const
+    {
+        return hash_int((uintptr_t)i);
+    }
+};
+
+template<>
+struct hash_t<string>
+{
+    size_t operator() (const string& i) const
+    {
+        return hash_bytes(i.data(), i.size());
+    }
+};
+#endif /* HASH_FNS_HPP */
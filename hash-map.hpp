@@ -0,0 +1,329 @@
+#ifndef HASH_MAP_HPP
+#define HASH_MAP_HPP
+
+#include <assert.h>
+#include <functional>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <utility>
+using namespace std;
+
+#include "hash-fns.hpp"
+
+// true if equal
+template<class T>
+struct compare_t
+{
+    bool operator() (const T& i, const T& j) const
+    {
+        return i == j;
+    }
+};
+
+// hash_map_t: a chained hash table that grows without stopping the world.
+//
+// When the table is full (as many entries as buckets), a table of twice
+// the size is made and the entries move over a few buckets at a time: every
+// put or erase migrates REHASH_BUCKETS buckets of the old table, and new
+// entries go to the new one. Until the old table is empty, lookups try
+// both. The old table is gone well before the new one is full, so a put
+// never does more than a bounded amount of rehashing; the bucket arrays
+// come from calloc, whose large blocks are zeroed by the kernel as they
+// are touched, so making one costs next to nothing either.
+//
+// With 'incremental' false, the whole table is rehashed at once instead,
+// as a baseline.
+//
+// find() does no migration, so it is const and iterators stay valid until
+// the next put or erase.
+template<class K, class V, class Hash = hash_t<K>, class Compare = compare_t<K> >
+struct hash_map_t
+{
+    struct pair_t
+    {
+        K k;
+        V v;
+
+        pair_t(K k, V v): k(k), v(v) {}
+    };
+
+    typedef K       key_type;
+    typedef V       mapped_type;
+    typedef pair_t  value_type;
+    typedef Compare key_compare;
+
+    struct hash_node_t
+    {
+        pair_t p;
+        hash_node_t *next;
+
+        hash_node_t(K k, V v): p(k, v), next(NULL) {}
+    };
+
+private:
+    enum {
+        MIN_SIZE = 16,
+        // old buckets migrated by every put or erase during a rehash
+        REHASH_BUCKETS = 4
+    };
+
+    struct table_t
+    {
+        table_t(): buckets(NULL), size(0), used(0) {}
+        hash_node_t **buckets;
+        size_t size;
+        size_t used;
+    };
+
+public:
+    struct iterator_t
+    {
+        friend struct hash_map_t;
+
+        iterator_t(): map(NULL), t(2), idx(0), n(NULL) {}
+
+        iterator_t &operator++()
+        {
+            n = n->next;
+            next_avail();
+            return *this;
+        }
+
+        bool operator==(const iterator_t &o) const
+        {
+            return t == o.t && idx == o.idx && n == o.n;
+        }
+
+        bool operator!=(const iterator_t &o) const
+        {
+            return !(*this == o);
+        }
+
+        pair_t &operator*() const
+        {
+            return n->p;
+        }
+
+        pair_t *operator->() const
+        {
+            return &n->p;
+        }
+
+    private:
+        iterator_t(const hash_map_t *map, int t, size_t idx, hash_node_t *n)
+          : map(map), t(t), idx(idx), n(n) {
+            next_avail();
+          }
+
+        // Past the end of a bucket is the start of the next non-empty one,
+        // through the old table and then the new one
+        void next_avail()
+        {
+            while(!n && t < 2) {
+                if(++idx >= map->tables[t].size) {
+                    ++t;
+                    idx = 0;
+                    if(t == 2) {
+                        break;
+                    }
+                    n = map->tables[t].size ? map->tables[t].buckets[0] : NULL;
+                    continue;
+                }
+                n = map->tables[t].buckets[idx];
+            }
+        }
+
+        const hash_map_t *map;
+        int t;
+        size_t idx;
+        hash_node_t *n;
+    };
+
+    hash_map_t(const Compare& compare = Compare(),
+               const Hash& hash = Hash(),
+               bool incremental = true)
+      : rehash_idx(0), incremental(incremental), hash(hash), compare(compare) {}
+
+    ~hash_map_t()
+    {
+        for(int t = 0; t < 2; ++t) {
+            free_table(tables[t]);
+        }
+    }
+
+    size_t size() const
+    {
+        return tables[0].used + tables[1].used;
+    }
+
+    // Whether a resize is under way
+    bool rehashing() const
+    {
+        return tables[1].size != 0;
+    }
+
+    // Insert or replace
+    void put(const K &k, const V &v)
+    {
+        rehash_step();
+        hash_node_t *n = find_node(k);
+        if(n) {
+            n->p.v = v;
+            return;
+        }
+        if(!rehashing() && tables[0].used >= tables[0].size) {
+            grow();
+        }
+        // new entries only go to the table that stays
+        table_t &to = tables[rehashing() ? 1 : 0];
+        n = new hash_node_t(k, v);
+        size_t idx = get_idx(to, k);
+        n->next = to.buckets[idx];
+        to.buckets[idx] = n;
+        ++to.used;
+    }
+
+    // NULL if not there
+    V *get(const K &k)
+    {
+        hash_node_t *n = find_node(k);
+        return n ? &n->p.v : NULL;
+    }
+
+    bool erase(const K &k)
+    {
+        rehash_step();
+        for(int t = 0; t < 2; ++t) {
+            if(!tables[t].used) {
+                continue;
+            }
+            hash_node_t **p = &tables[t].buckets[get_idx(tables[t], k)];
+            for(; *p; p = &(*p)->next) {
+                if(compare((*p)->p.k, k)) {
+                    hash_node_t *n = *p;
+                    *p = n->next;
+                    delete n;
+                    --tables[t].used;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    iterator_t find(const K &k) const
+    {
+        for(int t = 0; t < 2; ++t) {
+            if(!tables[t].used) {
+                continue;
+            }
+            size_t idx = get_idx(tables[t], k);
+            for(hash_node_t *n = tables[t].buckets[idx]; n; n = n->next) {
+                if(compare(n->p.k, k)) {
+                    return iterator_t(this, t, idx, n);
+                }
+            }
+        }
+        return end();
+    }
+
+    iterator_t begin() const
+    {
+        return iterator_t(this, 0, 0, tables[0].size ? tables[0].buckets[0] : NULL);
+    }
+
+    iterator_t end() const
+    {
+        return iterator_t();
+    }
+
+private:
+    hash_map_t(const hash_map_t &);
+    hash_map_t &operator=(const hash_map_t &);
+
+    size_t get_idx(const table_t &table, const K &k) const
+    {
+        return hash(k) & (table.size - 1);
+    }
+
+    hash_node_t *find_node(const K &k) const
+    {
+        iterator_t it = find(k);
+        return it.n;
+    }
+
+    void grow()
+    {
+        table_t &to = tables[tables[0].size ? 1 : 0];
+        to.size = tables[0].size ? tables[0].size * 2 : (size_t)MIN_SIZE;
+        to.buckets = (hash_node_t **)calloc(to.size, sizeof(hash_node_t *));
+        if(!to.buckets) {
+            throw bad_alloc();
+        }
+        rehash_idx = 0;
+        if(!incremental) {
+            while(rehashing()) {
+                rehash_buckets(tables[0].size);
+            }
+        }
+    }
+
+    void rehash_step()
+    {
+        if(rehashing()) {
+            rehash_buckets(REHASH_BUCKETS);
+        }
+    }
+
+    // Move the entries of the next 'count' old buckets to the new table,
+    // and make that the only table once the old one is empty.
+    void rehash_buckets(size_t count)
+    {
+        table_t &from = tables[0];
+        table_t &to = tables[1];
+        for(; count && rehash_idx < from.size; --count, ++rehash_idx) {
+            hash_node_t *n = from.buckets[rehash_idx];
+            from.buckets[rehash_idx] = NULL;
+            while(n) {
+                hash_node_t *next = n->next;
+                size_t idx = get_idx(to, n->p.k);
+                n->next = to.buckets[idx];
+                to.buckets[idx] = n;
+                --from.used;
+                ++to.used;
+                n = next;
+            }
+        }
+        if(rehash_idx == from.size) {
+            assert(!from.used);
+            free(from.buckets);
+            from = to;
+            to = table_t();
+            rehash_idx = 0;
+        }
+    }
+
+    static void free_table(table_t &table)
+    {
+        for(size_t i = 0; i < table.size; ++i) {
+            hash_node_t *n = table.buckets[i];
+            while(n) {
+                hash_node_t *next = n->next;
+                delete n;
+                n = next;
+            }
+        }
+        free(table.buckets);
+        table = table_t();
+    }
+
+    // tables[1] only during a rehash
+    table_t tables[2];
+    // next bucket of tables[0] to migrate
+    size_t rehash_idx;
+    bool incremental;
+    Hash hash;
+    Compare compare;
+};
+#endif /* HASH_MAP_HPP */
@@ -1,149 +1,56 @@
 // hash function ideas
 
 // implement a hashmap
-template<class T>
-struct hash_t 
+//
+// hash_map_t is in hash-map.hpp. This measures the latency of its puts
+// while it grows, rehashing all at once and incrementally.
+//
+// usage: hashtable [entries]
+//
+// Puts 'entries' (10M by default) random keys in an empty map and reports
+// percentiles of the time each put took.
+
+#include "hash-map.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static void run(const char *name, size_t entries, bool incremental)
 {
-    int operator() (const T& i);
-};
-
-template<>
-struct hash_t<int> 
-{
-    int operator() (const int& i)
-    {
-        return i;
-    }
-};
-
-template<class T>
-struct hash_t<T*>
-{
-    int operator() (const T*& i)
-    {
-        return i;
-    }
-};
-
-template<class T>
-struct compare_t
-{
-    bool operator() (const T& i, const T& j);
-};
-
-template<class K, class V, class Hash = hash_t<K>, class Compare = compare_t<K> >
-struct hash_map_t
+    hash_map_t<uint64_t, uint64_t> map(compare_t<uint64_t>(), hash_t<uint64_t>(),
+                                       incremental);
+    mt19937_64 rng(1);
+    vector<uint32_t> ns(entries);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point last = start;
+    for(size_t i = 0; i < entries; ++i) {
+        map.put(rng(), i);
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        ns[i] = min<int64_t>(UINT32_MAX, chrono::duration_cast<chrono::nanoseconds>(now - last).count());
+        last = now;
+    }
+    double secs = chrono::duration<double>(last - start).count();
+    sort(ns.begin(), ns.end());
+    printf("%-14s %10.0f %8u %8u %8u %10u %12u\n", name, entries / secs,
+           ns[entries / 2], ns[entries * 99 / 100], ns[entries * 999 / 1000],
+           ns[entries * 9999 / 10000], ns[entries - 1]);
+}
+
+int main(int argc, const char **argv)
 {
-    struct pair_t
-    {
-        K k;
-        V v;
-
-        pair_t(K k, V v): k(k), v(v) {}
-    };
-
-    typedef K       key_type;
-    typedef V       mapped_type;
-    typedef pair_t  value_type;
-    typedef Compare key_compare;
-
-    struct hash_node_t
-    {
-        pair_t p;
-        hash_node_t *next;
-
-        hash_node_t(K k, V v): p(k, v) {}
-    };
-
-    struct iterator_t
-    {
-        friend class hash_map_t;
-
-        iterator_t(hash_map_t &map, int idx, hash_node_t *n)
-          : map(map), idx(idx), n(n){
-            next_avail();
-          }
-
-        iterator_t &operator++()
-        {
-            n = n->next;
-            next_avail();
-            return *this;
-        }
-
-        void next_avail()
-        {
-            while(!n && idx < map.table_size) {
-                ++idx;
-                n = map.table[idx];
-            }
-        }
-
-        bool operator==(const iterator_t &o)
-        {
-            return &map == &o.map && o.idx == idx && o.n == n;
-        }
-
-        hash_node_t &operator*()
-        {
-            return *(n->p);
-        }
-
-    private:
-        hash_map_t &map;
-        int idx;
-        hash_node_t *n;
-    };
-
-    hash_map_t(const Compare& compare = Compare(),
-               const Hash& hash = Hash()) {}
-
-    // NB: put and get can both implemented with sorted list,
-    // then the put/get can be log(l).
-    void put(const K &k, const V &v)
-    {
-        int idx = get_idx();
-        hash_node_t *n = new hash_node_t(k, v);
-        n->next = table[idx];
-        table[idx] = n;
-    }
-
-    const V& get(const K &k)
-    {
-        iterator_t it = find(k);
-        if(it != end()) {
-            return *it;
-        }
-    }
-
-    iterator_t find(const K &k)
-    {
-        int idx = get_idx(k);
-        hash_node_t *n = table[idx];
-        while(n) {
-            if(!compare(n->k, k)) {
-                return iterator_t(*this, idx, n); 
-            }
-            n = n->next;
-        }
-    }
-
-    iterator_t begin()
-    {
-        return iterator_t(*this, 0, table[0], table);
-    }
-
-    iterator_t end()
-    {
-        return iterator_t(*this, table_size, 0);
-    }
-private:
-    int get_idx(const K &k) 
-    {
-        return hash(k) % table_size; 
-    }
-    hash_node_t **table;
-    int table_size;
-    Hash hash;
-    Compare compare;
-};
+    size_t entries = argc > 1 ? atol(argv[1]) : 10000000;
+    if(entries < 1) {
+        fprintf(stderr, "usage: %s [entries]\n", argv[0]);
+        return 1;
+    }
+    printf("%zu puts, ns per put\n", entries);
+    printf("%-14s %10s %8s %8s %8s %10s %12s\n", "rehash", "puts/sec",
+           "p50", "p99", "p99.9", "p99.99", "max");
+    run("all at once", entries, false);
+    run("incremental", entries, true);
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Throughput and hit ratio of lru_cache used as a look-aside cache.
+//
+// usage: lru-bench [max-threads [capacity [keys [seconds [shards [policy [ttl-ms]]]]]]]
+//        lru-bench replay trace capacity...
+//
+// The first form has every thread get zipfian distributed keys out of
+// 'keys' (theta 0.99) and set the ones it misses, as a cache in front of a
+// slower store would. Reports operations per second and the hit ratio for
+// 1, 2, 4, ... max-threads threads. 'policy' is lru (default), tinylfu or
+// clock. With 'keys' close to 'capacity' nearly all operations are hits,
+// i.e. gets, e.g. to compare lru and clock under a read-mostly load:
+//   lru-bench 32 100000 101000 2 16 lru
+//   lru-bench 32 100000 101000 2 16 clock
+// With 'ttl-ms' entries expire after that long, reclaimed by a background
+// tick every 1/64th of it; set 'capacity' above 'keys' to see only expiry:
+//   lru-bench 16 10000000 5000000 10 16 lru 3000
+//
+// 'replay' runs the same look-aside loop over the keys of a trace file, one
+// key per line, in one thread, for each policy and each capacity given.
+
+#include "lru-cache.hpp"
+#include "zipfian.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+// one per thread, padded so the counters do not share cache lines
+struct alignas(64) result_t {
+    result_t() : ops(0) {}
+    size_t ops;
+};
+
+typedef lru_cache<uint64_t, uint64_t> cache_t;
+
+static void worker(cache_t &cache, zipfian_t zipf, const atomic<bool> &stop,
+                   unsigned seed, result_t &res)
+{
+    mt19937_64 rng(seed);
+    uint64_t value;
+    while(!stop.load(memory_order_relaxed)) {
+        uint64_t key = zipf.next(rng);
+        if(!cache.get(key, value)) {
+            cache.set(key, key);
+        }
+        ++res.ops;
+    }
+}
+
+static const char *policy_names[] = { "lru", "tinylfu", "clock" };
+
+static int replay(int argc, const char **argv)
+{
+    if(argc < 4) {
+        fprintf(stderr, "usage: %s replay trace capacity...\n", argv[0]);
+        return 1;
+    }
+    ifstream in(argv[2]);
+    if(!in) {
+        perror(argv[2]);
+        return 1;
+    }
+    // keys are only compared, so their hashes will do
+    vector<uint64_t> trace;
+    string line;
+    while(getline(in, line)) {
+        trace.push_back(hash<string>()(line));
+    }
+
+    printf("%zu accesses\n", trace.size());
+    printf("capacity   policy     hit%%      ops/sec\n");
+    for(int a = 3; a < argc; ++a) {
+        size_t capacity = atol(argv[a]);
+        for(int p = cache_t::LRU; p <= cache_t::CLOCK; ++p) {
+            cache_t::options_t options;
+            options.shards = 1;
+            options.policy = (cache_t::policy_t)p;
+            cache_t cache(capacity, options);
+            uint64_t value;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(size_t i = 0; i < trace.size(); ++i) {
+                if(!cache.get(trace[i], value)) {
+                    cache.set(trace[i], trace[i]);
+                }
+            }
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cache_t::stats_t stats = cache.stats();
+            printf("%8zu %8s %8.2f %12.0f\n", capacity, policy_names[p],
+                   100.0 * stats.hits / max<uint64_t>(1, stats.hits + stats.misses),
+                   trace.size() / secs);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, const char **argv)
+{
+    if(argc > 1 && !strcmp(argv[1], "replay")) {
+        return replay(argc, argv);
+    }
+    int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+    size_t capacity = argc > 2 ? atol(argv[2]) : 100000;
+    size_t keys = argc > 3 ? atol(argv[3]) : 10 * capacity;
+    double seconds = argc > 4 ? atof(argv[4]) : 2;
+
+    cache_t::options_t options;
+    if(argc > 5) {
+        options.shards = atol(argv[5]);
+    }
+    for(int p = cache_t::LRU; argc > 6 && p <= cache_t::CLOCK; ++p) {
+        if(!strcmp(argv[6], policy_names[p])) {
+            options.policy = (cache_t::policy_t)p;
+        }
+    }
+    if(argc > 7) {
+        options.ttl = chrono::milliseconds(atol(argv[7]));
+        options.ttl_resolution = max(chrono::milliseconds(1), options.ttl / 64);
+        options.tick_interval = options.ttl_resolution;
+    }
+    zipfian_t zipf(keys);
+
+    printf("capacity %zu, %zu keys, %zu shards, %s, ttl %lldms, %.1fs per run\n",
+           capacity, keys, options.shards, policy_names[options.policy],
+           (long long)options.ttl.count(), seconds);
+    printf("threads      ops/sec   hit%%  expirations\n");
+    for(int threads = 1; threads <= max_threads; threads *= 2) {
+        cache_t cache(capacity, options);
+        atomic<bool> stop(false);
+        vector<result_t> results(threads);
+        vector<thread> pool;
+        for(int t = 0; t < threads; ++t) {
+            pool.push_back(thread(worker, ref(cache), zipf, cref(stop),
+                                  unsigned(t + 1), ref(results[t])));
+        }
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        stop = true;
+        size_t ops = 0;
+        for(int t = 0; t < threads; ++t) {
+            pool[t].join();
+            ops += results[t].ops;
+        }
+        cache_t::stats_t stats = cache.stats();
+        printf("%7d %12.0f %6.2f %12llu\n", threads, ops / seconds,
+               100.0 * stats.hits / max<uint64_t>(1, stats.hits + stats.misses),
+               (unsigned long long)stats.expirations);
+    }
+    return 0;
+}
@@ -0,0 +1,744 @@
+#ifndef LRU_CACHE_HPP
+#define LRU_CACHE_HPP
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <stdint.h>
+#include <thread>
+#include <utility>
+#include <vector>
+using namespace std;
+
+#include "hash-fns.hpp"
+#include "timer-wheel.hpp"
+
+// lru_cache<K, V, Hash>: a thread-safe cache that evicts the least recently
+// used entries.
+//
+// Keys are hashed to one of N shards, each with its own lock, its own share
+// of the capacity and its own LRU order (so eviction is LRU per shard).
+// A shard is an open-addressing hash table (linear probing, backward shift
+// deletion) whose slots also hold the links of the LRU list, so an entry
+// costs no allocation of its own.
+//
+// The capacity counts entries, or with a weigher, whatever it returns for
+// each entry (e.g. bytes).
+//
+// Policies, chosen per cache:
+// - LRU: evict the least recently used entry.
+// - TINY_LFU: W-TinyLFU (Einziger et al., "TinyLFU: A Highly Efficient
+//   Cache Admission Policy"). New entries go to a window LRU of 1% of the
+//   capacity; what falls out of it only gets into the main cache if it has
+//   been used more often than what the main cache would evict for it,
+//   going by a count-min sketch of recent access frequencies (halved every
+//   10 * capacity accesses so that it forgets). The main cache is a
+//   segmented LRU: entries start on probation and are protected (80% of
+//   the main cache) once used again. A scan, whose keys are each used
+//   once, then only churns the window instead of flushing the hot set.
+// - CLOCK: second chance. get() only sets the entry's reference bit, under
+//   a shared lock, so readers of a shard do not wait for each other; set()
+//   sweeps from the oldest entry, giving referenced ones another round and
+//   evicting the first that is not.
+//
+// Entries can also be given a time to live. Each shard keeps those that
+// have one on a timer wheel threaded through its slots, so scheduling one
+// is O(1) and expiring them takes O(1) each, in batches, without timers
+// per entry or scans of the table. Expired entries are reclaimed by a
+// background thread every 'tick_interval', or else by expire(); before
+// that, get() no longer finds them and set() reclaims what is due in its
+// shard.
+template<class K, class V, class Hash = hash<K> >
+class lru_cache {
+public:
+    typedef function<size_t(const K &, const V &)> weigher_t;
+
+    enum policy_t {
+        LRU,
+        TINY_LFU,
+        CLOCK
+    };
+
+    struct options_t {
+        options_t() : shards(16), policy(LRU), ttl(0), ttl_resolution(1000),
+                      tick_interval(0) {}
+        // rounded up to a power of 2
+        size_t shards;
+        policy_t policy;
+        // weight of an entry; 1 if not set
+        weigher_t weigher;
+        // time to live of what is set without one; 0 for forever
+        chrono::milliseconds ttl;
+        // entries expire up to this much late
+        chrono::milliseconds ttl_resolution;
+        // how often a background thread reclaims expired entries; 0 for
+        // no thread
+        chrono::milliseconds tick_interval;
+        // current time in milliseconds; steady_clock if not set
+        function<uint64_t()> clock;
+    };
+
+    struct stats_t {
+        stats_t() : hits(0), misses(0), evictions(0), expirations(0) {}
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t expirations;
+    };
+
+    explicit lru_cache(size_t capacity, const options_t &options = options_t())
+        : weigher(options.weigher), default_ttl(options.ttl),
+          resolution(max<uint64_t>(1, options.ttl_resolution.count())),
+          clock(options.clock), stopping(false) {
+        start = now_ms();
+        size_t n = 1;
+        while(n < options.shards) {
+            n *= 2;
+        }
+        shard_bits = 0;
+        while(((size_t)1 << shard_bits) < n) {
+            ++shard_bits;
+        }
+        size_t per_shard = (capacity + n - 1) / n;
+        shards.reserve(n);
+        for(size_t i = 0; i < n; ++i) {
+            shards.push_back(new shard_t(per_shard ? per_shard : 1, !weigher, options.policy));
+        }
+        if(options.tick_interval.count() > 0) {
+            ticker = thread(&lru_cache::tick, this, options.tick_interval);
+        }
+    }
+
+    ~lru_cache() {
+        if(ticker.joinable()) {
+            {
+                lock_guard<mutex> lock(ticker_m);
+                stopping = true;
+            }
+            ticker_cv.notify_one();
+            ticker.join();
+        }
+        for(size_t i = 0; i < shards.size(); ++i) {
+            delete shards[i];
+        }
+    }
+
+    // Copies the value out and makes the entry the most recently used.
+    bool get(const K &key, V &value) {
+        size_t h = hash_of(key);
+        shard_t &s = shard_of(h);
+        if(s.policy == CLOCK) {
+            shared_lock<shared_timed_mutex> lock(s.m);
+            uint32_t i = s.find(key, h);
+            // an expired entry is left for the next exclusive lock
+            if(i == NIL || expired(s.slots[i])) {
+                s.misses.fetch_add(1, memory_order_relaxed);
+                return false;
+            }
+            s.hits.fetch_add(1, memory_order_relaxed);
+            // only written when it changes, to keep the line shared
+            if(!s.slots[i].referenced.load(memory_order_relaxed)) {
+                s.slots[i].referenced.store(true, memory_order_relaxed);
+            }
+            value = s.slots[i].value;
+            return true;
+        }
+        unique_lock<shared_timed_mutex> lock(s.m);
+        s.record(h);
+        uint32_t i = s.find(key, h);
+        if(i != NIL && expired(s.slots[i])) {
+            s.expire(i);
+            i = NIL;
+        }
+        if(i == NIL) {
+            s.misses.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        s.hits.fetch_add(1, memory_order_relaxed);
+        s.touch(i);
+        value = s.slots[i].value;
+        return true;
+    }
+
+    // Insert or replace, then evict what no longer fits.
+    void set(const K &key, const V &value) {
+        set(key, value, default_ttl);
+    }
+
+    // The same, the entry expiring after 'ttl' (never if 0).
+    void set(const K &key, const V &value, chrono::milliseconds ttl) {
+        size_t h = hash_of(key);
+        shard_t &s = shard_of(h);
+        size_t w = weigher ? weigher(key, value) : 1;
+        uint32_t deadline = ttl.count() > 0 ? deadline_of(ttl) : 0;
+        unique_lock<shared_timed_mutex> lock(s.m);
+        if(s.wheel.size()) {
+            s.expire_until(ticks());
+        }
+        s.record(h);
+        uint32_t i = s.find(key, h);
+        if(i != NIL) {
+            s.set_weight(i, w);
+            s.slots[i].value = value;
+            s.touch(i);
+        } else {
+            i = s.insert(key, value, h, w);
+        }
+        s.schedule(i, deadline);
+        s.evict();
+    }
+
+    bool erase(const K &key) {
+        size_t h = hash_of(key);
+        shard_t &s = shard_of(h);
+        unique_lock<shared_timed_mutex> lock(s.m);
+        uint32_t i = s.find(key, h);
+        if(i == NIL) {
+            return false;
+        }
+        s.remove(i);
+        return true;
+    }
+
+    void clear() {
+        for(size_t i = 0; i < shards.size(); ++i) {
+            unique_lock<shared_timed_mutex> lock(shards[i]->m);
+            for(int q = 0; q < QUEUES; ++q) {
+                while(shards[i]->lists[q].tail != NIL) {
+                    shards[i]->remove(shards[i]->lists[q].tail);
+                }
+            }
+        }
+    }
+
+    // Reclaim every expired entry; the background thread calls this.
+    void expire() {
+        uint64_t now = ticks();
+        for(size_t i = 0; i < shards.size(); ++i) {
+            unique_lock<shared_timed_mutex> lock(shards[i]->m);
+            shards[i]->expire_until(now);
+        }
+    }
+
+    // Includes entries that expired but were not reclaimed yet.
+    size_t size() const {
+        size_t rv = 0;
+        for(size_t i = 0; i < shards.size(); ++i) {
+            shared_lock<shared_timed_mutex> lock(shards[i]->m);
+            rv += shards[i]->count;
+        }
+        return rv;
+    }
+
+    // Sum of the weights; size() without a weigher
+    size_t weight() const {
+        size_t rv = 0;
+        for(size_t i = 0; i < shards.size(); ++i) {
+            shared_lock<shared_timed_mutex> lock(shards[i]->m);
+            rv += shards[i]->weight;
+        }
+        return rv;
+    }
+
+    stats_t stats() const {
+        stats_t rv;
+        for(size_t i = 0; i < shards.size(); ++i) {
+            shared_lock<shared_timed_mutex> lock(shards[i]->m);
+            rv.hits += shards[i]->hits.load(memory_order_relaxed);
+            rv.misses += shards[i]->misses.load(memory_order_relaxed);
+            rv.evictions += shards[i]->evictions;
+            rv.expirations += shards[i]->expirations;
+        }
+        return rv;
+    }
+
+private:
+    lru_cache(const lru_cache &);
+    lru_cache &operator=(const lru_cache &);
+
+    static const uint32_t NIL = ~(uint32_t)0;
+
+    // The lists an entry can be on; LRU only uses WINDOW, as its one list.
+    enum {
+        WINDOW,
+        PROBATION,
+        PROTECTED,
+        QUEUES
+    };
+
+    struct slot_t {
+        slot_t() : used(false), queue(WINDOW), referenced(false),
+                   timer_bucket(wheel_t::NO_BUCKET), deadline(0), hash(0), weight(0),
+                   prev(NIL), next(NIL), timer_prev(NIL), timer_next(NIL) {}
+        // only moved around under the shard's exclusive lock
+        slot_t(slot_t &&o) { *this = std::move(o); }
+        slot_t &operator=(slot_t &&o) {
+            used = o.used;
+            queue = o.queue;
+            referenced.store(o.referenced.load(memory_order_relaxed), memory_order_relaxed);
+            timer_bucket = o.timer_bucket;
+            deadline = o.deadline;
+            hash = o.hash;
+            weight = o.weight;
+            prev = o.prev;
+            next = o.next;
+            timer_prev = o.timer_prev;
+            timer_next = o.timer_next;
+            key = std::move(o.key);
+            value = std::move(o.value);
+            return *this;
+        }
+
+        bool used;
+        uint8_t queue;
+        // CLOCK: used since the hand last passed
+        atomic<bool> referenced;
+        // timer wheel bucket, NO_BUCKET if the entry does not expire
+        uint16_t timer_bucket;
+        // tick it expires at, 0 for never
+        uint32_t deadline;
+        size_t hash;
+        size_t weight;
+        // list, most recent first
+        uint32_t prev;
+        uint32_t next;
+        // timer wheel bucket list
+        uint32_t timer_prev;
+        uint32_t timer_next;
+        K key;
+        V value;
+    };
+
+    // How the timer wheel gets at its links in the slots
+    struct timer_links_t {
+        explicit timer_links_t(vector<slot_t> &slots) : slots(slots) {}
+        uint32_t &prev(uint32_t i) { return slots[i].timer_prev; }
+        uint32_t &next(uint32_t i) { return slots[i].timer_next; }
+        uint16_t &bucket(uint32_t i) { return slots[i].timer_bucket; }
+        uint64_t deadline(uint32_t i) { return slots[i].deadline; }
+        vector<slot_t> &slots;
+    };
+    typedef timer_wheel_t<timer_links_t> wheel_t;
+
+    struct list_t {
+        list_t() : head(NIL), tail(NIL), weight(0) {}
+        uint32_t head;
+        uint32_t tail;
+        size_t weight;
+    };
+
+    // Count-min sketch of how often hashes were seen lately: 4 rows of
+    // counters saturating at 15, the estimate being the smallest of the 4.
+    struct sketch_t {
+        sketch_t() : bits(0), additions(0), sample_size(0) {}
+
+        void resize(size_t entries) {
+            bits = 4;
+            while(((size_t)1 << bits) < entries) {
+                ++bits;
+            }
+            counters.assign(4 << bits, 0);
+            additions = 0;
+            sample_size = 10 << bits;
+        }
+
+        void increment(size_t h) {
+            bool added = false;
+            for(int r = 0; r < 4; ++r) {
+                uint8_t &c = counters[index(h, r)];
+                if(c < 15) {
+                    ++c;
+                    added = true;
+                }
+            }
+            if(added && ++additions >= sample_size) {
+                // age: halve everything
+                for(size_t i = 0; i < counters.size(); ++i) {
+                    counters[i] >>= 1;
+                }
+                additions /= 2;
+            }
+        }
+
+        unsigned frequency(size_t h) const {
+            unsigned rv = 15;
+            for(int r = 0; r < 4; ++r) {
+                rv = min<unsigned>(rv, counters[index(h, r)]);
+            }
+            return rv;
+        }
+
+        size_t index(size_t h, int row) const {
+            static const uint64_t seeds[4] = {
+                0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+                0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+            };
+            return ((size_t)row << bits) | (size_t)((h * seeds[row]) >> (64 - bits));
+        }
+
+        int bits;
+        vector<uint8_t> counters;
+        size_t additions;
+        size_t sample_size;
+    };
+
+    struct shard_t {
+        shard_t(size_t capacity, bool counted, policy_t policy)
+            : policy(policy), timer_links(slots), capacity(capacity), count(0), weight(0),
+              hits(0), misses(0), evictions(0), expirations(0) {
+            // by count, the table never has to grow: keep it at most 3/4 full
+            size_t n = 16;
+            while(counted && n * 3 < (capacity + 1) * 4) {
+                n *= 2;
+            }
+            slots.resize(n);
+            if(policy == TINY_LFU) {
+                window_capacity = max<size_t>(1, capacity / 100);
+                protected_capacity = (capacity - min(capacity, window_capacity)) * 8 / 10;
+                sketch.resize(n);
+            } else {
+                window_capacity = capacity;
+                protected_capacity = 0;
+            }
+        }
+
+        uint32_t find(const K &key, size_t h) const {
+            size_t mask = slots.size() - 1;
+            for(size_t i = h & mask; slots[i].used; i = (i + 1) & mask) {
+                if(slots[i].hash == h && slots[i].key == key) {
+                    return i;
+                }
+            }
+            return NIL;
+        }
+
+        // Every exclusive get or set, found or not
+        void record(size_t h) {
+            if(policy == TINY_LFU) {
+                sketch.increment(h);
+            }
+        }
+
+        void set_weight(uint32_t i, size_t w) {
+            list_t &l = lists[slots[i].queue];
+            l.weight += w - slots[i].weight;
+            weight += w - slots[i].weight;
+            slots[i].weight = w;
+        }
+
+        // The entry was used again
+        void touch(uint32_t i) {
+            if(policy == CLOCK) {
+                slots[i].referenced.store(true, memory_order_relaxed);
+                return;
+            }
+            if(slots[i].queue != PROBATION) {
+                move_to_front(i);
+                return;
+            }
+            // used again: from probation to protected, which makes room by
+            // putting its own least recent entries back on probation
+            unlink(i);
+            link_front(i, PROTECTED);
+            while(lists[PROTECTED].weight > protected_capacity &&
+                  lists[PROTECTED].tail != i) {
+                uint32_t demoted = lists[PROTECTED].tail;
+                unlink(demoted);
+                link_front(demoted, PROBATION);
+            }
+        }
+
+        uint32_t insert(const K &key, const V &value, size_t h, size_t w) {
+            if((count + 1) * 4 > slots.size() * 3) {
+                grow();
+            }
+            size_t mask = slots.size() - 1;
+            size_t i = h & mask;
+            while(slots[i].used) {
+                i = (i + 1) & mask;
+            }
+            slot_t &s = slots[i];
+            s.used = true;
+            s.hash = h;
+            s.weight = w;
+            s.key = key;
+            s.value = value;
+            s.referenced.store(false, memory_order_relaxed);
+            link_front(i, WINDOW);
+            ++count;
+            weight += w;
+            return i;
+        }
+
+        // (Re)schedule the entry to expire at tick 'deadline', 0 for never
+        void schedule(uint32_t i, uint32_t deadline) {
+            if(slots[i].timer_bucket != wheel_t::NO_BUCKET) {
+                wheel.remove(timer_links, i);
+            }
+            slots[i].deadline = deadline;
+            if(deadline) {
+                wheel.add(timer_links, i);
+            }
+        }
+
+        // Reclaim what expires by tick 'now'
+        void expire_until(uint64_t now) {
+            wheel.advance(timer_links, now, [this](uint32_t i) { expire(i); });
+        }
+
+        void expire(uint32_t i) {
+            remove(i);
+            ++expirations;
+        }
+
+        // Evict until within capacity
+        void evict() {
+            if(policy == LRU) {
+                while(weight > capacity && lists[WINDOW].tail != NIL) {
+                    evict(lists[WINDOW].tail);
+                }
+                return;
+            }
+            if(policy == CLOCK) {
+                // the list is the clock, the hand at its tail
+                while(weight > capacity && lists[WINDOW].tail != NIL) {
+                    uint32_t i = lists[WINDOW].tail;
+                    if(slots[i].referenced.load(memory_order_relaxed)) {
+                        slots[i].referenced.store(false, memory_order_relaxed);
+                        move_to_front(i);
+                    } else {
+                        evict(i);
+                    }
+                }
+                return;
+            }
+            for(;;) {
+                list_t &window = lists[WINDOW];
+                uint32_t candidate = window.tail;
+                uint32_t victim = lists[PROBATION].tail != NIL ? lists[PROBATION].tail
+                                                                : lists[PROTECTED].tail;
+                if(window.weight > window_capacity && candidate != NIL) {
+                    // the window's oldest entry has to go to the main
+                    // cache, or out
+                    if(weight <= capacity) {
+                        unlink(candidate);
+                        link_front(candidate, PROBATION);
+                    } else if(victim == NIL) {
+                        evict(candidate);
+                    } else if(sketch.frequency(slots[candidate].hash) >
+                              sketch.frequency(slots[victim].hash)) {
+                        unlink(candidate);
+                        link_front(candidate, PROBATION);
+                        evict(victim);
+                    } else {
+                        evict(candidate);
+                    }
+                    continue;
+                }
+                if(weight <= capacity) {
+                    break;
+                }
+                evict(victim != NIL ? victim : candidate);
+            }
+        }
+
+        void evict(uint32_t i) {
+            remove(i);
+            ++evictions;
+        }
+
+        void remove(uint32_t i) {
+            if(slots[i].timer_bucket != wheel_t::NO_BUCKET) {
+                wheel.remove(timer_links, i);
+            }
+            unlink(i);
+            --count;
+            weight -= slots[i].weight;
+            slots[i].used = false;
+            // Backward shift: move later entries of the probe sequence
+            // into the hole unless that would put them before their home.
+            size_t mask = slots.size() - 1;
+            for(size_t j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask) {
+                size_t home = slots[j].hash & mask;
+                // can j move to i, i.e. is home cyclically outside (i, j]?
+                if(((j - home) & mask) >= ((j - i) & mask)) {
+                    move(j, i);
+                    i = j;
+                }
+            }
+            slots[i] = slot_t();
+        }
+
+        void move_to_front(uint32_t i) {
+            list_t &l = lists[slots[i].queue];
+            if(l.head != i) {
+                uint8_t q = slots[i].queue;
+                unlink(i);
+                link_front(i, q);
+            }
+        }
+
+        void link_front(uint32_t i, uint8_t q) {
+            list_t &l = lists[q];
+            slots[i].queue = q;
+            slots[i].prev = NIL;
+            slots[i].next = l.head;
+            if(l.head != NIL) {
+                slots[l.head].prev = i;
+            } else {
+                l.tail = i;
+            }
+            l.head = i;
+            l.weight += slots[i].weight;
+        }
+
+        void unlink(uint32_t i) {
+            slot_t &s = slots[i];
+            list_t &l = lists[s.queue];
+            if(s.prev != NIL) {
+                slots[s.prev].next = s.next;
+            } else {
+                l.head = s.next;
+            }
+            if(s.next != NIL) {
+                slots[s.next].prev = s.prev;
+            } else {
+                l.tail = s.prev;
+            }
+            l.weight -= s.weight;
+        }
+
+        // Move the entry in 'from' to the empty slot 'to', keeping its
+        // place in its list.
+        void move(uint32_t from, uint32_t to) {
+            slots[to] = std::move(slots[from]);
+            slots[from].used = false;
+            slot_t &s = slots[to];
+            list_t &l = lists[s.queue];
+            if(s.prev != NIL) {
+                slots[s.prev].next = to;
+            } else {
+                l.head = to;
+            }
+            if(s.next != NIL) {
+                slots[s.next].prev = to;
+            } else {
+                l.tail = to;
+            }
+            if(s.timer_bucket != wheel_t::NO_BUCKET) {
+                wheel.moved(timer_links, to);
+            }
+        }
+
+        // Double the table, keeping the order of the lists.
+        void grow() {
+            vector<slot_t> old(slots.size() * 2);
+            old.swap(slots);
+            size_t mask = slots.size() - 1;
+            for(uint8_t q = 0; q < QUEUES; ++q) {
+                uint32_t i = lists[q].tail;
+                lists[q] = list_t();
+                while(i != NIL) {
+                    slot_t &o = old[i];
+                    size_t j = o.hash & mask;
+                    while(slots[j].used) {
+                        j = (j + 1) & mask;
+                    }
+                    uint32_t prev = o.prev;
+                    slots[j] = std::move(o);
+                    link_front(j, q);
+                    i = prev;
+                }
+            }
+            if(policy == TINY_LFU) {
+                sketch.resize(slots.size());
+            }
+            // every entry moved: put them on the wheel again
+            wheel.clear(wheel.now());
+            for(uint32_t i = 0; i < slots.size(); ++i) {
+                if(slots[i].timer_bucket != wheel_t::NO_BUCKET) {
+                    wheel.add(timer_links, i);
+                }
+            }
+        }
+
+        shared_timed_mutex m;
+        policy_t policy;
+        vector<slot_t> slots;
+        timer_links_t timer_links;
+        wheel_t wheel;
+        list_t lists[QUEUES];
+        size_t capacity;
+        size_t window_capacity;
+        size_t protected_capacity;
+        size_t count;
+        size_t weight;
+        sketch_t sketch;
+        // atomic since CLOCK hits and misses only hold a shared lock
+        atomic<uint64_t> hits;
+        atomic<uint64_t> misses;
+        uint64_t evictions;
+        uint64_t expirations;
+    };
+
+    // std::hash is often the identity; spread it over all the bits
+    // since the low ones pick the slot and the high ones the shard.
+    size_t hash_of(const K &key) const {
+        return hash_mix64(Hash()(key));
+    }
+
+    shard_t &shard_of(size_t h) const {
+        return *shards[shard_bits ? h >> (64 - shard_bits) : 0];
+    }
+
+    uint64_t now_ms() const {
+        if(clock) {
+            return clock();
+        }
+        return chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // The time in ticks of 'resolution' since the cache was made, from 1
+    // so that a deadline of 0 can mean none.
+    uint64_t ticks() const {
+        return (now_ms() - start) / resolution + 1;
+    }
+
+    // The first tick that starts after 'ttl' from now, so that entries
+    // never expire early
+    uint32_t deadline_of(chrono::milliseconds ttl) const {
+        return min<uint64_t>((now_ms() + ttl.count() - start) / resolution + 2, UINT32_MAX);
+    }
+
+    bool expired(const slot_t &s) const {
+        return s.deadline && s.deadline <= ticks();
+    }
+
+    void tick(chrono::milliseconds interval) {
+        unique_lock<mutex> lock(ticker_m);
+        while(!ticker_cv.wait_for(lock, interval, [this] { return stopping; })) {
+            lock.unlock();
+            expire();
+            lock.lock();
+        }
+    }
+
+    weigher_t weigher;
+    chrono::milliseconds default_ttl;
+    uint64_t resolution;
+    function<uint64_t()> clock;
+    uint64_t start;
+    size_t shard_bits;
+    vector<shard_t *> shards;
+
+    thread ticker;
+    mutex ticker_m;
+    condition_variable ticker_cv;
+    bool stopping;
+};
+#endif /* LRU_CACHE_HPP */
@@ -4,16 +4,21 @@
  * set(key, value)
  */
 
+#include "lru-cache.hpp"
+
+// The int -> int interface on top of lru_cache (lru-cache.hpp), with one
+// shard so that eviction is exactly LRU.
 class LRUCache {
 public:
     LRUCache(int capacity)
-        :capacity(capacity) {}
+        :cache(capacity, single_shard()) {}
 
     // return -1 if not exist
     int get(int key) 
     {
-        if(contains(dict, key)) {
-            return *dict[key];
+        int value;
+        if(cache.get(key, value)) {
+            return value;
         } else {
             return -1;
         }
@@ -21,37 +26,21 @@ public:
 
     void set(int key, int value) 
     {
-        if(contains(dict, key)) {
-            *dict[key] = value;
-            move_to_front(key);
-        } else {
-            mtf.push_front(value);
-            dict[key] = mtf.front();
-        }
-        evict_older();
+        cache.set(key, value);
     }
 
-    void move_to_front(int key) 
-    {
-        mtf.splice(mtf.front(), mtf, dict[key]);
-        dict[key] = mtf.front();
-    }
-
-    // is it worth evicting half-of-the-size?
-    void evict_older()
+private:
+    static lru_cache<int, int>::options_t single_shard()
     {
-        while(mtf.size() > capacity) {
-            mtf.erase(mtf.back());
-        }
+        lru_cache<int, int>::options_t options;
+        options.shards = 1;
+        return options;
     }
 
-private:
-    int capacity;
-    list<int> mtf;
-    typedef list<int>::iterator mtf_it;
-    map<int, move_to_front_it> dict;
+    lru_cache<int, int> cache;
 };
 
-// a more general LRU cache can be made up of [key, entry], in which the entry
-// contains a timestamp. While evicting (half-of-the-size), build a heap in a
-// vector(of the size-to-delete) using std::push_heap as well as filter down.
+// The map + list version needed two allocations per entry, and evicting
+// half of the cache at once (building a heap of timestamps to find the
+// oldest half) would only have amortized the list updates. lru_cache keeps
+// the list inside its hash table slots instead, and shards it for threads.
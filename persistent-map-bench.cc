@@ -0,0 +1,91 @@
+// Forking a state and changing a little of it: a copy of a std::map (as
+// arena_map_t is, ordered) against a persistent_map_t.
+//
+// usage: persistent-map-bench [entries [forks [updates]]]
+//
+// Fills a map with 'entries' (100000) pointers to ints, then 'forks'
+// (1000) times copies it and sets 'updates' (10) random keys in the copy,
+// as an analysis does at a branch; then compares the copy with the
+// original, as a join would. Reports microseconds per fork and per
+// compare, and the differences found (the same for both).
+
+#include "persistent-map.hpp"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<class Map, class Diff>
+static void run(const char *name, const vector<const int *> &keys, int forks, int updates,
+                Diff diff)
+{
+    Map base;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        base[keys[i]] = (int)i;
+    }
+    mt19937 rng(1);
+    double fork = 0, compare = 0;
+    size_t found = 0;
+    for(int f = 0; f < forks; ++f) {
+        double start = now();
+        Map copy(base);
+        for(int u = 0; u < updates; ++u) {
+            copy[keys[rng() % keys.size()]] = -1 - u;
+        }
+        fork += now() - start;
+
+        start = now();
+        found += diff(copy, base);
+        compare += now() - start;
+    }
+    printf("%-12s %12.2f %12.2f %10zu\n", name, fork * 1e6 / forks, compare * 1e6 / forks, found);
+}
+
+typedef map<const int *, int> ordered_t;
+typedef persistent_map_t<const int *, int> persistent_t;
+
+static size_t diff_ordered(const ordered_t &a, const ordered_t &b)
+{
+    size_t n = 0;
+    for(ordered_t::const_iterator i = a.begin(), j = b.begin(); i != a.end(); ++i, ++j) {
+        n += i->second != j->second;
+    }
+    return n;
+}
+
+static size_t diff_persistent(const persistent_t &a, const persistent_t &b)
+{
+    size_t n = 0;
+    a.diff(b, [&](const int *, const int *, const int *) {
+        ++n;
+        return true;
+    });
+    return n;
+}
+
+int main(int argc, const char **argv)
+{
+    size_t entries = argc > 1 ? atol(argv[1]) : 100000;
+    int forks = argc > 2 ? atoi(argv[2]) : 1000;
+    int updates = argc > 3 ? atoi(argv[3]) : 10;
+
+    vector<int> objects(entries);
+    vector<const int *> keys(entries);
+    for(size_t i = 0; i < entries; ++i) {
+        keys[i] = &objects[i];
+    }
+    printf("%zu entries, %d forks of %d updates\n", entries, forks, updates);
+    printf("%-12s %12s %12s %10s\n", "map", "fork-us", "compare-us", "diffs");
+    // the ordered map's diff is on the same keys: the updates do not add any
+    run<ordered_t>("std::map", keys, forks, updates, diff_ordered);
+    run<persistent_t>("persistent", keys, forks, updates, diff_persistent);
+    return 0;
+}
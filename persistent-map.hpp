@@ -0,0 +1,741 @@
+#ifndef PERSISTENT_MAP_HPP
+#define PERSISTENT_MAP_HPP
+
+#include <functional>
+#include <new>
+#include <stdint.h>
+#include <utility>
+using namespace std;
+
+#include "hash-fns.hpp"
+
+// persistent_map_t<K, V>: an unordered map whose copies share their
+// structure: copying one is a reference count increment, and an update
+// copies only the path from the root to what it changes. For states that
+// fork often and change a little after each fork.
+//
+// It is a hash array mapped trie, in the compressed layout of Steindorfer
+// and Vinju's CHAMP: each node takes 5 bits of the key's hash and has 32
+// slots, and keeps two bitmaps of them, which slots hold an entry and
+// which a child node. The entries, then the children, are stored packed
+// in the node after its header, in slot order. Keys whose 64 bit hashes
+// are all equal end up in a collision node, a plain list. A node left
+// with one entry is folded into its parent, so the same keys make the
+// same shape whatever the order of the updates.
+//
+// Updates where the path is not shared (its nodes' counts are 1) are made
+// in place when they do not change the size of a node: replacing a value,
+// or a child under a node that already has it. Otherwise the nodes on the
+// path are copied.
+//
+// diff() walks two maps side by side and skips the subtrees they share,
+// by pointer: comparing a state with one it was forked from costs what
+// was changed since, not the size of the map.
+//
+// Reference counts are not atomic: the copies of a map belong to one
+// thread. Pointers to values are valid until the next update of the map.
+template<class K, class V, class Hash = hash_t<K>, class Eq = equal_to<K> >
+class persistent_map_t {
+    enum { BITS = 5, SLOTS = 1 << BITS, HASH_BITS = 64, MAX_DEPTH = HASH_BITS / BITS + 2 };
+
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef pair<K, V> value_type;
+    typedef size_t size_type;
+
+private:
+    struct node_t {
+        int refs;
+        // which slots have an entry, which a child; 0 in a collision node
+        uint32_t datamap, nodemap;
+        // entries, children
+        uint32_t count, children;
+        bool collision;
+
+        node_t **kids() { return (node_t **)((char *)this + KIDS); }
+        node_t *const *kids() const { return (node_t *const *)((const char *)this + KIDS); }
+        value_type *entries() { return (value_type *)((char *)this + entries_offset(children)); }
+        const value_type *entries() const {
+            return (const value_type *)((const char *)this + entries_offset(children));
+        }
+        // the one entry, of a node that a parent can fold in
+        bool single() const { return count == 1 && children == 0; }
+    };
+
+    static const size_t KIDS = (sizeof(node_t) + sizeof(node_t *) - 1) & ~(sizeof(node_t *) - 1);
+
+    static size_t entries_offset(uint32_t children) {
+        size_t align = alignof(value_type);
+        return (KIDS + children * sizeof(node_t *) + align - 1) & ~(align - 1);
+    }
+
+public:
+    class const_iterator {
+    public:
+        typedef forward_iterator_tag iterator_category;
+        typedef pair<K, V> value_type;
+        typedef const value_type &reference;
+        typedef const value_type *pointer;
+        typedef ptrdiff_t difference_type;
+
+        const_iterator() : cur(NULL), depth(0) {}
+
+        const value_type &operator*() const { return *cur; }
+        const value_type *operator->() const { return cur; }
+
+        const_iterator &operator++() {
+            settle();
+            return *this;
+        }
+
+        bool operator==(const const_iterator &o) const { return cur == o.cur; }
+        bool operator!=(const const_iterator &o) const { return !(*this == o); }
+
+    private:
+        friend class persistent_map_t;
+
+        explicit const_iterator(const node_t *root) : cur(NULL), depth(0) {
+            if(root) {
+                push(root);
+                settle();
+            }
+        }
+
+        void push(const node_t *n) {
+            stack[depth].n = n;
+            stack[depth].i = 0;
+            ++depth;
+        }
+
+        // On the next entry: the rest of the node's entries, then its
+        // children's, depth first
+        void settle() {
+            while(depth) {
+                frame_t &f = stack[depth - 1];
+                if(f.i < f.n->count) {
+                    cur = &f.n->entries()[f.i++];
+                    return;
+                }
+                uint32_t kid = f.i - f.n->count;
+                if(kid < f.n->children) {
+                    ++f.i;
+                    push(f.n->kids()[kid]);
+                    continue;
+                }
+                --depth;
+            }
+            cur = NULL;
+        }
+
+        struct frame_t {
+            const node_t *n;
+            uint32_t i;
+        };
+
+        const value_type *cur;
+        frame_t stack[MAX_DEPTH];
+        int depth;
+    };
+
+    typedef const_iterator iterator;
+
+    persistent_map_t() : root(NULL), entries(0) {}
+
+    // O(1): the copy shares all of it
+    persistent_map_t(const persistent_map_t &o) : root(o.root), entries(o.entries) {
+        retain(root);
+    }
+
+    persistent_map_t(persistent_map_t &&o) : root(o.root), entries(o.entries) {
+        o.root = NULL;
+        o.entries = 0;
+    }
+
+    persistent_map_t &operator=(persistent_map_t o) {
+        swap(o);
+        return *this;
+    }
+
+    ~persistent_map_t() { release(root); }
+
+    void swap(persistent_map_t &o) {
+        std::swap(root, o.root);
+        std::swap(entries, o.entries);
+    }
+
+    const_iterator begin() const { return const_iterator(root); }
+    const_iterator end() const { return const_iterator(); }
+
+    size_t size() const { return entries; }
+    bool empty() const { return entries == 0; }
+
+    // The value for k, NULL if none
+    const V *lookup(const K &k) const {
+        const value_type *e = find_from(root, hasher(k), 0, k);
+        return e ? &e->second : NULL;
+    }
+
+    // An iterator on k's entry, whose stack is the path down to it
+    const_iterator find(const K &k) const {
+        const_iterator it;
+        uint64_t h = hasher(k);
+        const node_t *n = root;
+        for(unsigned shift = 0; n; shift += BITS) {
+            it.push(n);
+            uint32_t &next = it.stack[it.depth - 1].i;
+            if(n->collision) {
+                for(uint32_t i = 0; i < n->count; ++i) {
+                    if(eq(n->entries()[i].first, k)) {
+                        next = i + 1;
+                        it.cur = &n->entries()[i];
+                        return it;
+                    }
+                }
+                break;
+            }
+            uint32_t bit = 1u << slot(h, shift);
+            if(n->datamap & bit) {
+                uint32_t i = index(n->datamap, bit);
+                if(!eq(n->entries()[i].first, k)) {
+                    break;
+                }
+                next = i + 1;
+                it.cur = &n->entries()[i];
+                return it;
+            }
+            if(!(n->nodemap & bit)) {
+                break;
+            }
+            uint32_t j = index(n->nodemap, bit);
+            next = n->count + j + 1;
+            n = n->kids()[j];
+        }
+        return end();
+    }
+
+    size_t count(const K &k) const { return lookup(k) ? 1 : 0; }
+
+    // Whether k was added; a value already there is left
+    bool insert(const K &k, const V &v) { return set(k, v, false); }
+
+    // Whether k was added; a value already there is replaced
+    bool assign(const K &k, const V &v) { return set(k, v, true); }
+
+    // The value for k, added if need be, in nodes of this map's own
+    V &operator[](const K &k) {
+        if(V *v = lookup_own(k)) {
+            return *v;
+        }
+        const V *v = lookup(k);
+        set(k, v ? V(*v) : V(), true);
+        return *lookup_own(k);
+    }
+
+    size_t erase(const K &k) {
+        if(!lookup(k)) {
+            return 0;
+        }
+        node_t *r = erase(root, hasher(k), 0, k, root->refs == 1);
+        if(r != root) {
+            release(root);
+            root = r;
+        }
+        --entries;
+        return 1;
+    }
+
+    void clear() {
+        release(root);
+        root = NULL;
+        entries = 0;
+    }
+
+    // Whether the two are copies, with no update to either since
+    bool same(const persistent_map_t &o) const { return root == o.root; }
+
+    // f(key, mine, theirs) for each key that is in one map and not the other
+    // (the other's value NULL) or whose values are not ==, in no particular
+    // order, as long as f returns true; what the maps share is skipped.
+    // Returns whether f always did.
+    template<class F>
+    bool diff(const persistent_map_t &o, F f) const {
+        return diff_nodes(root, o.root, 0, f);
+    }
+
+    bool operator==(const persistent_map_t &o) const {
+        return entries == o.entries &&
+               diff(o, [](const K &, const V *, const V *) { return false; });
+    }
+    bool operator!=(const persistent_map_t &o) const { return !(*this == o); }
+
+private:
+    static unsigned slot(uint64_t h, unsigned shift) { return (unsigned)(h >> shift) & (SLOTS - 1); }
+
+    // the rank of 'bit' among the bits of 'map'
+    static uint32_t index(uint32_t map, uint32_t bit) { return __builtin_popcount(map & (bit - 1)); }
+
+    static void retain(node_t *n) {
+        if(n) {
+            ++n->refs;
+        }
+    }
+
+    static void release(node_t *n) {
+        if(!n || --n->refs) {
+            return;
+        }
+        value_type *e = n->entries();
+        for(uint32_t i = 0; i < n->count; ++i) {
+            e[i].~value_type();
+        }
+        for(uint32_t i = 0; i < n->children; ++i) {
+            release(n->kids()[i]);
+        }
+        ::operator delete(n);
+    }
+
+    // A node being made: the entries go in first, one by one, and if one
+    // throws, those made go with the node; then the children, which cannot
+    // throw, and done() hands it over
+    class builder_t {
+    public:
+        builder_t(uint32_t datamap, uint32_t nodemap, uint32_t count, uint32_t children,
+                  bool collision = false)
+            : n((node_t *)::operator new(entries_offset(children) + count * sizeof(value_type))),
+              made(0) {
+            n->refs = 1;
+            n->datamap = datamap;
+            n->nodemap = nodemap;
+            n->count = count;
+            n->children = children;
+            n->collision = collision;
+        }
+
+        ~builder_t() {
+            if(n) {
+                for(uint32_t i = 0; i < made; ++i) {
+                    n->entries()[i].~value_type();
+                }
+                ::operator delete(n);
+            }
+        }
+
+        void add(const value_type &e) {
+            new(n->entries() + made) value_type(e);
+            ++made;
+        }
+
+        void add(const K &k, const V &v) {
+            new(n->entries() + made) value_type(k, v);
+            ++made;
+        }
+
+        // kid i, with a reference of its own
+        void kid(uint32_t i, node_t *kid) { n->kids()[i] = kid; }
+
+        node_t *done() {
+            node_t *r = n;
+            n = NULL;
+            return r;
+        }
+
+    private:
+        node_t *n;
+        uint32_t made;
+    };
+
+    // Owns a reference until taken
+    struct hold_t {
+        explicit hold_t(node_t *n) : n(n) {}
+        ~hold_t() { release(n); }
+        node_t *take() {
+            node_t *r = n;
+            n = NULL;
+            return r;
+        }
+        node_t *n;
+    };
+
+    // n's children from 'from' on, into b's from 'to' on, retained
+    static void copy_kids(builder_t &b, const node_t *n, uint32_t from, uint32_t to,
+                          uint32_t count) {
+        for(uint32_t i = 0; i < count; ++i) {
+            node_t *kid = n->kids()[from + i];
+            retain(kid);
+            b.kid(to + i, kid);
+        }
+    }
+
+    static const value_type *find_from(const node_t *n, uint64_t h, unsigned shift, const K &k) {
+        Eq eq;
+        for(; n; shift += BITS) {
+            if(n->collision) {
+                for(uint32_t i = 0; i < n->count; ++i) {
+                    if(eq(n->entries()[i].first, k)) {
+                        return &n->entries()[i];
+                    }
+                }
+                return NULL;
+            }
+            uint32_t bit = 1u << slot(h, shift);
+            if(n->datamap & bit) {
+                const value_type &e = n->entries()[index(n->datamap, bit)];
+                return eq(e.first, k) ? &e : NULL;
+            }
+            if(!(n->nodemap & bit)) {
+                return NULL;
+            }
+            n = n->kids()[index(n->nodemap, bit)];
+        }
+        return NULL;
+    }
+
+    // The value for k if the path to it is this map's alone
+    V *lookup_own(const K &k) {
+        uint64_t h = hasher(k);
+        node_t *n = root;
+        for(unsigned shift = 0; n && n->refs == 1; shift += BITS) {
+            if(n->collision) {
+                for(uint32_t i = 0; i < n->count; ++i) {
+                    if(eq(n->entries()[i].first, k)) {
+                        return &n->entries()[i].second;
+                    }
+                }
+                return NULL;
+            }
+            uint32_t bit = 1u << slot(h, shift);
+            if(n->datamap & bit) {
+                value_type &e = n->entries()[index(n->datamap, bit)];
+                return eq(e.first, k) ? &e.second : NULL;
+            }
+            if(!(n->nodemap & bit)) {
+                return NULL;
+            }
+            n = n->kids()[index(n->nodemap, bit)];
+        }
+        return NULL;
+    }
+
+    bool set(const K &k, const V &v, bool overwrite) {
+        uint64_t h = hasher(k);
+        bool added = false;
+        if(!root) {
+            builder_t b(1u << slot(h, 0), 0, 1, 0);
+            b.add(k, v);
+            root = b.done();
+            added = true;
+        } else {
+            node_t *r = set(root, h, 0, k, v, overwrite, root->refs == 1, added);
+            if(r != root) {
+                release(root);
+                root = r;
+            }
+        }
+        entries += added;
+        return added;
+    }
+
+    // What goes in place of n, with k set in it. n itself if it was
+    // changed in place or not at all, else a node of its own: the caller
+    // drops n then. 'own': whether the path down to n is this map's alone.
+    node_t *set(node_t *n, uint64_t h, unsigned shift, const K &k, const V &v, bool overwrite,
+                bool own, bool &added) {
+        own = own && n->refs == 1;
+        if(n->collision) {
+            return set_collision(n, k, v, overwrite, own, added);
+        }
+        uint32_t bit = 1u << slot(h, shift);
+        if(n->datamap & bit) {
+            uint32_t i = index(n->datamap, bit);
+            value_type &e = n->entries()[i];
+            if(eq(e.first, k)) {
+                if(!overwrite) {
+                    return n;
+                }
+                if(own) {
+                    e.second = v;
+                    return n;
+                }
+                return with_value(n, i, v);
+            }
+            // both down a level
+            hold_t sub(merge(e, hasher(e.first), k, v, h, shift + BITS));
+            uint32_t j = index(n->nodemap, bit);
+            builder_t b(n->datamap & ~bit, n->nodemap | bit, n->count - 1, n->children + 1);
+            for(uint32_t x = 0; x < n->count; ++x) {
+                if(x != i) {
+                    b.add(n->entries()[x]);
+                }
+            }
+            copy_kids(b, n, 0, 0, j);
+            b.kid(j, sub.take());
+            copy_kids(b, n, j, j + 1, n->children - j);
+            added = true;
+            return b.done();
+        }
+        if(n->nodemap & bit) {
+            uint32_t j = index(n->nodemap, bit);
+            node_t *kid = n->kids()[j];
+            node_t *r = set(kid, h, shift + BITS, k, v, overwrite, own, added);
+            if(r == kid) {
+                return n;
+            }
+            if(own) {
+                n->kids()[j] = r;
+                release(kid);
+                return n;
+            }
+            return with_kid(n, j, r);
+        }
+        uint32_t i = index(n->datamap, bit);
+        builder_t b(n->datamap | bit, n->nodemap, n->count + 1, n->children);
+        for(uint32_t x = 0; x < i; ++x) {
+            b.add(n->entries()[x]);
+        }
+        b.add(k, v);
+        for(uint32_t x = i; x < n->count; ++x) {
+            b.add(n->entries()[x]);
+        }
+        copy_kids(b, n, 0, 0, n->children);
+        added = true;
+        return b.done();
+    }
+
+    node_t *set_collision(node_t *n, const K &k, const V &v, bool overwrite, bool own,
+                          bool &added) {
+        for(uint32_t i = 0; i < n->count; ++i) {
+            value_type &e = n->entries()[i];
+            if(eq(e.first, k)) {
+                if(!overwrite) {
+                    return n;
+                }
+                if(own) {
+                    e.second = v;
+                    return n;
+                }
+                return with_value(n, i, v);
+            }
+        }
+        builder_t b(0, 0, n->count + 1, 0, true);
+        for(uint32_t i = 0; i < n->count; ++i) {
+            b.add(n->entries()[i]);
+        }
+        b.add(k, v);
+        added = true;
+        return b.done();
+    }
+
+    // A copy of n with the value of entry i replaced
+    static node_t *with_value(const node_t *n, uint32_t i, const V &v) {
+        builder_t b(n->datamap, n->nodemap, n->count, n->children, n->collision);
+        for(uint32_t x = 0; x < n->count; ++x) {
+            if(x == i) {
+                b.add(n->entries()[x].first, v);
+            } else {
+                b.add(n->entries()[x]);
+            }
+        }
+        copy_kids(b, n, 0, 0, n->children);
+        return b.done();
+    }
+
+    // A copy of n with child j replaced by 'kid', whose reference it takes
+    static node_t *with_kid(const node_t *n, uint32_t j, node_t *kid) {
+        hold_t hold(kid);
+        builder_t b(n->datamap, n->nodemap, n->count, n->children);
+        for(uint32_t x = 0; x < n->count; ++x) {
+            b.add(n->entries()[x]);
+        }
+        copy_kids(b, n, 0, 0, j);
+        b.kid(j, hold.take());
+        copy_kids(b, n, j + 1, j + 1, n->children - j - 1);
+        return b.done();
+    }
+
+    // A node at 'shift' with the two entries
+    static node_t *merge(const value_type &e, uint64_t eh, const K &k, const V &v, uint64_t h,
+                         unsigned shift) {
+        if(shift >= HASH_BITS) {
+            builder_t b(0, 0, 2, 0, true);
+            b.add(e);
+            b.add(k, v);
+            return b.done();
+        }
+        uint32_t ebit = 1u << slot(eh, shift), bit = 1u << slot(h, shift);
+        if(ebit == bit) {
+            hold_t sub(merge(e, eh, k, v, h, shift + BITS));
+            builder_t b(0, bit, 0, 1);
+            b.kid(0, sub.take());
+            return b.done();
+        }
+        builder_t b(ebit | bit, 0, 2, 0);
+        if(ebit < bit) {
+            b.add(e);
+            b.add(k, v);
+        } else {
+            b.add(k, v);
+            b.add(e);
+        }
+        return b.done();
+    }
+
+    // What goes in place of n, with k (which is there) gone: NULL if
+    // nothing is left. As set().
+    node_t *erase(node_t *n, uint64_t h, unsigned shift, const K &k, bool own) {
+        own = own && n->refs == 1;
+        if(n->collision) {
+            builder_t b(0, 0, n->count - 1, 0, true);
+            for(uint32_t i = 0; i < n->count; ++i) {
+                if(!eq(n->entries()[i].first, k)) {
+                    b.add(n->entries()[i]);
+                }
+            }
+            return b.done();
+        }
+        uint32_t bit = 1u << slot(h, shift);
+        if(n->datamap & bit) {
+            if(n->single()) {
+                return NULL;
+            }
+            uint32_t i = index(n->datamap, bit);
+            builder_t b(n->datamap & ~bit, n->nodemap, n->count - 1, n->children);
+            for(uint32_t x = 0; x < n->count; ++x) {
+                if(x != i) {
+                    b.add(n->entries()[x]);
+                }
+            }
+            copy_kids(b, n, 0, 0, n->children);
+            return b.done();
+        }
+        uint32_t j = index(n->nodemap, bit);
+        node_t *kid = n->kids()[j];
+        node_t *r = erase(kid, h, shift + BITS, k, own);
+        if(r == kid) {
+            return n;
+        }
+        if(r && !r->single()) {
+            if(own) {
+                n->kids()[j] = r;
+                release(kid);
+                return n;
+            }
+            return with_kid(n, j, r);
+        }
+        // the child is down to one entry, or none: fold it in
+        hold_t hold(r);
+        uint32_t count = n->count + (r ? 1 : 0);
+        if(!count && n->children == 1) {
+            return NULL;
+        }
+        uint32_t i = index(n->datamap, bit);
+        builder_t b(r ? n->datamap | bit : n->datamap, n->nodemap & ~bit, count, n->children - 1);
+        for(uint32_t x = 0; x < n->count; ++x) {
+            if(r && x == i) {
+                b.add(r->entries()[0]);
+            }
+            b.add(n->entries()[x]);
+        }
+        if(r && i == n->count) {
+            b.add(r->entries()[0]);
+        }
+        copy_kids(b, n, 0, 0, j);
+        copy_kids(b, n, j + 1, j, n->children - j - 1);
+        return b.done();
+    }
+
+    // One side of a slot: an entry or a subtree (or neither)
+    struct side_t {
+        const value_type *e;
+        const node_t *n;
+        unsigned shift;
+
+        const value_type *find(const K &k, uint64_t h) const {
+            if(e) {
+                return Eq()(e->first, k) ? e : NULL;
+            }
+            return find_from(n, h, shift, k);
+        }
+    };
+
+    static side_t side(const node_t *n, uint32_t bit, unsigned shift) {
+        side_t s = { NULL, NULL, shift };
+        if(n->datamap & bit) {
+            s.e = &n->entries()[index(n->datamap, bit)];
+        } else if(n->nodemap & bit) {
+            s.n = n->kids()[index(n->nodemap, bit)];
+        }
+        return s;
+    }
+
+    template<class F>
+    static bool walk(const side_t &s, F f) {
+        if(s.e) {
+            return f(*s.e);
+        }
+        for(const_iterator it(s.n); it != const_iterator(); ++it) {
+            if(!f(*it)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<class F>
+    bool diff_nodes(const node_t *a, const node_t *b, unsigned shift, F &f) const {
+        if(a == b) {
+            return true;
+        }
+        if(!a || !b || a->collision || b->collision) {
+            side_t sa = { NULL, a, shift }, sb = { NULL, b, shift };
+            return diff_sides(sa, sb, f);
+        }
+        uint32_t slots = a->datamap | a->nodemap | b->datamap | b->nodemap;
+        while(slots) {
+            uint32_t bit = slots & -slots;
+            slots &= slots - 1;
+            side_t sa = side(a, bit, shift + BITS), sb = side(b, bit, shift + BITS);
+            if(sa.n && sb.n) {
+                if(!diff_nodes(sa.n, sb.n, shift + BITS, f)) {
+                    return false;
+                }
+            } else if(!diff_sides(sa, sb, f)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The keys of a slot, at least one side of which is an entry or empty:
+    // by lookup
+    template<class F>
+    bool diff_sides(const side_t &a, const side_t &b, F &f) const {
+        const Hash &hash = hasher;
+        return walk(a, [&](const value_type &x) {
+                   const value_type *y = b.find(x.first, hash(x.first));
+                   return (y && x.second == y->second) || f(x.first, &x.second, y ? &y->second : NULL);
+               }) &&
+               walk(b, [&](const value_type &y) {
+                   return a.find(y.first, hash(y.first)) || f(y.first, (const V *)NULL, &y.second);
+               });
+    }
+
+    node_t *root;
+    size_t entries;
+    Hash hasher;
+    Eq eq;
+};
+
+// An Eq for keys that an ordered map would compare with Less: equal when
+// Less orders neither before the other. The Hash has to agree, and give
+// such keys the same hash.
+template<class K, class Less>
+struct less_equiv_t {
+    bool operator()(const K &a, const K &b) const
+    {
+        return !less(a, b) && !less(b, a);
+    }
+    Less less;
+};
+
+#endif /* PERSISTENT_MAP_HPP */
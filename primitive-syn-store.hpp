@@ -1,6 +1,10 @@
 #ifndef PRIMITIVE_SYN_STORE_HPP
 #define PRIMITIVE_SYN_STORE_HPP
 
+#include <type_traits>
+
+#include "persistent-map.hpp"
+
 // class primitive_syn_store_t<T>
 //
 // A generic mapping from trees to states, with some special functions
@@ -10,9 +14,24 @@
 //
 // Template arguments are based on those for store_t<T>.
 //
+// With 'Persistent', both maps are persistent_map_t's: copying the store
+// to fork a state is O(1), and an update copies only the path to what it
+// changes, instead of all of both maps at each fork. same_as() and the
+// diff_*() functions skip what two stores still share since one was
+// forked from the other. Equivalence classes are numbered from a counter
+// then, instead of taking the first one unused. Expressions are the same
+// key when astnode_lt_t orders neither before the other, as in the
+// arena_map_t, and are hashed by KeyHash, which must give the same hash to
+// trees that astnode_lt_t finds equal; only the persistent store needs it.
+//
 template<class T,
-         class Copy = ShallowCopy<T> >
+         class Copy = ShallowCopy<T>,
+         bool Persistent = false,
+         class KeyHash = void>
 class primitive_syn_store_t {
+    static_assert(!Persistent || !is_void<KeyHash>::value,
+                  "primitive_syn_store_t: a persistent store needs a KeyHash that "
+                  "agrees with astnode_lt_t");
 public:
     /// A typedef for the data type, to use e.g. in templates
     typedef T data_type;
@@ -24,16 +43,24 @@ public:
         }
         explicit EquivClass(const T &v):refCount(1), value(v) {
         }
+        bool operator==(const EquivClass &o) const {
+            return refCount == o.refCount && value == o.value;
+        }
         int refCount;
         T value;
     };
     // a map from equivalence classes to values.
-    typedef VectorMapA<EquivClass> equiv_map;
+    typedef typename conditional<Persistent,
+                                 persistent_map_t<int, EquivClass>,
+                                 VectorMapA<EquivClass> >::type equiv_map;
     // A map from expressions to equivalence classes.
-    typedef arena_map_t<const Expression *, int, astnode_lt_t>
+    typedef typename conditional<Persistent,
+                                 persistent_map_t<const Expression *, int, KeyHash,
+                                                  less_equiv_t<const Expression *, astnode_lt_t> >,
+                                 arena_map_t<const Expression *, int, astnode_lt_t> >::type
     equiv_class_map;
 
-    typedef primitive_syn_store_t<T, Copy> this_store_t;
+    typedef primitive_syn_store_t<T, Copy, Persistent, KeyHash> this_store_t;
     typedef size_t size_type;
     typedef typename equiv_map::iterator eiterator;
     typedef std::pair<const Expression * const, eiterator> value_type;
@@ -80,7 +107,7 @@ public:
         store_type *store;
     };
     typedef iter<> iterator;
-    typedef iter<equiv_class_map::const_iterator, const this_store_t, typename equiv_map::const_iterator, const T> const_iterator;
+    typedef iter<typename equiv_class_map::const_iterator, const this_store_t, typename equiv_map::const_iterator, const T> const_iterator;
 
     // Iterator to iterate over all the values. Doesn't give access to
     // the expressions.
@@ -117,6 +144,8 @@ public:
     typedef value_iter<> value_iterator;
     typedef value_iter<typename equiv_map::const_iterator, const T> const_value_iterator;
 
+    primitive_syn_store_t() : next_equiv_class(0) {}
+
     // Remove dangling references in equiv_map to ensure that every
     // equivalence class in the range of 'equiv_map' is in the domain
     // of 'valueof'.  Also ensure that the reference counts are right.
@@ -159,7 +188,7 @@ public:
         const T& state,
         int &ec) {
         if(!contains(equiv_class, t)) {
-            ec = valueof.first_unmapped_key();
+            ec = fresh_equiv_class();
             equiv_class[t] = ec;
             valueof[ec] = EquivClass(state);
         } else {
@@ -370,12 +399,79 @@ public:
 
     const equiv_map &get_valueof_map() const;
 
+    // Whether 'other' maps the same trees to the same classes, with the
+    // same values
+    bool same_as(const this_store_t &other) const {
+        return equiv_class == other.equiv_class && valueof == other.valueof;
+    }
+
+    // For joins: f(t, ec, other_ec) for each tree whose class is not the
+    // same in 'other', -1 where one of them does not map it
+    template<class F>
+    void diff_equiv_classes(const this_store_t &other, F f) const {
+        diff_maps(equiv_class, other.equiv_class,
+                  [&](const Expression *t, const int *ec, const int *other_ec) {
+                      f(t, ec ? *ec : -1, other_ec ? *other_ec : -1);
+                      return true;
+                  },
+                  integral_constant<bool, Persistent>());
+    }
+
+    // f(ec, mine, theirs) for each equivalence class whose EquivClass is
+    // not the same in 'other', NULL where one of them does not have it
+    template<class F>
+    void diff_values(const this_store_t &other, F f) const {
+        diff_maps(valueof, other.valueof,
+                  [&](int ec, const EquivClass *mine, const EquivClass *theirs) {
+                      f(ec, mine, theirs);
+                      return true;
+                  },
+                  integral_constant<bool, Persistent>());
+    }
+
 protected:
+    // A class number not in use
+    int fresh_equiv_class() {
+        return fresh_equiv_class(integral_constant<bool, Persistent>());
+    }
+    int fresh_equiv_class(false_type) {
+        return valueof.first_unmapped_key();
+    }
+    int fresh_equiv_class(true_type) {
+        return next_equiv_class++;
+    }
+
+    // Persistent: only what the maps do not share
+    template<class Map, class F>
+    static void diff_maps(const Map &a, const Map &b, F f, true_type) {
+        a.diff(b, f);
+    }
+
+    // Otherwise, all of both
+    template<class Map, class F>
+    static void diff_maps(const Map &a, const Map &b, F f, false_type) {
+        foreach(it, a) {
+            typename Map::const_iterator o = b.find(it->first);
+            if(o == b.end()) {
+                f(it->first, &it->second, NULL);
+            } else if(!(it->second == o->second)) {
+                f(it->first, &it->second, &o->second);
+            }
+        }
+        foreach(it, b) {
+            if(a.find(it->first) == a.end()) {
+                f(it->first, NULL, &it->second);
+            }
+        }
+    }
 
     // Mapping from trees to equivalance class (int)
     equiv_class_map equiv_class;
 
     // Mapping from equivalence class to value
     equiv_map valueof;
+
+    // Persistent: the next class fresh_equiv_class() hands out
+    int next_equiv_class;
 };
 #endif
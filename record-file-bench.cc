@@ -0,0 +1,118 @@
+// Getting at record n of a dump: streaming through a plain Flatten file to
+// it, against record-file.hpp's lookup, and decoding all of a record file
+// in threads.
+//
+// usage: record-file-bench [records [threads [path]]]
+//
+// Writes 'records' (2M by default) records, as flatten-bench's, to 'path'
+// (/tmp/record-file-bench) and to 'path'.flat, then reports
+//   stream   the time to read records up to the middle one, as Flatten
+//            must
+//   seek     the time per read of a random record
+//   all      the time to decode the whole file, with 1, 2, 4 ... 'threads'
+//            (the cores) threads
+// The files are in the page cache: it is the decoding that is timed.
+
+#include "flatten-fields.hpp"
+#include "record-file.hpp"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct record_t {
+    uint64_t id;
+    int64_t time;
+    int32_t line;
+    uint32_t count;
+    uint16_t kind;
+    string file;
+    vector<uint32_t> events;
+
+    FLATTEN_FIELDS(record_t, id, time, line, count, kind, file, events)
+};
+
+int main(int argc, const char **argv)
+{
+    size_t n = argc > 1 ? atol(argv[1]) : 2000000;
+    unsigned max_threads = argc > 2 ? atoi(argv[2]) : thread::hardware_concurrency();
+    string path = argc > 3 ? argv[3] : "/tmp/record-file-bench";
+    string flat_path = path + ".flat";
+
+    mt19937_64 rng(1);
+    geometric_distribution<int> small(0.3);
+    uniform_int_distribution<int> line(1, 5000), file_len(10, 40);
+    double start = now();
+    {
+        record_file_writer_t writer(path);
+        FileFlatten flat(flat_path, false);
+        record_t r;
+        for(size_t i = 0; i < n; ++i) {
+            r.id = i;
+            r.time = line(rng) - 2500;
+            r.line = line(rng);
+            r.count = small(rng);
+            r.kind = (uint16_t)small(rng);
+            r.file.assign(file_len(rng), 'a' + i % 26);
+            r.events.resize(small(rng));
+            for(size_t e = 0; e < r.events.size(); ++e) {
+                r.events[e] = line(rng);
+            }
+            writer.append(r);
+            r.xferFields(flat);
+        }
+        writer.close();
+        flat.close();
+    }
+    printf("%zu records, written in %.2f s\n", n, now() - start);
+
+    record_t r;
+    size_t middle = n / 2;
+    start = now();
+    {
+        FileFlatten flat(flat_path, true);
+        for(size_t i = 0; i <= middle; ++i) {
+            r.xferFields(flat);
+        }
+    }
+    double stream = now() - start;
+    if(r.id != middle) {
+        printf("stream: MISMATCH\n");
+    }
+    printf("stream   %12.0f us to record %zu\n", stream * 1e6, middle);
+
+    record_file_t file(path);
+    enum { SEEKS = 100000 };
+    uniform_int_distribution<uint64_t> which(0, n - 1);
+    bool ok = true;
+    start = now();
+    for(int i = 0; i < SEEKS; ++i) {
+        uint64_t k = which(rng);
+        file.read(k, r);
+        ok &= r.id == k;
+    }
+    double seek = now() - start;
+    printf("seek     %12.3f us a record, %zu blocks of %u%s\n", seek * 1e6 / SEEKS,
+           file.blocks(), file.records_per_block(), ok ? "" : "   MISMATCH");
+
+    // once first, so that the records' strings are there to decode into
+    vector<record_t> all;
+    file.read_all(all, 1);
+    for(unsigned threads = 1; threads <= max(max_threads, 1u); threads *= 2) {
+        start = now();
+        file.read_all(all, threads);
+        double t = now() - start;
+        printf("all      %12.0f us, %u threads, %.1f M records/s%s\n", t * 1e6, threads,
+               n / t / 1e6, all.size() == n && all[n - 1].id == n - 1 ? "" : "   MISMATCH");
+    }
+    return 0;
+}
@@ -0,0 +1,330 @@
+#ifndef RECORD_FILE_HPP
+#define RECORD_FILE_HPP
+
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "flatten.hpp"
+
+// A file of records, each xferGeneric'ed as a Flatten would, that can be
+// read from any record on without reading what comes before it:
+//
+//   block 0 .. block B-1  records_per_block records each (the last one
+//                         what is left): the records, then a uint32 per
+//                         record, its offset in the block
+//   index                 a uint64 per block, its offset in the file
+//   footer (32 bytes)     uint64 records, uint64 offset of the index,
+//                         uint32 records_per_block, uint32 version,
+//                         "RECFILE" and a 0
+// All integers little endian, as xferInt writes them.
+//
+// Record n is in block n / records_per_block, so a read is two lookups and
+// the decode of the record, from the file mmap'ed by a FileFlatten.
+// Reading is const and can go on in any number of threads; read_all()
+// decodes the blocks across threads itself.
+
+class record_file_writer_t
+{
+public:
+    enum { RECORDS_PER_BLOCK = 1024 };
+
+    record_file_writer_t(const string &path, uint32_t records_per_block = RECORDS_PER_BLOCK)
+        : file(path, false), per_block(records_per_block ? records_per_block : 1), records(0),
+          written(0), closed(false), flat(block, false)
+    {
+    }
+
+    ~record_file_writer_t()
+    {
+        try {
+            close();
+        } catch(const runtime_error &) {
+            // close() to know
+        }
+    }
+
+    template<class T>
+    void append(T &record)
+    {
+        offsets.push_back(check32(flat.written()));
+        xferGeneric(flat, record);
+        ++records;
+        if(offsets.size() == per_block) {
+            end_block();
+        }
+    }
+
+    uint64_t size() const
+    {
+        return records;
+    }
+
+    // The last block, the index and the footer; throws if they did not
+    // make it to the file
+    void close()
+    {
+        if(closed) {
+            return;
+        }
+        closed = true;
+        if(!offsets.empty()) {
+            end_block();
+        }
+        uint64_t index = written;
+        for(size_t i = 0; i < index_.size(); ++i) {
+            file.xferUint64(index_[i]);
+        }
+        uint32_t version = VERSION;
+        file.xferUint64(records);
+        file.xferUint64(index);
+        file.xferUint32(per_block);
+        file.xferUint32(version);
+        file.xferFullBlock((char *)magic(), 8);
+        file.close();
+    }
+
+    enum { VERSION = 1, FOOTER_SIZE = 32 };
+
+    // 8 bytes, the 0 included
+    static const char *magic()
+    {
+        return "RECFILE";
+    }
+
+private:
+    record_file_writer_t(const record_file_writer_t &);
+    record_file_writer_t &operator=(const record_file_writer_t &);
+
+    void end_block()
+    {
+        index_.push_back(written);
+        for(size_t i = 0; i < offsets.size(); ++i) {
+            flat.xferUint32(offsets[i]);
+        }
+        flat.flush();
+        file.xferFullBlock(&block[0], block.size());
+        written += block.size();
+        flat.clear();
+        offsets.clear();
+    }
+
+    static uint32_t check32(size_t offset)
+    {
+        if(offset > UINT32_MAX) {
+            throw runtime_error("record_file_writer_t: block over 4GB");
+        }
+        return (uint32_t)offset;
+    }
+
+    FileFlatten file;
+    uint32_t per_block;
+    uint64_t records;
+    // bytes in the file, before the current block
+    uint64_t written;
+    bool closed;
+    // the current block, its records' offsets; one StringFlatten writes all
+    // of a block, growing it by doubling
+    string block;
+    vector<uint32_t> offsets;
+    StringFlatten flat;
+    // the offset of each block written
+    vector<uint64_t> index_;
+};
+
+class record_file_t
+{
+public:
+    explicit record_file_t(const string &path) : file(path, true), records(0), per_block(1)
+    {
+        file_size = file.size();
+        data = file.readInPlace(file_size);
+        if(file_size < record_file_writer_t::FOOTER_SIZE) {
+            corrupt("too short");
+        }
+        const char *footer = data + file_size - record_file_writer_t::FOOTER_SIZE;
+        records = load<uint64_t>(footer);
+        index = load<uint64_t>(footer + 8);
+        per_block = load<uint32_t>(footer + 16);
+        if(load<uint32_t>(footer + 20) != record_file_writer_t::VERSION ||
+           memcmp(footer + 24, record_file_writer_t::magic(), 8) != 0) {
+            corrupt("not a record file");
+        }
+        if(!per_block) {
+            corrupt("no records per block");
+        }
+        block_count = (records + per_block - 1) / per_block;
+        uint64_t index_end = file_size - record_file_writer_t::FOOTER_SIZE;
+        if(index > index_end || (index_end - index) / 8 != block_count ||
+           (index_end - index) % 8) {
+            corrupt("bad index");
+        }
+        // blocks in order, each with room for its offsets
+        uint64_t last = 0;
+        for(size_t b = 0; b < block_count; ++b) {
+            uint64_t start = block_start(b);
+            if(start < last || block_end(b) < start ||
+               block_end(b) - start < (uint64_t)block_records(b) * 4) {
+                corrupt("bad block");
+            }
+            last = start;
+        }
+        madvise((void *)data, file_size, MADV_RANDOM);
+    }
+
+    uint64_t size() const
+    {
+        return records;
+    }
+
+    size_t blocks() const
+    {
+        return block_count;
+    }
+
+    uint32_t records_per_block() const
+    {
+        return per_block;
+    }
+
+    // Record n, n < size()
+    template<class T>
+    void read(uint64_t n, T &record) const
+    {
+        if(n >= records) {
+            throw out_of_range("record_file_t: no such record");
+        }
+        size_t b = (size_t)(n / per_block);
+        read_record(b, block_start(b), block_records(b), (uint32_t)(n % per_block), record);
+    }
+
+    // The records of block b, in order
+    template<class T>
+    void read_block(size_t b, vector<T> &out) const
+    {
+        uint32_t count = block_records(b);
+        out.resize(count);
+        read_records(b, &out[0]);
+    }
+
+    // All the records, the blocks decoded by 'threads' threads
+    template<class T>
+    void read_all(vector<T> &out, unsigned threads = thread::hardware_concurrency()) const
+    {
+        out.resize(records);
+        threads = (unsigned)min<uint64_t>(max(threads, 1u), block_count);
+        if(threads <= 1) {
+            for(size_t b = 0; b < block_count; ++b) {
+                read_records(b, &out[(size_t)b * per_block]);
+            }
+            return;
+        }
+        madvise((void *)data, file_size, MADV_SEQUENTIAL);
+        atomic<size_t> next(0);
+        exception_ptr error;
+        atomic<bool> failed(false);
+        vector<thread> pool;
+        for(unsigned t = 0; t < threads; ++t) {
+            pool.push_back(thread([&]() {
+                try {
+                    for(size_t b; !failed && (b = next++) < block_count;) {
+                        read_records(b, &out[(size_t)b * per_block]);
+                    }
+                } catch(...) {
+                    if(!failed.exchange(true)) {
+                        error = current_exception();
+                    }
+                }
+            }));
+        }
+        for(unsigned t = 0; t < threads; ++t) {
+            pool[t].join();
+        }
+        madvise((void *)data, file_size, MADV_RANDOM);
+        if(error) {
+            rethrow_exception(error);
+        }
+    }
+
+private:
+    template<class T>
+    static T load(const char *p)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        uint64_t u = 0;
+        for(size_t i = 0; i < sizeof(T); ++i) {
+            u |= (uint64_t)(unsigned char)p[i] << (8 * i);
+        }
+        return (T)u;
+#else
+        T v;
+        memcpy(&v, p, sizeof(T));
+        return v;
+#endif
+    }
+
+    uint64_t block_start(size_t b) const
+    {
+        return load<uint64_t>(data + index + 8 * b);
+    }
+
+    uint64_t block_end(size_t b) const
+    {
+        return b + 1 < block_count ? block_start(b + 1) : index;
+    }
+
+    uint32_t block_records(size_t b) const
+    {
+        if(b >= block_count) {
+            throw out_of_range("record_file_t: no such record");
+        }
+        return b + 1 < block_count ? per_block : (uint32_t)(records - (uint64_t)b * per_block);
+    }
+
+    template<class T>
+    void read_records(size_t b, T *out) const
+    {
+        uint64_t start = block_start(b);
+        uint32_t count = block_records(b);
+        for(uint32_t i = 0; i < count; ++i) {
+            read_record(b, start, count, i, out[i]);
+        }
+    }
+
+    // record i of the 'count' in block b, at 'start'
+    template<class T>
+    void read_record(size_t b, uint64_t start, uint32_t count, uint32_t i, T &record) const
+    {
+        uint64_t table = block_end(b) - (uint64_t)count * 4;
+        const char *offsets = data + table;
+        uint64_t begin = load<uint32_t>(offsets + 4 * i);
+        uint64_t end = i + 1 < count ? load<uint32_t>(offsets + 4 * (i + 1)) : table - start;
+        if(begin > end || end > table - start) {
+            corrupt("bad record offsets");
+        }
+        MemoryFlatten flat(data + start + begin, end - begin);
+        xferGeneric(flat, record);
+    }
+
+    void corrupt(const char *what) const
+    {
+        throw runtime_error("record_file_t: " + string(what));
+    }
+
+    FileFlatten file;
+    const char *data;
+    uint64_t file_size;
+    uint64_t records;
+    uint64_t index;
+    uint32_t per_block;
+    size_t block_count;
+};
+
+#endif
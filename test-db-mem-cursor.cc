@@ -0,0 +1,82 @@
+// db_mem_t's cursors over both indexes: scan() and prefix() against the
+// keys expected, a transaction's adds and deletes merged in, and cursors
+// copied and assigned, which must not point into each other. Build with
+// -fsanitize=address to catch a cursor reading freed memory.
+//
+// usage: test-db-mem-cursor
+
+#include "b-tree.hpp"
+#include "db-mem.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char *index, const char *what)
+{
+    if(!ok) {
+        printf("FAIL: %s: %s\n", index, what);
+        ++failures;
+    }
+}
+
+template<class Cursor>
+static string keys_of(Cursor c)
+{
+    string rv;
+    for(; c.valid(); c.next()) {
+        rv += c.key() + "=" + c.value() + " ";
+    }
+    return rv;
+}
+
+template<class Index>
+static void run(const char *index)
+{
+    typedef db_mem_t<Index> db_t;
+    db_t db;
+    db.add("a", "1", true);
+    db.add("ba", "2", true);
+    db.add("bb", "3", true);
+    db.add("bc", "4", true);
+    db.add("c", "5", true);
+
+    check(keys_of(db.scan("b", "c")) == "ba=2 bb=3 bc=4 ", index, "scan");
+    check(keys_of(db.scan("bb")) == "bb=3 bc=4 c=5 ", index, "open scan");
+    check(keys_of(db.prefix("b")) == "ba=2 bb=3 bc=4 ", index, "prefix");
+
+    // copied, assigned over, and the original stepped past where the copy is
+    typename db_t::cursor_t c = db.scan("a", "c");
+    typename db_t::cursor_t copy(c);
+    c.next();
+    check(copy.valid() && copy.key() == "a" && copy.value() == "1", index, "copy");
+    check(c.valid() && c.key() == "ba", index, "original after copy");
+    c = db.scan("bb", "c");
+    check(c.valid() && c.key() == "bb" && c.value() == "3", index, "assign");
+    copy = c;
+    c.next();
+    check(copy.key() == "bb" && c.key() == "bc", index, "assign from a cursor");
+
+    db.begin_transaction();
+    db.add("bab", "6", true);
+    db.add("bc", "7", true);
+    db.delete_key("bb");
+    check(keys_of(db.prefix("b")) == "ba=2 bab=6 bc=7 ", index, "transaction");
+    typename db_t::cursor_t t = db.prefix("bab");
+    typename db_t::cursor_t t2 = t;
+    check(t2.valid() && t2.key() == "bab" && t2.value() == "6", index, "copy of an add");
+    db.end_transaction();
+}
+
+int main()
+{
+    run<map<string, string> >("map");
+    run<bptree_t<string> >("bptree");
+    if(failures) {
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,10 @@
+// xferFieldsText of classes declared where text-flatten.hpp cannot be
+// included, for dependency reasons
+
+#include "flatten-fields.hpp"
+#include "md5.hpp"
+
+void md5_pair_t::xferFieldsText(TextFlatten &flat, const char *fieldName)
+{
+    FLATTEN_XFER_FIELDS_TEXT(flat, fieldName, md5_pair_t, hi, lo);
+}
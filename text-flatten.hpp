@@ -0,0 +1,360 @@
+#ifndef TEXT_FLATTEN_HPP
+#define TEXT_FLATTEN_HPP
+
+#include <errno.h>
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+using namespace std;
+
+// The text counterpart of Flatten, for dumps to read and to diff. One
+// field a line, by name:
+//   md5 {
+//     hi: 1234
+//     lo: -5
+//     names [
+//       "a\n"
+//     ]
+//   }
+// A persistent class has xferFieldsText(TextFlatten &, const char
+// *fieldName) for both directions: beginRecord(fieldName), an xfer per
+// field in the order of xferFields, endRecord(). Elements of a list have no
+// name (NULL). Reading wants the fields in the same order, by the same
+// names, and throws runtime_error on anything else.
+class TextFlatten
+{
+public:
+    // Writing
+    explicit TextFlatten(ostream &out) : m_reading(false), in(NULL), out(&out), depth(0) {}
+    // Reading
+    explicit TextFlatten(istream &in) : m_reading(true), in(&in), out(NULL), depth(0) {}
+
+    bool reading() const
+    {
+        return m_reading;
+    }
+
+    // "name {" ... "}"
+    void beginRecord(const char *name)
+    {
+        open(name, '{');
+    }
+
+    void endRecord()
+    {
+        close('}');
+    }
+
+    // "name [" ... "]"
+    void beginList(const char *name)
+    {
+        open(name, '[');
+    }
+
+    // Reading a list: whether an element comes before the "]"
+    bool moreElements()
+    {
+        return peek() != ']';
+    }
+
+    void endList()
+    {
+        close(']');
+    }
+
+    // Any integer type, in decimal
+    template<class T>
+    void xferInt(T &v, const char *name)
+    {
+        if(!m_reading) {
+            key(name);
+            if(is_signed<T>::value) {
+                *out << (long long)v << '\n';
+            } else {
+                *out << (unsigned long long)v << '\n';
+            }
+            return;
+        }
+        expectKey(name);
+        string token = readToken();
+        const char *s = token.c_str();
+        char *stop;
+        errno = 0;
+        if(is_signed<T>::value) {
+            long long x = strtoll(s, &stop, 10);
+            v = (T)x;
+            if((long long)v != x) {
+                errno = ERANGE;
+            }
+        } else {
+            unsigned long long x = strtoull(s, &stop, 10);
+            v = (T)x;
+            if((unsigned long long)v != x || *s == '-') {
+                errno = ERANGE;
+            }
+        }
+        if(stop == s || *stop || errno) {
+            fail("bad integer", token);
+        }
+    }
+
+    void xferBool(bool &b, const char *name)
+    {
+        if(!m_reading) {
+            key(name);
+            *out << (b ? "true" : "false") << '\n';
+            return;
+        }
+        expectKey(name);
+        string token = readToken();
+        if(token != "true" && token != "false") {
+            fail("bad bool", token);
+        }
+        b = token == "true";
+    }
+
+    // Quoted; '"', '\\' and all but printable ascii escaped, as in C
+    void xferString(string &s, const char *name)
+    {
+        if(!m_reading) {
+            key(name);
+            writeQuoted(s);
+            *out << '\n';
+            return;
+        }
+        expectKey(name);
+        readQuoted(s);
+    }
+
+private:
+    TextFlatten(const TextFlatten &);
+    TextFlatten &operator=(const TextFlatten &);
+
+    void open(const char *name, char bracket)
+    {
+        if(!m_reading) {
+            indent();
+            if(name) {
+                *out << name << ' ';
+            }
+            *out << bracket << '\n';
+            ++depth;
+            return;
+        }
+        if(name) {
+            expect(name);
+        }
+        expect(string(1, bracket));
+    }
+
+    void close(char bracket)
+    {
+        if(!m_reading) {
+            --depth;
+            indent();
+            *out << bracket << '\n';
+            return;
+        }
+        expect(string(1, bracket));
+    }
+
+    void indent()
+    {
+        for(int i = 0; i < depth; ++i) {
+            *out << "  ";
+        }
+    }
+
+    // "name: ", or nothing for an element
+    void key(const char *name)
+    {
+        indent();
+        if(name) {
+            *out << name << ": ";
+        }
+    }
+
+    void expectKey(const char *name)
+    {
+        if(name) {
+            expect(string(name) + ':');
+        }
+    }
+
+    void expect(const string &want)
+    {
+        string token = readToken();
+        if(token != want) {
+            fail("expected " + want + ", got", token);
+        }
+    }
+
+    // the next character after white space, left in the stream
+    int peek()
+    {
+        *in >> ws;
+        int c = in->peek();
+        if(c == EOF) {
+            fail("unexpected end of input", "");
+        }
+        return c;
+    }
+
+    string readToken()
+    {
+        string token;
+        peek();
+        *in >> token;
+        return token;
+    }
+
+    void writeQuoted(const string &s)
+    {
+        *out << '"';
+        for(size_t i = 0; i < s.size(); ++i) {
+            unsigned char c = s[i];
+            if(c == '"' || c == '\\') {
+                *out << '\\' << c;
+            } else if(c == '\n') {
+                *out << "\\n";
+            } else if(c == '\t') {
+                *out << "\\t";
+            } else if(c < ' ' || c > '~') {
+                char hex[5];
+                snprintf(hex, sizeof(hex), "\\x%02x", c);
+                *out << hex;
+            } else {
+                *out << c;
+            }
+        }
+        *out << '"';
+    }
+
+    void readQuoted(string &s)
+    {
+        s.clear();
+        if(peek() != '"') {
+            fail("expected a string, got", readToken());
+        }
+        in->get();
+        for(;;) {
+            int c = in->get();
+            if(c == EOF) {
+                fail("unterminated string", s);
+            }
+            if(c == '"') {
+                return;
+            }
+            if(c == '\\') {
+                c = in->get();
+                if(c == 'n') {
+                    c = '\n';
+                } else if(c == 't') {
+                    c = '\t';
+                } else if(c == 'x') {
+                    char hex[3] = { (char)in->get(), (char)in->get(), 0 };
+                    char *stop;
+                    c = (int)strtol(hex, &stop, 16);
+                    if(stop != hex + 2) {
+                        fail("bad escape in string", s);
+                    }
+                } else if(c != '"' && c != '\\') {
+                    fail("bad escape in string", s);
+                }
+            }
+            s += (char)c;
+        }
+    }
+
+    void fail(const string &what, const string &token)
+    {
+        throw runtime_error("TextFlatten: " + what + (token.empty() ? "" : " '" + token + "'"));
+    }
+
+    // read or write
+    bool m_reading;
+    istream *in;
+    ostream *out;
+    // writing, of records and lists
+    int depth;
+};
+
+// xferGenericText: the xfer for the type, as xferGeneric for Flatten
+template<class T>
+void xferGenericText(TextFlatten &flat, T &x, const char *name)
+{
+    x.xferFieldsText(flat, name);
+}
+
+#define TEXT_FLATTEN_XFER_INT(type) \
+    inline void xferGenericText(TextFlatten &flat, type &x, const char *name) \
+    { \
+        flat.xferInt(x, name); \
+    }
+TEXT_FLATTEN_XFER_INT(char)
+TEXT_FLATTEN_XFER_INT(signed char)
+TEXT_FLATTEN_XFER_INT(unsigned char)
+TEXT_FLATTEN_XFER_INT(short)
+TEXT_FLATTEN_XFER_INT(unsigned short)
+TEXT_FLATTEN_XFER_INT(int)
+TEXT_FLATTEN_XFER_INT(unsigned)
+TEXT_FLATTEN_XFER_INT(long)
+TEXT_FLATTEN_XFER_INT(unsigned long)
+TEXT_FLATTEN_XFER_INT(long long)
+TEXT_FLATTEN_XFER_INT(unsigned long long)
+#undef TEXT_FLATTEN_XFER_INT
+
+inline void xferGenericText(TextFlatten &flat, bool &x, const char *name)
+{
+    flat.xferBool(x, name);
+}
+
+inline void xferGenericText(TextFlatten &flat, string &x, const char *name)
+{
+    flat.xferString(x, name);
+}
+
+template<class T>
+void xferGenericText(TextFlatten &flat, vector<T> &v, const char *name)
+{
+    flat.beginList(name);
+    if(!flat.reading()) {
+        for(size_t i = 0; i < v.size(); ++i) {
+            xferGenericText(flat, v[i], NULL);
+        }
+    } else {
+        v.clear();
+        while(flat.moreElements()) {
+            v.push_back(T());
+            xferGenericText(flat, v.back(), NULL);
+        }
+    }
+    flat.endList();
+}
+
+// vector<bool>'s elements are proxies, not bool &
+inline void xferGenericText(TextFlatten &flat, vector<bool> &v, const char *name)
+{
+    flat.beginList(name);
+    if(!flat.reading()) {
+        for(size_t i = 0; i < v.size(); ++i) {
+            bool b = v[i];
+            flat.xferBool(b, NULL);
+        }
+    } else {
+        v.clear();
+        while(flat.moreElements()) {
+            bool b = false;
+            flat.xferBool(b, NULL);
+            v.push_back(b);
+        }
+    }
+    flat.endList();
+}
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <stdint.h>
+
+// A hierarchical timer wheel (Varghese & Lauck) over entries that live in
+// some array and are known by their index, e.g. hash table slots.
+//
+// LEVELS wheels of SLOTS buckets each: a bucket of level l holds what is
+// due within one span of SLOTS^l ticks. Adding or removing an entry is
+// O(1); advancing the time expires the due bucket of level 0 and, every
+// SLOTS^l ticks, spreads one bucket of level l over the levels below. An
+// entry is so moved at most LEVELS - 1 times before it expires.
+//
+// The buckets are doubly linked lists threaded through the entries, which
+// the wheel reaches through 'Links':
+//     uint32_t &prev(uint32_t i);      list links, NIL at the ends
+//     uint32_t &next(uint32_t i);
+//     uint16_t &bucket(uint32_t i);    NO_BUCKET when not on the wheel
+//     uint64_t deadline(uint32_t i);   tick the entry expires at
+// Entries that move in the array must be reported with moved().
+template<class Links>
+class timer_wheel_t {
+public:
+    enum {
+        LEVEL_BITS = 6,
+        SLOTS = 1 << LEVEL_BITS,
+        LEVELS = 4
+    };
+    static const uint32_t NIL = ~(uint32_t)0;
+    static const uint16_t NO_BUCKET = 0xffff;
+
+    explicit timer_wheel_t(uint64_t now = 0) : now_(now), size_(0) {
+        for(int b = 0; b < LEVELS * SLOTS; ++b) {
+            heads[b] = NIL;
+        }
+    }
+
+    uint64_t now() const { return now_; }
+    uint32_t size() const { return size_; }
+
+    // Entries already due expire on the next advance().
+    void add(Links &l, uint32_t i) {
+        insert(l, i, max_of(l.deadline(i), now_ + 1));
+    }
+
+    void remove(Links &l, uint32_t i) {
+        uint16_t b = l.bucket(i);
+        if(l.prev(i) != NIL) {
+            l.next(l.prev(i)) = l.next(i);
+        } else {
+            heads[b] = l.next(i);
+        }
+        if(l.next(i) != NIL) {
+            l.prev(l.next(i)) = l.prev(i);
+        }
+        l.bucket(i) = NO_BUCKET;
+        --size_;
+    }
+
+    // The entry now at 'to', its links copied from where it was.
+    void moved(Links &l, uint32_t to) {
+        if(l.prev(to) != NIL) {
+            l.next(l.prev(to)) = to;
+        } else {
+            heads[l.bucket(to)] = to;
+        }
+        if(l.next(to) != NIL) {
+            l.prev(l.next(to)) = to;
+        }
+    }
+
+    // Forget every entry, e.g. to add them all again after they moved.
+    void clear(uint64_t now) {
+        for(int b = 0; b < LEVELS * SLOTS; ++b) {
+            heads[b] = NIL;
+        }
+        now_ = now;
+        size_ = 0;
+    }
+
+    // Move the time to 'to', calling expire(i) for every entry that is
+    // due by then, after taking it off the wheel. expire() may remove
+    // other entries or move them around.
+    template<class Expire>
+    void advance(Links &l, uint64_t to, Expire expire) {
+        while(now_ < to) {
+            if(!size_) {
+                now_ = to;
+                return;
+            }
+            uint64_t t = ++now_;
+            // spread the buckets of the higher levels whose turn it is,
+            // from the top so that entries can go down several levels
+            for(int level = LEVELS - 1; level > 0; --level) {
+                if(t & (((uint64_t)1 << (LEVEL_BITS * level)) - 1)) {
+                    continue;
+                }
+                uint16_t b = bucket_of(level, t >> (LEVEL_BITS * level));
+                while(heads[b] != NIL) {
+                    uint32_t i = heads[b];
+                    remove(l, i);
+                    // level 0's bucket for t is still to come
+                    insert(l, i, max_of(l.deadline(i), t));
+                }
+            }
+            uint16_t b = bucket_of(0, t);
+            while(heads[b] != NIL) {
+                uint32_t i = heads[b];
+                remove(l, i);
+                expire(i);
+            }
+        }
+    }
+
+private:
+    static uint64_t max_of(uint64_t a, uint64_t b) {
+        return a > b ? a : b;
+    }
+
+    // Put i in the bucket for tick d (>= now)
+    void insert(Links &l, uint32_t i, uint64_t d) {
+        uint64_t delta = d - now_;
+        int level = 0;
+        while(level < LEVELS - 1 && delta >= ((uint64_t)1 << (LEVEL_BITS * (level + 1)))) {
+            ++level;
+        }
+        uint16_t b;
+        if(level == LEVELS - 1 && delta >= ((uint64_t)1 << (LEVEL_BITS * LEVELS))) {
+            // too far: park it in the top bucket processed last, from
+            // where it is added again
+            b = bucket_of(level, (now_ >> (LEVEL_BITS * level)) + SLOTS - 1);
+        } else {
+            b = bucket_of(level, d >> (LEVEL_BITS * level));
+        }
+        l.bucket(i) = b;
+        l.prev(i) = NIL;
+        l.next(i) = heads[b];
+        if(heads[b] != NIL) {
+            l.prev(heads[b]) = i;
+        }
+        heads[b] = i;
+        ++size_;
+    }
+
+    static uint16_t bucket_of(int level, uint64_t index) {
+        return level * SLOTS + (index & (SLOTS - 1));
+    }
+
+    uint64_t now_;
+    uint32_t size_;
+    uint32_t heads[LEVELS * SLOTS];
+};
+#endif /* TIMER_WHEEL_HPP */
@@ -0,0 +1,264 @@
+// Variable length integer formats on columns of 32 bit integers:
+//   varwidth        varwidth.h, varWidthEncodeInt64 / varWidthDecodeInt64
+//                   one value per call
+//   varwidth-array  varwidth.h, varWidthEncodeArray / varWidthDecodeArray
+//   leb128          7 bits per byte, the high bit set if more follow, as
+//                   test_google_varint.cpp; zigzag for signed integers
+//   stream-vbyte    stream-vbyte.h
+//   bitpack         bitpack.hpp, after zigzag for signed integers; it
+//                   keeps its blocks in a bitpacked_array_t of its own
+//
+// usage: varint-bench [count [rounds]]
+//
+// Encodes 'count' integers (1M by default) then decodes them, 'rounds' (20)
+// times over, for each of these columns:
+//   1 byte     -64..63
+//   mixed      signed, of a random width of 1 to 32 bits
+//   2-3 bytes  signed, of a random width of 8 to 21 bits
+//   postings   sorted, gaps of 1 to 256; the formats code the gaps
+// Reports the bytes per integer, and integers per nanosecond for encode and
+// decode. Build with -mssse3 (or -march=native) for the stream-vbyte
+// shuffles.
+
+#include "bitpack.hpp"
+#include "stream-vbyte.h"
+#include "varwidth.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+using namespace std;
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Encoders return the end of what they wrote. With 'sorted' they code the
+// differences between consecutive integers.
+struct codec_t {
+    const char *name;
+    unsigned char *(*encode)(const int32_t *in, size_t n, bool sorted, unsigned char *out);
+    void (*decode)(const unsigned char *in, const unsigned char *end, size_t n, bool sorted,
+                   int32_t *out);
+};
+
+static unsigned char *varwidth_encode(const int32_t *in, size_t n, bool sorted,
+                                      unsigned char *out)
+{
+    int32_t prev = 0;
+    for(size_t i = 0; i < n; ++i) {
+        varWidthEncodeInt64(&out, sorted ? in[i] - prev : in[i]);
+        prev = in[i];
+    }
+    return out;
+}
+
+static void varwidth_decode(const unsigned char *in, const unsigned char *, size_t n, bool sorted,
+                            int32_t *out)
+{
+    int32_t prev = 0;
+    for(size_t i = 0; i < n; ++i) {
+        sint64 v;
+        varWidthDecodeInt64(&in, &v);
+        out[i] = prev = (int32_t)v + (sorted ? prev : 0);
+    }
+}
+
+// varWidth*Array take 64 bit values: through here
+static vector<sint64> wide;
+
+static unsigned char *varwidth_array_encode(const int32_t *in, size_t n, bool sorted,
+                                            unsigned char *out)
+{
+    int32_t prev = 0;
+    for(size_t i = 0; i < n; ++i) {
+        wide[i] = sorted ? in[i] - prev : in[i];
+        prev = in[i];
+    }
+    varWidthEncodeArray(&out, &wide[0], n);
+    return out;
+}
+
+static void varwidth_array_decode(const unsigned char *in, const unsigned char *end, size_t n,
+                                  bool sorted, int32_t *out)
+{
+    varWidthDecodeArray(&in, end, &wide[0], n);
+    int32_t prev = 0;
+    for(size_t i = 0; i < n; ++i) {
+        out[i] = prev = (int32_t)wide[i] + (sorted ? prev : 0);
+    }
+}
+
+static unsigned char *leb128_encode(const int32_t *in, size_t n, bool sorted, unsigned char *out)
+{
+    int32_t prev = 0;
+    for(size_t i = 0; i < n; ++i) {
+        uint32_t v;
+        if(sorted) {
+            v = in[i] - prev;
+            prev = in[i];
+        } else {
+            v = ((uint32_t)in[i] << 1) ^ (uint32_t)(in[i] >> 31);
+        }
+        while(v >= 0x80) {
+            *out++ = (unsigned char)(v | 0x80);
+            v >>= 7;
+        }
+        *out++ = (unsigned char)v;
+    }
+    return out;
+}
+
+static void leb128_decode(const unsigned char *in, const unsigned char *, size_t n, bool sorted,
+                          int32_t *out)
+{
+    uint32_t prev = 0;
+    for(size_t i = 0; i < n; ++i) {
+        uint32_t v = 0;
+        for(int shift = 0;; shift += 7) {
+            unsigned char b = *in++;
+            v |= (uint32_t)(b & 0x7f) << shift;
+            if(!(b & 0x80)) {
+                break;
+            }
+        }
+        if(sorted) {
+            out[i] = prev += v;
+        } else {
+            out[i] = (int32_t)((v >> 1) ^ -(v & 1));
+        }
+    }
+}
+
+static unsigned char *stream_vbyte_encode(const int32_t *in, size_t n, bool sorted,
+                                          unsigned char *out)
+{
+    if(sorted) {
+        streamVByteEncodeDelta(&out, (const uint32_t *)in, n, 0);
+    } else {
+        streamVByteEncodeZigzag(&out, in, n);
+    }
+    return out;
+}
+
+static void stream_vbyte_decode(const unsigned char *in, const unsigned char *end, size_t n,
+                                bool sorted, int32_t *out)
+{
+    if(sorted) {
+        streamVByteDecodeDelta(&in, end, (uint32_t *)out, n, 0);
+    } else {
+        streamVByteDecodeZigzag(&in, end, out, n);
+    }
+}
+
+// bitpack writes nothing to 'out': the encoder returns 'out' plus the
+// size of the array
+static bitpacked_array_t packed;
+static vector<uint32_t> zigzag;
+
+static unsigned char *bitpack_encode(const int32_t *in, size_t n, bool sorted,
+                                     unsigned char *out)
+{
+    if(sorted) {
+        packed.assign((const uint32_t *)in, n, true);
+    } else {
+        for(size_t i = 0; i < n; ++i) {
+            zigzag[i] = ((uint32_t)in[i] << 1) ^ (uint32_t)(in[i] >> 31);
+        }
+        packed.assign(&zigzag[0], n);
+    }
+    return out + packed.bytes();
+}
+
+static void bitpack_decode(const unsigned char *, const unsigned char *, size_t n, bool sorted,
+                           int32_t *out)
+{
+    packed.decode((uint32_t *)out);
+    if(!sorted) {
+        for(size_t i = 0; i < n; ++i) {
+            uint32_t v = (uint32_t)out[i];
+            out[i] = (int32_t)((v >> 1) ^ -(v & 1));
+        }
+    }
+}
+
+static const codec_t codecs[] = {
+    { "varwidth", varwidth_encode, varwidth_decode },
+    { "varwidth-array", varwidth_array_encode, varwidth_array_decode },
+    { "leb128", leb128_encode, leb128_decode },
+    { "stream-vbyte", stream_vbyte_encode, stream_vbyte_decode },
+    { "bitpack", bitpack_encode, bitpack_decode },
+};
+
+// 'count' integers of 'min_bits' to 'max_bits' significant bits, sign
+// included
+static vector<int32_t> make_values(size_t count, int min_bits, int max_bits)
+{
+    mt19937 rng(1);
+    uniform_int_distribution<int> width(min_bits, max_bits);
+    vector<int32_t> values(count);
+    for(size_t i = 0; i < count; ++i) {
+        values[i] = (int32_t)rng() >> (32 - width(rng));
+    }
+    return values;
+}
+
+static vector<int32_t> make_postings(size_t count)
+{
+    mt19937 rng(1);
+    uniform_int_distribution<int> gap(1, 256);
+    vector<int32_t> values(count);
+    int32_t id = 0;
+    for(size_t i = 0; i < count; ++i) {
+        values[i] = id += gap(rng);
+    }
+    return values;
+}
+
+static void run(const char *name, const vector<int32_t> &values, bool sorted, int rounds)
+{
+    size_t n = values.size();
+    vector<unsigned char> buf(max<size_t>(n * VARWIDTH_MAX_WIDTH, STREAM_VBYTE_MAX_BYTES(n)));
+    vector<int32_t> out(n);
+    double ints = (double)n * rounds;
+
+    printf("%s\n", name);
+    for(size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); ++c) {
+        const codec_t &codec = codecs[c];
+        unsigned char *end = NULL;
+        double start = now();
+        for(int r = 0; r < rounds; ++r) {
+            end = codec.encode(&values[0], n, sorted, &buf[0]);
+        }
+        double encode = now() - start;
+
+        out.assign(n, 0);
+        start = now();
+        for(int r = 0; r < rounds; ++r) {
+            codec.decode(&buf[0], end, n, sorted, &out[0]);
+        }
+        double decode = now() - start;
+
+        printf("  %-16s %6.2f %10.3f %10.3f%s\n", codec.name, (double)(end - &buf[0]) / n,
+               ints / encode / 1e9, ints / decode / 1e9, out == values ? "" : "   MISMATCH");
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    size_t count = argc > 1 ? atol(argv[1]) : 1000000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+
+    wide.resize(count);
+    zigzag.resize(count);
+    printf("%zu integers, %d rounds (ints/ns)\n", count, rounds);
+    printf("  %-16s %6s %10s %10s\n", "format", "bytes", "encode", "decode");
+    run("1 byte", make_values(count, 1, 7), false, rounds);
+    run("mixed", make_values(count, 1, 32), false, rounds);
+    run("2-3 bytes", make_values(count, 8, 21), false, rounds);
+    run("postings", make_postings(count), true, rounds);
+    return 0;
+}
@@ -1,6 +1,15 @@
 #ifndef VARWIDTH_H
 #define VARWIDTH_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef int64_t sint64;
+
 // Maximum number of bytes to encode a number
 #define VARWIDTH_MAX_WIDTH 9
 
@@ -16,68 +25,242 @@
 //   1111 1111     9 bytes
 // 'x' bits are the encoded value and they are also in network byte order (big
 // endian). The quantity is two's complement signed.
+//
+// The length is the number of leading 1 bits of the first byte, plus one:
+// one count-leading-zeros of its complement. varWidthEncodeArray and
+// varWidthDecodeArray do many values at a time without byte loops; the
+// value of 8 bytes or less is one unaligned 64 bit load, byte swapped and
+// shifted into place, and 16 values of one byte are sign extended at once
+// with SSE2.
+
+// Number of bytes of the value whose first byte is 'first'
+inline int varWidthLength(unsigned char first)
+{
+    // the 0x800000 stops the count at 8, for 0xff
+    return __builtin_clz(((uint32_t)(unsigned char)~first << 24) | 0x800000) + 1;
+}
 
+// The 8 bytes at 'buf' as a big endian number
+inline uint64_t varWidthLoad64(unsigned char const *buf)
+{
+    uint64_t v;
+    memcpy(&v, buf, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+inline void varWidthStore64(unsigned char *buf, uint64_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    memcpy(buf, &v, 8);
+}
 
 // Encode 'value' by writing up to VARWIDTH_MAX_WIDTH bytes into '**dest', moving
 // '*dest' to point to the byte just after the last one written.
 // '**dest' must have enough space to allow this.
-void varWidthEncodeInt64(unsigned char **dest, sint64 value)
+inline void varWidthEncodeInt64(unsigned char **dest, sint64 value)
 {
     unsigned char* buf = *dest;
     for(int nbytes = 1; nbytes <= 8; ++nbytes) {
-        sint64 lo = -(1 << (nbytes * 8 - nbytes)),
+        // nbytes bytes hold 7 * nbytes value bits
+        sint64 lo = -((sint64)1 << (nbytes * 7 - 1)),
                hi = -(lo + 1);
         if(value <= hi && value >= lo) {
-           unsigned char val = value >> ((nbytes - 1) * 8);
-           val |= 0xfe << (8 - nbytes);
+           unsigned char val = (unsigned char)(value >> ((nbytes - 1) * 8));
+           val &= 0xff >> nbytes;
+           val |= 0xff << (9 - nbytes);
            buf[0] = val;
 
            for(int j = 1; j < nbytes; ++j) {
-                buf[j] = (value >> (nbytes -j - 1) * 8);
+                buf[j] = (unsigned char)(value >> (nbytes - j - 1) * 8);
            }
 
            *dest = buf + nbytes;
+           return;
         }
     }
     // 9
     buf[0] = 0xff;
     for(int j = 1; j < 9; ++j) {
-        buf[j] = (value >> (8 - j) * 8);
+        buf[j] = (unsigned char)(value >> (8 - j) * 8);
     }
     *dest = buf + 9;
 }
 
 // Decode the next value from '**src', storing the decoded value in
 // '*value' and advancing '*src' to just past the last read byte.
-//
-// If there is an error, its code is returned, and neither '*src' nor
-// '*value' are modified.
-void varWidthDecodeInt64(unsigned char const **src, sint64 *value)
+inline void varWidthDecodeInt64(unsigned char const **src, sint64 *value)
 {
-    unsigned char* buf = *src;
+    unsigned char const* buf = *src;
 
-    int nbytes = 1;
-    unsigned char base = buf[0];
-    while(base & 0x80) {
-        ++nbytes;
-        base <<= 1;
-    } 
+    int nbytes = varWidthLength(buf[0]);
 
-    *value = 0;
+    uint64_t v = 0;
     if(nbytes == 9) {
         for(int j = 1; j < 9; ++j) {
-            *value |= buf[j] << (8 - j);
+            v = (v << 8) | buf[j];
         }
+        *value = (sint64)v;
     } else {
-        // first bytes
-        *value |= (buf[0] & (~(0xfe << (8 - nbytes)))) << (nbytes - 1);
+        // first byte
+        v = buf[0] & (0xff >> nbytes);
         // others
         for(int j = 1; j < nbytes; ++j) {
-            *value |= buf[j] << (nbytes - j - 1);
+            v = (v << 8) | buf[j];
         }
+        // sign extend from 7 * nbytes bits
+        int unused = 64 - 7 * nbytes;
+        *value = (sint64)(v << unused) >> unused;
     }
 
     *src += nbytes;
 }
 
+// The same for unsigned values: the 'x' bits are not sign extended, so a
+// byte holds 0..127, two 0..16383, and so on.
+inline void varWidthEncodeUInt64(unsigned char **dest, uint64_t value)
+{
+    unsigned char *buf = *dest;
+    int nbytes = (64 - __builtin_clzll(value | 1) + 6) / 7;
+    if(nbytes <= 8) {
+        // n - 1 ones and a zero above the 7 * n value bits
+        uint64_t v = value | ((((uint64_t)1 << nbytes) - 2) << (7 * nbytes));
+        for(int j = 0; j < nbytes; ++j) {
+            buf[j] = (unsigned char)(v >> (nbytes - j - 1) * 8);
+        }
+        *dest = buf + nbytes;
+        return;
+    }
+    buf[0] = 0xff;
+    for(int j = 1; j < 9; ++j) {
+        buf[j] = (unsigned char)(value >> (8 - j) * 8);
+    }
+    *dest = buf + 9;
+}
+
+inline void varWidthDecodeUInt64(unsigned char const **src, uint64_t *value)
+{
+    unsigned char const* buf = *src;
+    int nbytes = varWidthLength(buf[0]);
+    uint64_t v = nbytes == 9 ? 0 : buf[0] & (0xff >> nbytes);
+    for(int j = 1; j < nbytes; ++j) {
+        v = (v << 8) | buf[j];
+    }
+    *value = v;
+    *src += nbytes;
+}
+
+// Encode the 'count' values at 'values', one after the other, as
+// varWidthEncodeInt64 would, and move '*dest' past them. Values shorter
+// than 8 bytes are written as 8 bytes that the next one overwrites, so
+// '**dest' must have VARWIDTH_MAX_WIDTH * count bytes whatever the values.
+inline void varWidthEncodeArray(unsigned char **dest, const sint64 *values, size_t count)
+{
+    // bytes for the number of significant bits, sign included
+    static const unsigned char widths[65] = {
+        1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3,
+        4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6,
+        7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9
+    };
+    // for n bytes: n - 1 ones and a zero above 7 * n value bits, all at
+    // the top of 64
+    static const uint64_t prefixes[9] = {
+        0, 0, 0x8000000000000000ULL, 0xc000000000000000ULL, 0xe000000000000000ULL,
+        0xf000000000000000ULL, 0xf800000000000000ULL, 0xfc00000000000000ULL,
+        0xfe00000000000000ULL
+    };
+
+    unsigned char *buf = *dest;
+    for(size_t i = 0; i < count; ++i) {
+        sint64 value = values[i];
+        // -64..63 is one byte, and as common as it is cheap
+        if((uint64_t)value + 64 < 128) {
+            *buf++ = (unsigned char)(value & 0x7f);
+            continue;
+        }
+        int nbytes = widths[64 - __builtin_clrsbll(value)];
+        if(__builtin_expect(nbytes <= 8, 1)) {
+            // the value bits to the top, then the prefix over what is
+            // left of the sign
+            int unused = 64 - 7 * nbytes;
+            uint64_t v = ((uint64_t)value << unused) >> nbytes;
+            varWidthStore64(buf, v | prefixes[nbytes]);
+            buf += nbytes;
+        } else {
+            buf[0] = 0xff;
+            varWidthStore64(buf + 1, (uint64_t)value);
+            buf += 9;
+        }
+    }
+    *dest = buf;
+}
+
+#ifdef __SSE2__
+// Decode the 16 bytes at 'buf' into 'values' if they are all values of
+// one byte; 0 if not
+inline int varWidthDecode16Bytes(unsigned char const *buf, sint64 *values)
+{
+    __m128i b = _mm_loadu_si128((const __m128i *)buf);
+    if(_mm_movemask_epi8(b)) {
+        return 0;
+    }
+    // sign extend from 7 bits: -64..63
+    __m128i bias = _mm_set1_epi8(0x40);
+    __m128i v8 = _mm_sub_epi8(_mm_xor_si128(b, bias), bias);
+    // and on to 64, interleaving with the sign
+    __m128i zero = _mm_setzero_si128();
+    __m128i s8 = _mm_cmpgt_epi8(zero, v8);
+    __m128i v16[2] = { _mm_unpacklo_epi8(v8, s8), _mm_unpackhi_epi8(v8, s8) };
+    for(int i = 0; i < 2; ++i) {
+        __m128i s16 = _mm_srai_epi16(v16[i], 15);
+        __m128i v32[2] = { _mm_unpacklo_epi16(v16[i], s16), _mm_unpackhi_epi16(v16[i], s16) };
+        for(int j = 0; j < 2; ++j) {
+            __m128i s32 = _mm_srai_epi32(v32[j], 31);
+            __m128i *out = (__m128i *)(values + i * 8 + j * 4);
+            _mm_storeu_si128(out, _mm_unpacklo_epi32(v32[j], s32));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(v32[j], s32));
+        }
+    }
+    return 1;
+}
+#endif
+
+// Decode 'count' values from '**src' into 'values', and move '*src' past
+// them. 'end' is the end of the readable bytes: they are read 8 or 16 at
+// a time, going past the last value when there is room for it.
+inline void varWidthDecodeArray(unsigned char const **src, unsigned char const *end,
+                                sint64 *values, size_t count)
+{
+    unsigned char const *buf = *src;
+    size_t i = 0;
+    while(i < count && end - buf >= 16) {
+#ifdef __SSE2__
+        if(buf[0] < 0x80 && count - i >= 16 && varWidthDecode16Bytes(buf, values + i)) {
+            buf += 16;
+            i += 16;
+            continue;
+        }
+#endif
+        int nbytes = varWidthLength(buf[0]);
+        if(__builtin_expect(nbytes <= 8, 1)) {
+            // drop the length bits, then sign extend from 7 * n bits
+            uint64_t v = varWidthLoad64(buf) << nbytes;
+            values[i] = (sint64)v >> (64 - 7 * nbytes);
+        } else {
+            values[i] = (sint64)varWidthLoad64(buf + 1);
+        }
+        buf += nbytes;
+        ++i;
+    }
+    // the last few bytes, one at a time
+    for(; i < count; ++i) {
+        varWidthDecodeInt64(&buf, values + i);
+    }
+    *src = buf;
+}
+
 #endif /* VARWIDTH_H */
@@ -0,0 +1,55 @@
+#ifndef ZIPFIAN_HPP
+#define ZIPFIAN_HPP
+
+#include <math.h>
+#include <random>
+#include <stdint.h>
+using namespace std;
+
+// Zipfian over [0, n) (Gray et al., "Quickly generating billion-record
+// synthetic databases"), item 0 being the most popular; scrambled by
+// hashing so that the popular items are spread over the key space.
+class zipfian_t {
+public:
+    zipfian_t(uint64_t n, double theta = 0.99)
+        : n(n), theta(theta), zetan(0) {
+        for(uint64_t i = 1; i <= n; ++i) {
+            zetan += 1 / pow((double)i, theta);
+        }
+        double zeta2 = 1 + 1 / pow(2.0, theta);
+        alpha = 1 / (1 - theta);
+        eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+    }
+
+    template<class Rng>
+    uint64_t next(Rng &rng) {
+        double u = uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        uint64_t v;
+        if(uz < 1) {
+            v = 0;
+        } else if(uz < 1 + pow(0.5, theta)) {
+            v = 1;
+        } else {
+            v = (uint64_t)(n * pow(eta * u - eta + 1, alpha));
+        }
+        return scramble(v % n) % n;
+    }
+
+private:
+    // FNV-1a of the 8 bytes
+    static uint64_t scramble(uint64_t v) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for(int i = 0; i < 8; ++i) {
+            h = (h ^ ((v >> (8 * i)) & 0xff)) * 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    uint64_t n;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+};
+#endif /* ZIPFIAN_HPP */